@@ -6,6 +6,7 @@ curl ?= 1
 debug ?= 0
 exif ?= 0
 help ?= 0
+jpeg ?= 0
 magic ?= 0
 mkstemps ?= 1
 verscmp ?= 1
@@ -97,6 +98,14 @@ else
 	MAN_EXIF = not available
 endif
 
+ifeq (${jpeg},1)
+	CFLAGS += -DHAVE_LIBJPEG
+	LDLIBS += -ljpeg
+	MAN_JPEG = enabled
+else
+	MAN_JPEG = disabled
+endif
+
 ifeq (${inotify},1)
 	CFLAGS += -DHAVE_INOTIFY
 	MAN_INOTIFY = enabled
@@ -116,4 +125,4 @@ MAN_DATE ?= ${shell date --utc --date=@$(SOURCE_DATE_EPOCH) '+%B %d, %Y'}
 CFLAGS += -DPREFIX=\"${PREFIX}\" \
 	-DPACKAGE=\"${PACKAGE}\" -DVERSION=\"${VERSION}\"
 
-LDLIBS += -lm -lpng -lX11 -lImlib2
+LDLIBS += -lm -lpng -lX11 -lImlib2 -lpthread
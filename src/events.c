@@ -643,6 +643,7 @@ static void feh_event_handle_MotionNotify(XEvent * ev)
 			if (!winwid->has_rotated) {
 				Imlib_Image temp;
 
+				winwidget_ensure_full_image(winwid);
 				temp = gib_imlib_create_rotated_image(winwid->im, 0.0);
 				if (temp != NULL) {
 					winwid->im_w = gib_imlib_image_get_width(temp);
@@ -666,6 +667,7 @@ static void feh_event_handle_MotionNotify(XEvent * ev)
 
 			D(("Blurring\n"));
 
+			winwidget_ensure_full_image(winwid);
 			temp = gib_imlib_clone_image(winwid->im);
 			if (temp != NULL) {
 				blur_radius = (((double) ev->xmotion.x / winwid->w) * 20) - 10;
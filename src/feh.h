@@ -142,6 +142,8 @@ void init_multiwindow_mode(void);
 void init_thumbnail_mode(void);
 void init_index_mode(void);
 void init_slideshow_mode(void);
+void slideshow_stream_update(gib_list * added);
+void slideshow_stream_done(void);
 void init_list_mode(void);
 void init_loadables_mode(void);
 void init_unloadables_mode(void);
@@ -152,9 +154,27 @@ void init_magic(void);
 void feh_clean_exit(void);
 int feh_should_ignore_image(Imlib_Image * im);
 int feh_load_image(Imlib_Image * im, feh_file * file);
+int feh_load_image_scaled(Imlib_Image * im, feh_file * file, int max_w, int max_h);
+int feh_load_thumbnail(Imlib_Image * im, feh_file * file, int max_w, int max_h);
+void feh_image_orientate(Imlib_Image im, int orientation);
+int feh_image_max_scale(int w, int h, int max_w, int max_h);
+void feh_image_set_scale(Imlib_Image im, int scale, int orig_w, int orig_h);
+int feh_image_get_scale(Imlib_Image im);
+int feh_image_get_width(Imlib_Image im);
+int feh_image_get_height(Imlib_Image im);
 void show_mini_usage(void);
 void slideshow_change_image(winwidget winwid, int change, int render);
 void slideshow_pause_toggle(winwidget w);
+int slideshow_jump_length(void);
+void feh_prefetch_update(winwidget w, int change);
+int feh_prefetch_take(feh_file * file, Imlib_Image * im, int max_w, int max_h);
+int feh_imagecache_get(feh_file * file, Imlib_Image * im, int max_w, int max_h);
+int feh_imagecache_contains(feh_file * file, int max_w, int max_h);
+int feh_imagecache_is_current(feh_file * file, Imlib_Image im);
+void feh_imagecache_loan(feh_file * file, Imlib_Image im);
+void feh_imagecache_forget(Imlib_Image im);
+int feh_imagecache_put(Imlib_Image im);
+void feh_imagecache_print_stats(void);
 void init_keyevents(void);
 void init_buttonbindings(void);
 void setup_stdin(void);
@@ -225,6 +245,9 @@ extern char *mode;		/* label for the current mode */
 /* to terminate long-running children with SIGALRM */
 extern int childpid;
 
+/* temporary files of converted and downloaded images, see imlib.c */
+extern gib_hash *conversion_cache;
+
 extern unsigned char control_via_stdin;
 
 #endif
@@ -0,0 +1,512 @@
+/* feh_jpeg.c
+
+Copyright (C) 2024 feh contributors.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to
+deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+sell copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies of the Software and its documentation and acknowledgment shall be
+given in the documentation and software packages that this Software was
+used.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#include <stdio.h>
+#include <setjmp.h>
+#include <jpeglib.h>
+
+#include "feh_jpeg.h"
+#include "options.h"
+
+/*
+ * Imlib2 1.7.5 and later apply the EXIF orientation when loading JPEG files,
+ * so images decoded here must be oriented the same way.
+ */
+#if defined(IMLIB2_VERSION_MAJOR) && defined(IMLIB2_VERSION_MINOR) && defined(IMLIB2_VERSION_MICRO) && (IMLIB2_VERSION_MAJOR > 1 || IMLIB2_VERSION_MINOR > 7 || IMLIB2_VERSION_MICRO >= 5)
+#define FEH_JPEG_AUTO_ORIENTATION 1
+#else
+#define FEH_JPEG_AUTO_ORIENTATION 0
+#endif
+
+/* embedded previews larger than this are not worth it */
+#define FEH_JPEG_MAX_PREVIEW (8 * 1024 * 1024)
+
+struct feh_jpeg_error_mgr {
+	struct jpeg_error_mgr pub;
+	jmp_buf setjmp_buffer;
+};
+
+/* what we know about a JPEG file after reading the headers before its SOF */
+typedef struct {
+	int width, height;
+	int orientation;
+	unsigned char *exif;
+	unsigned int exif_len;
+	unsigned char *mpf;
+	unsigned int mpf_len;
+	long mpf_base;
+} feh_jpeg_info;
+
+static void feh_jpeg_error_exit(j_common_ptr cinfo)
+{
+	struct feh_jpeg_error_mgr *err = (struct feh_jpeg_error_mgr *) cinfo->err;
+	longjmp(err->setjmp_buffer, 1);
+}
+
+/* Corrupt data warnings are left to Imlib2, which reports them if needed */
+static void feh_jpeg_output_message(j_common_ptr cinfo)
+{
+	(void) cinfo;
+}
+
+static unsigned int feh_jpeg_get16(unsigned char *p, int big_endian)
+{
+	return(big_endian ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0]);
+}
+
+static unsigned int feh_jpeg_get32(unsigned char *p, int big_endian)
+{
+	if (big_endian)
+		return(((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]);
+	return(((unsigned int)p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0]);
+}
+
+/*
+ * Looks up tag in the TIFF IFD at offset ifd of the len bytes at tiff and
+ * stores its value (or, for larger entries, the offset of its data) in
+ * *value. Returns the number of elements of the tag, or 0 if it is missing.
+ */
+static unsigned int feh_jpeg_tiff_tag(unsigned char *tiff, unsigned int len,
+		unsigned int ifd, unsigned int tag, unsigned int *value)
+{
+	int big_endian = (tiff[0] == 'M');
+	unsigned int i, entries;
+	unsigned char *entry;
+
+	if ((ifd < 8) || (len < 2) || (ifd > len - 2))
+		return(0);
+	entries = feh_jpeg_get16(tiff + ifd, big_endian);
+	if (entries > (len - ifd - 2) / 12)
+		return(0);
+
+	for (i = 0; i < entries; i++) {
+		entry = tiff + ifd + 2 + i * 12;
+		if (feh_jpeg_get16(entry, big_endian) != tag)
+			continue;
+		if (feh_jpeg_get16(entry + 2, big_endian) == 3)
+			*value = feh_jpeg_get16(entry + 8, big_endian);
+		else
+			*value = feh_jpeg_get32(entry + 8, big_endian);
+		return(feh_jpeg_get32(entry + 4, big_endian));
+	}
+	return(0);
+}
+
+static unsigned int feh_jpeg_tiff_next_ifd(unsigned char *tiff, unsigned int len,
+		unsigned int ifd)
+{
+	int big_endian = (tiff[0] == 'M');
+	unsigned int entries;
+
+	if ((ifd < 8) || (len < 6) || (ifd > len - 6))
+		return(0);
+	entries = feh_jpeg_get16(tiff + ifd, big_endian);
+	if (entries > (len - ifd - 6) / 12)
+		return(0);
+	return(feh_jpeg_get32(tiff + ifd + 2 + entries * 12, big_endian));
+}
+
+/* Returns the offset of IFD0 or 0 if tiff does not start with a TIFF header */
+static unsigned int feh_jpeg_tiff_ifd0(unsigned char *tiff, unsigned int len)
+{
+	if ((len < 8) || !(((tiff[0] == 'I') && (tiff[1] == 'I'))
+				|| ((tiff[0] == 'M') && (tiff[1] == 'M'))))
+		return(0);
+	return(feh_jpeg_get32(tiff + 4, tiff[0] == 'M'));
+}
+
+static void feh_jpeg_info_free(feh_jpeg_info * info)
+{
+	free(info->exif);
+	free(info->mpf);
+}
+
+/*
+ * Reads the markers of the JPEG file fp up to its first frame header and
+ * fills in info. Returns 0 if fp is not a JPEG file.
+ */
+static int feh_jpeg_read_info(FILE * fp, feh_jpeg_info * info)
+{
+	unsigned char *segment;
+	unsigned int len, value;
+	int marker;
+
+	memset(info, 0, sizeof(feh_jpeg_info));
+
+	if ((getc(fp) != 0xff) || (getc(fp) != 0xd8))
+		return(0);
+
+	while (1) {
+		if (getc(fp) != 0xff)
+			return(0);
+		while ((marker = getc(fp)) == 0xff);
+		if ((marker == EOF) || (marker == 0xd9) || (marker == 0xda))
+			return(0);
+		if ((marker == 0x01) || ((marker >= 0xd0) && (marker <= 0xd7)))
+			continue;
+
+		len = getc(fp) << 8;
+		len |= getc(fp);
+		if ((len < 2) || feof(fp))
+			return(0);
+		len -= 2;
+
+		if ((marker >= 0xc0) && (marker <= 0xcf) && (marker != 0xc4)
+				&& (marker != 0xc8) && (marker != 0xcc)) {
+			unsigned char sof[5];
+			if ((len < 5) || (fread(sof, 1, 5, fp) != 5))
+				return(0);
+			info->height = feh_jpeg_get16(sof + 1, 1);
+			info->width = feh_jpeg_get16(sof + 3, 1);
+			break;
+		}
+
+		if (((marker == 0xe1) && !info->exif) || ((marker == 0xe2) && !info->mpf)) {
+			segment = emalloc(len + 1);
+			if (fread(segment, 1, len, fp) != len) {
+				free(segment);
+				return(0);
+			}
+			if ((marker == 0xe1) && (len > 6) && !memcmp(segment, "Exif\0\0", 6)) {
+				info->exif = segment;
+				info->exif_len = len;
+			} else if ((marker == 0xe2) && (len > 4) && !memcmp(segment, "MPF\0", 4)) {
+				info->mpf = segment;
+				info->mpf_len = len;
+				info->mpf_base = ftell(fp) - len + 4;
+			} else
+				free(segment);
+		} else if (fseek(fp, len, SEEK_CUR))
+			return(0);
+	}
+
+	if (info->exif && feh_jpeg_tiff_tag(info->exif + 6, info->exif_len - 6,
+				feh_jpeg_tiff_ifd0(info->exif + 6, info->exif_len - 6),
+				0x0112, &value) && (value >= 1) && (value <= 8))
+		info->orientation = value;
+
+	return((info->width > 0) && (info->height > 0));
+}
+
+/*
+ * Decodes a JPEG image from fp or, if fp is NULL, from the len bytes at buf.
+ * It is scaled down as far as possible while still providing enough pixels
+ * to be shown in a max_w x max_h area. Returns NULL if that would involve a
+ * scaling denominator below min_scale.
+ */
+static Imlib_Image feh_jpeg_decode(FILE * fp, unsigned char *buf,
+		unsigned long len, int max_w, int max_h, int min_scale,
+		int *orig_w, int *orig_h, int *scale)
+{
+	struct jpeg_decompress_struct cinfo;
+	struct feh_jpeg_error_mgr jerr;
+	Imlib_Image volatile im = NULL;
+	JSAMPROW volatile row = NULL;
+	DATA32 *data, *dst;
+	unsigned int x;
+	int denom;
+
+	cinfo.err = jpeg_std_error(&jerr.pub);
+	jerr.pub.error_exit = feh_jpeg_error_exit;
+	jerr.pub.output_message = feh_jpeg_output_message;
+
+	if (setjmp(jerr.setjmp_buffer)) {
+		D(("libjpeg error, falling back to imlib2\n"));
+		jpeg_destroy_decompress(&cinfo);
+		free(row);
+		if (im)
+			gib_imlib_free_image_and_decache(im);
+		return(NULL);
+	}
+
+	jpeg_create_decompress(&cinfo);
+	if (fp)
+		jpeg_stdio_src(&cinfo, fp);
+	else
+		jpeg_mem_src(&cinfo, buf, len);
+	jpeg_read_header(&cinfo, TRUE);
+
+	denom = feh_image_max_scale(cinfo.image_width, cinfo.image_height,
+			max_w, max_h);
+
+	/* CMYK images need Imlib2's color conversion */
+	if ((denom < min_scale) || ((cinfo.num_components != 1)
+				&& (cinfo.num_components != 3))) {
+		jpeg_destroy_decompress(&cinfo);
+		return(NULL);
+	}
+
+	cinfo.scale_num = 1;
+	cinfo.scale_denom = denom;
+	cinfo.out_color_space = (cinfo.num_components == 1) ? JCS_GRAYSCALE : JCS_RGB;
+	jpeg_start_decompress(&cinfo);
+
+	im = imlib_create_image(cinfo.output_width, cinfo.output_height);
+	if (!im)
+		longjmp(jerr.setjmp_buffer, 1);
+	row = emalloc(cinfo.output_width * cinfo.output_components);
+
+	imlib_context_set_image(im);
+	data = imlib_image_get_data();
+	while (cinfo.output_scanline < cinfo.output_height) {
+		dst = data + cinfo.output_scanline * cinfo.output_width;
+		jpeg_read_scanlines(&cinfo, (JSAMPARRAY) &row, 1);
+		if (cinfo.output_components == 1)
+			for (x = 0; x < cinfo.output_width; x++)
+				dst[x] = 0xff000000 | (row[x] << 16) | (row[x] << 8) | row[x];
+		else
+			for (x = 0; x < cinfo.output_width; x++)
+				dst[x] = 0xff000000 | (row[3 * x] << 16)
+					| (row[3 * x + 1] << 8) | row[3 * x + 2];
+	}
+	imlib_image_put_back_data(data);
+	imlib_image_set_has_alpha(0);
+	imlib_image_set_format("jpeg");
+
+	*orig_w = cinfo.image_width;
+	*orig_h = cinfo.image_height;
+	*scale = denom;
+
+	jpeg_finish_decompress(&cinfo);
+	jpeg_destroy_decompress(&cinfo);
+	free(row);
+
+	return(im);
+}
+
+/* Swaps *w and *h if the EXIF orientation involves a 90 degree rotation */
+static void feh_jpeg_orientate_size(int orientation, int *w, int *h)
+{
+	int tmp;
+
+	if (orientation >= 5) {
+		tmp = *w;
+		*w = *h;
+		*h = tmp;
+	}
+}
+
+/*
+ * Uses libjpeg's DCT scaling to decode filename at 1/2, 1/4 or 1/8 of its
+ * size, provided that the result is still large enough to be shown at
+ * max_w x max_h. Returns NULL if filename is not a (supported) JPEG image or
+ * if it needs to be decoded at full size anyways; the caller should then fall
+ * back to Imlib2.
+ */
+Imlib_Image feh_jpeg_load_scaled(char *filename, int max_w, int max_h,
+		int *orig_w, int *orig_h, int *scale)
+{
+	feh_jpeg_info info;
+	Imlib_Image im = NULL;
+	FILE *fp;
+
+	if (!(fp = fopen(filename, "rb")))
+		return(NULL);
+
+	if (feh_jpeg_read_info(fp, &info)
+			&& (feh_image_max_scale(info.width, info.height, max_w, max_h) > 1)) {
+		rewind(fp);
+		im = feh_jpeg_decode(fp, NULL, 0, max_w, max_h, 2, orig_w, orig_h, scale);
+	}
+	fclose(fp);
+
+	if (im && FEH_JPEG_AUTO_ORIENTATION) {
+		feh_image_orientate(im, info.orientation);
+		feh_jpeg_orientate_size(info.orientation, orig_w, orig_h);
+	}
+	feh_jpeg_info_free(&info);
+
+	D(("%s: decoded at 1/%d\n", filename, im ? *scale : 1));
+	return(im);
+}
+
+/*
+ * Returns 1 if a w x h preview of a orig_w x orig_h image is large enough to
+ * be shown in a max_w x max_h area after applying the EXIF orientation and
+ * has the same aspect ratio (i.e., it is not letterboxed).
+ */
+static int feh_jpeg_preview_usable(int w, int h, int orig_w, int orig_h,
+		int orientation, int max_w, int max_h)
+{
+	double zoom;
+
+	feh_jpeg_orientate_size(orientation, &w, &h);
+	feh_jpeg_orientate_size(orientation, &orig_w, &orig_h);
+
+	if ((w <= 0) || (h <= 0) || (w > orig_w) || (h > orig_h))
+		return(0);
+	if (fabs((double) w / h - (double) orig_w / orig_h) > 0.02 * orig_w / orig_h)
+		return(0);
+
+	zoom = (double) max_w / orig_w;
+	if ((double) max_h / orig_h < zoom)
+		zoom = (double) max_h / orig_h;
+	if (zoom >= 1.0)
+		return(0);
+	return((w >= orig_w * zoom - 1) && (h >= orig_h * zoom - 1));
+}
+
+static int feh_jpeg_mem_size(unsigned char *buf, unsigned long len, int *w, int *h)
+{
+	struct jpeg_decompress_struct cinfo;
+	struct feh_jpeg_error_mgr jerr;
+
+	if ((len < 4) || (buf[0] != 0xff) || (buf[1] != 0xd8))
+		return(0);
+
+	cinfo.err = jpeg_std_error(&jerr.pub);
+	jerr.pub.error_exit = feh_jpeg_error_exit;
+	jerr.pub.output_message = feh_jpeg_output_message;
+
+	if (setjmp(jerr.setjmp_buffer)) {
+		jpeg_destroy_decompress(&cinfo);
+		return(0);
+	}
+
+	jpeg_create_decompress(&cinfo);
+	jpeg_mem_src(&cinfo, buf, len);
+	jpeg_read_header(&cinfo, TRUE);
+	*w = cinfo.image_width;
+	*h = cinfo.image_height;
+	jpeg_destroy_decompress(&cinfo);
+	return(1);
+}
+
+/*
+ * Finds the smallest usable preview image in the Multi-Picture Format
+ * (CIPA DC-007) index of fp and returns its data.
+ */
+static unsigned char *feh_jpeg_mpf_preview(FILE * fp, feh_jpeg_info * info,
+		int orientation, int max_w, int max_h, unsigned long *len)
+{
+	unsigned char *tiff = info->mpf + 4, *entry, *buf, *best = NULL;
+	unsigned int tiff_len = info->mpf_len - 4;
+	unsigned int i, count, entries, type, size, offset;
+	int big_endian = (tiff[0] == 'M');
+	int w, h, best_w = 0;
+
+	count = feh_jpeg_tiff_tag(tiff, tiff_len, feh_jpeg_tiff_ifd0(tiff, tiff_len),
+			0xb002, &entries);
+	if (!count || (entries > tiff_len) || (count > tiff_len - entries))
+		return(NULL);
+
+	for (i = 1; i < count / 16; i++) {
+		entry = tiff + entries + i * 16;
+		type = feh_jpeg_get32(entry, big_endian) & 0x07ffffff;
+		size = feh_jpeg_get32(entry + 4, big_endian);
+		offset = feh_jpeg_get32(entry + 8, big_endian);
+
+		/* large thumbnails (VGA equivalent and Full-HD equivalent) */
+		if (((type != 0x010001) && (type != 0x010002))
+				|| (size > FEH_JPEG_MAX_PREVIEW) || !offset)
+			continue;
+
+		buf = emalloc(size);
+		if (fseek(fp, info->mpf_base + offset, SEEK_SET)
+				|| (fread(buf, 1, size, fp) != size)
+				|| !feh_jpeg_mem_size(buf, size, &w, &h)
+				|| !feh_jpeg_preview_usable(w, h, info->width, info->height,
+					orientation, max_w, max_h)
+				|| (best && (w >= best_w))) {
+			free(buf);
+			continue;
+		}
+		free(best);
+		best = buf;
+		best_w = w;
+		*len = size;
+	}
+	return(best);
+}
+
+/*
+ * Decodes a preview image embedded in the JPEG file filename (an EXIF
+ * thumbnail or a Multi-Picture Format preview) which is large enough to be
+ * shown at max_w x max_h. The preview is oriented like the main image, and
+ * *orig_w and *orig_h are set to the size of the main image. Returns NULL if
+ * no such preview exists.
+ */
+Imlib_Image feh_jpeg_load_embedded(char *filename, int max_w, int max_h,
+		int *orig_w, int *orig_h)
+{
+	feh_jpeg_info info;
+	Imlib_Image im = NULL;
+	FILE *fp;
+	unsigned char *tiff, *preview = NULL, *mpf_preview = NULL;
+	unsigned int tiff_len, ifd1, offset = 0, size = 0;
+	unsigned long len = 0;
+	int w, h, scale, orientation = 1;
+
+	if ((max_w <= 0) || (max_h <= 0) || !(fp = fopen(filename, "rb")))
+		return(NULL);
+
+	if (!feh_jpeg_read_info(fp, &info)) {
+		fclose(fp);
+		feh_jpeg_info_free(&info);
+		return(NULL);
+	}
+
+#ifdef HAVE_LIBEXIF
+	if (FEH_JPEG_AUTO_ORIENTATION || opt.auto_rotate)
+#else
+	if (FEH_JPEG_AUTO_ORIENTATION)
+#endif
+		orientation = info.orientation;
+
+	if (info.exif) {
+		tiff = info.exif + 6;
+		tiff_len = info.exif_len - 6;
+		ifd1 = feh_jpeg_tiff_next_ifd(tiff, tiff_len, feh_jpeg_tiff_ifd0(tiff, tiff_len));
+		if (feh_jpeg_tiff_tag(tiff, tiff_len, ifd1, 0x0201, &offset)
+				&& feh_jpeg_tiff_tag(tiff, tiff_len, ifd1, 0x0202, &size)
+				&& (offset < tiff_len) && (size <= tiff_len - offset)
+				&& feh_jpeg_mem_size(tiff + offset, size, &w, &h)
+				&& feh_jpeg_preview_usable(w, h, info.width, info.height,
+					orientation, max_w, max_h)) {
+			preview = tiff + offset;
+			len = size;
+		}
+	}
+
+	if (!preview && info.mpf)
+		preview = mpf_preview = feh_jpeg_mpf_preview(fp, &info, orientation,
+				max_w, max_h, &len);
+
+	if (preview)
+		im = feh_jpeg_decode(NULL, preview, len, max_w, max_h, 1, &w, &h, &scale);
+
+	if (im) {
+		*orig_w = info.width;
+		*orig_h = info.height;
+		feh_image_orientate(im, orientation);
+		feh_jpeg_orientate_size(orientation, orig_w, orig_h);
+		D(("%s: using embedded %dx%d preview\n", filename, w, h));
+	}
+
+	free(mpf_preview);
+	feh_jpeg_info_free(&info);
+	fclose(fp);
+	return(im);
+}
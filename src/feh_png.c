@@ -27,74 +27,208 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 
 #include "feh_png.h"
 
-#define FEH_PNG_COMPRESSION 3
 #define FEH_PNG_NUM_COMMENTS 4
 
-gib_hash *feh_png_read_comments(char *file)
+typedef struct {
+	unsigned char *data;
+	size_t size;
+	size_t pos;
+} feh_png_buffer;
+
+static void feh_png_read_buffer(png_structp png_ptr, png_bytep out,
+		png_size_t len)
 {
-	FILE *fp;
-	int i, sig_bytes, comments = 0;
+	feh_png_buffer *buf = png_get_io_ptr(png_ptr);
+
+	if (len > buf->size - buf->pos)
+		png_error(png_ptr, "unexpected end of file");
+	memcpy(out, buf->data + buf->pos, len);
+	buf->pos += len;
+}
+
+/*
+ * Checks the comments of a thumbnail against uri and mtime and reads the
+ * dimensions of the original image from them.
+ */
+static int feh_png_thumbnail_is_valid(png_structp png_ptr, png_infop info_ptr,
+		char *uri, time_t mtime, int *orig_w, int *orig_h)
+{
+	int i, comments = 0, valid = 0;
+	png_textp text_ptr;
+
+#ifdef PNG_TEXT_SUPPORTED
+	png_get_text(png_ptr, info_ptr, &text_ptr, &comments);
+	for (i = 0; i < comments; i++) {
+		if (!strcmp(text_ptr[i].key, "Thumb::MTime")) {
+			if ((time_t) strtol(text_ptr[i].text, NULL, 10) == mtime)
+				valid = 1;
+		} else if (!strcmp(text_ptr[i].key, "Thumb::URI")) {
+			if (uri && strcmp(text_ptr[i].text, uri))
+				return 0;
+		} else if (!strcmp(text_ptr[i].key, "Thumb::Image::Width"))
+			*orig_w = atoi(text_ptr[i].text);
+		else if (!strcmp(text_ptr[i].key, "Thumb::Image::Height"))
+			*orig_h = atoi(text_ptr[i].text);
+	}
+#endif				/* PNG_TEXT_SUPPORTED */
+
+	return valid;
+}
+
+/*
+ * Loads a thumbnail written by feh_png_write_png_fd if its Thumb::URI and
+ * Thumb::MTime match uri and mtime, sets *orig_w and *orig_h to the
+ * Thumb::Image dimensions. The file is mapped once and both the comments
+ * and the pixels are read from it in a single pass, so a stale thumbnail
+ * is rejected before its image data is decoded.
+ */
+Imlib_Image feh_png_load_thumbnail(char *file, char *uri, time_t mtime,
+		int *orig_w, int *orig_h)
+{
+	int fd, i;
+	struct stat st;
+	feh_png_buffer buf;
+	png_uint_32 w, h;
+	int depth, color_type, has_alpha;
 
 	png_structp png_ptr;
 	png_infop info_ptr;
-	png_textp text_ptr;
 
-	if (!(fp = fopen(file, "rb")))
+	Imlib_Image volatile im = NULL;
+	png_bytep * volatile rows = NULL;
+	DATA32 *data;
+
+	if ((fd = open(file, O_RDONLY)) == -1)
 		return NULL;
 
-	if (!(sig_bytes = feh_png_file_is_png(fp))) {
-		fclose(fp);
+	if (fstat(fd, &st) || (st.st_size < 8)) {
+		close(fd);
+		return NULL;
+	}
+
+	buf.size = st.st_size;
+	buf.pos = 8;
+	buf.data = mmap(NULL, buf.size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (buf.data == MAP_FAILED)
+		return NULL;
+
+	if (png_sig_cmp(buf.data, 0, 8)) {
+		munmap(buf.data, buf.size);
 		return NULL;
 	}
 
-	/* initialize data structures */
 	png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
 	if (!png_ptr) {
-		fclose(fp);
+		munmap(buf.data, buf.size);
 		return NULL;
 	}
 
 	info_ptr = png_create_info_struct(png_ptr);
 	if (!info_ptr) {
 		png_destroy_read_struct(&png_ptr, (png_infopp) NULL, (png_infopp) NULL);
-		fclose(fp);
+		munmap(buf.data, buf.size);
 		return NULL;
 	}
 
 	if (setjmp(png_jmpbuf(png_ptr))) {
 		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-		fclose(fp);
+		munmap(buf.data, buf.size);
+		free(rows);
+		if (im)
+			gib_imlib_free_image_and_decache(im);
 		return NULL;
 	}
 
-	/* initialize reading */
-	png_init_io(png_ptr, fp);
-	png_set_sig_bytes(png_ptr, sig_bytes);
+	png_set_read_fn(png_ptr, &buf, feh_png_read_buffer);
+	png_set_sig_bytes(png_ptr, 8);
 
+	/* the comments precede the image data, so this does not decode it yet */
 	png_read_info(png_ptr, info_ptr);
 
-	gib_hash *hash = NULL;
+	if (!feh_png_thumbnail_is_valid(png_ptr, info_ptr, uri, mtime,
+			orig_w, orig_h)) {
+		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+		munmap(buf.data, buf.size);
+		return NULL;
+	}
 
-#ifdef PNG_TEXT_SUPPORTED
-	png_get_text(png_ptr, info_ptr, &text_ptr, &comments);
-	if (comments > 0) {
-		hash = gib_hash_new();
-		for (i = 0; i < comments; i++)
-			gib_hash_set(hash, text_ptr[i].key, estrdup(text_ptr[i].text));
+	png_get_IHDR(png_ptr, info_ptr, &w, &h, &depth, &color_type, NULL, NULL,
+			NULL);
+
+	has_alpha = (color_type & PNG_COLOR_MASK_ALPHA)
+		|| png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS);
+
+	/* same transformations as Imlib2's PNG loader */
+	png_set_expand(png_ptr);
+	png_set_strip_16(png_ptr);
+	png_set_gray_to_rgb(png_ptr);
+	png_set_filler(png_ptr, 0xff, PNG_FILLER_AFTER);
+#ifdef WORDS_BIGENDIAN
+	png_set_swap_alpha(png_ptr);
+#else				/* !WORDS_BIGENDIAN */
+	png_set_bgr(png_ptr);
+#endif				/* WORDS_BIGENDIAN */
+	png_set_interlace_handling(png_ptr);
+	png_read_update_info(png_ptr, info_ptr);
+
+	if (!(im = imlib_create_image(w, h))) {
+		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+		munmap(buf.data, buf.size);
+		return NULL;
 	}
-#endif				/* PNG_TEXT_SUPPORTED */
+
+	imlib_context_set_image(im);
+	imlib_image_set_has_alpha(has_alpha);
+	data = imlib_image_get_data();
+
+	rows = emalloc(h * sizeof(png_bytep));
+	for (i = 0; i < (int) h; i++)
+		rows[i] = (png_bytep) (data + i * w);
+
+	png_read_image(png_ptr, rows);
+	imlib_image_put_back_data(data);
 
 	png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-	fclose(fp);
+	munmap(buf.data, buf.size);
+	free(rows);
+
+	return im;
+}
 
-	return hash;
+/*
+ * Returns the libpng filter mask for a filter name as accepted by
+ * --thumb-compression, or -1 if there is no such filter.
+ */
+int feh_png_parse_filters(char *name)
+{
+	if (!strcmp(name, "none"))
+		return PNG_FILTER_NONE;
+	else if (!strcmp(name, "sub"))
+		return PNG_FILTER_SUB;
+	else if (!strcmp(name, "up"))
+		return PNG_FILTER_UP;
+	else if (!strcmp(name, "avg"))
+		return PNG_FILTER_AVG;
+	else if (!strcmp(name, "paeth"))
+		return PNG_FILTER_PAETH;
+	else if (!strcmp(name, "all"))
+		return PNG_ALL_FILTERS;
+	return -1;
 }
 
-/* grab image data from image and write info file with comments ... */
-int feh_png_write_png_fd(Imlib_Image image, int fd, ...)
+/*
+ * grab image data from image and write info file with comments ...
+ * level is the zlib compression level, filters a mask of libpng row filters
+ * (-1: libpng's choice). Returns 0 on success.
+ */
+int feh_png_write_png_fd(Imlib_Image image, int fd, int level, int filters, ...)
 {
 	FILE *fp;
 	int i, w, h;
@@ -111,27 +245,29 @@ int feh_png_write_png_fd(Imlib_Image image, int fd, ...)
 	char *pair_key, *pair_text;
 #endif				/* PNG_TEXT_SUPPORTED */
 
-	if (!(fp = fdopen(fd, "wb")))
-		return 0;
+	if (!(fp = fdopen(fd, "wb"))) {
+		close(fd);
+		return 1;
+	}
 
 	png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
 	if (!png_ptr) {
 		fclose(fp);
-		return 0;
+		return 1;
 	}
 
 	info_ptr = png_create_info_struct(png_ptr);
 	if (!info_ptr) {
 		png_destroy_write_struct(&png_ptr, (png_infopp) NULL);
 		fclose(fp);
-		return 0;
+		return 1;
 	}
 
 	if (setjmp(png_jmpbuf(png_ptr))) {
 		fclose(fp);
 		png_destroy_write_struct(&png_ptr, &info_ptr);
 		png_destroy_info_struct(png_ptr, &info_ptr);
-		return 0;
+		return 1;
 	}
 
 	w = gib_imlib_image_get_width(image);
@@ -155,7 +291,7 @@ int feh_png_write_png_fd(Imlib_Image image, int fd, ...)
 	png_set_sBIT(png_ptr, info_ptr, &sig_bit);
 
 #ifdef PNG_TEXT_SUPPORTED
-	va_start(args, fd);
+	va_start(args, filters);
 	for (i = 0; i < FEH_PNG_NUM_COMMENTS; i++) {
 		if ((pair_key = va_arg(args, char *))
 		    && (pair_text = va_arg(args, char *))) {
@@ -172,7 +308,9 @@ int feh_png_write_png_fd(Imlib_Image image, int fd, ...)
 		png_set_text(png_ptr, info_ptr, text, i);
 #endif				/* PNG_TEXT_SUPPORTED */
 
-	png_set_compression_level(png_ptr, FEH_PNG_COMPRESSION);
+	png_set_compression_level(png_ptr, level);
+	if (filters >= 0)
+		png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, filters);
 	png_write_info(png_ptr, info_ptr);
 	png_set_shift(png_ptr, &sig_bit);
 	png_set_packing(png_ptr);
@@ -187,7 +325,8 @@ int feh_png_write_png_fd(Imlib_Image image, int fd, ...)
 	png_destroy_write_struct(&png_ptr, &info_ptr);
 	png_destroy_info_struct(png_ptr, &info_ptr);
 
-	fclose(fp);
+	if (fclose(fp))
+		return 1;
 
 	return 0;
 }
@@ -31,8 +31,10 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #include "feh.h"
 
-gib_hash *feh_png_read_comments(char *file);
-int feh_png_write_png_fd(Imlib_Image image, int fd, ...);
+Imlib_Image feh_png_load_thumbnail(char *file, char *uri, time_t mtime,
+		int *orig_w, int *orig_h);
+int feh_png_parse_filters(char *name);
+int feh_png_write_png_fd(Imlib_Image image, int fd, int level, int filters, ...);
 
 int feh_png_file_is_png(FILE * fp);
 
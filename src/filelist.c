@@ -29,6 +29,17 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "signals.h"
 #include "options.h"
 #include "utils.h"
+#include "probe.h"
+#include "metadata.h"
+#include "pathstore.h"
+#include "worker.h"
+#include "watch.h"
+#include "thumbnail.h"
+#include "timers.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/mman.h>
 
 #ifdef HAVE_LIBCURL
 #include <curl/curl.h>
@@ -42,21 +53,53 @@ gib_list *current_file = NULL;
 static gib_list *rm_filelist = NULL;
 
 feh_file *feh_file_new(char *filename)
+{
+	return(feh_file_new_len(filename, strlen(filename)));
+}
+
+/*
+ * feh_file structs are allocated in blocks of FEH_FILE_BLOCK and recycled
+ * through a free list, which is linked through their filename pointers.
+ * Their filenames live in the path store (see pathstore.c).
+ */
+#define FEH_FILE_BLOCK 1024
+
+static feh_file *free_files = NULL;
+
+static feh_file *feh_file_alloc(void)
+{
+	feh_file *file;
+	int i;
+
+	if (!free_files) {
+		free_files = emalloc(FEH_FILE_BLOCK * sizeof(feh_file));
+		for (i = 0; i < FEH_FILE_BLOCK - 1; i++)
+			free_files[i].filename = (char *) &free_files[i + 1];
+		free_files[i].filename = NULL;
+	}
+	file = free_files;
+	free_files = (feh_file *) file->filename;
+	return(file);
+}
+
+/* Like feh_file_new, for a filename which is not NUL-terminated */
+feh_file *feh_file_new_len(char *filename, size_t len)
 {
 	feh_file *newfile;
-	char *s;
+	size_t base = len;
+
+	while ((base > 0) && (filename[base - 1] != '/'))
+		base--;
 
-	newfile = (feh_file *) emalloc(sizeof(feh_file));
+	newfile = feh_file_alloc();
 	newfile->caption = NULL;
-	newfile->filename = estrdup(filename);
-	s = strrchr(filename, '/');
-	if (s)
-		newfile->name = estrdup(s + 1);
-	else
-		newfile->name = estrdup(filename);
+	newfile->filename = feh_path_store(filename, len);
+	newfile->name = newfile->filename + base;
+	newfile->dir = feh_path_dir(filename, base);
 	newfile->size = -1;
 	newfile->mtime = 0;
 	newfile->info = NULL;
+	newfile->slot = -1;
 #ifdef HAVE_LIBEXIF
 	newfile->ed = NULL;
 #endif
@@ -67,10 +110,7 @@ void feh_file_free(feh_file * file)
 {
 	if (!file)
 		return;
-	if (file->filename)
-		free(file->filename);
-	if (file->name)
-		free(file->name);
+	feh_path_release(file->filename);
 	if (file->caption)
 		free(file->caption);
 	if (file->info)
@@ -79,7 +119,8 @@ void feh_file_free(feh_file * file)
 	if (file->ed)
 		exif_data_unref(file->ed);
 #endif
-	free(file);
+	file->filename = (char *) free_files;
+	free_files = file;
 	return;
 }
 
@@ -118,8 +159,213 @@ gib_list *feh_file_rm_and_free(gib_list * list, gib_list * l)
 	return(feh_file_remove_from_list(list, l));
 }
 
+/*
+ * Positional index of the filelist: an array of its nodes in list order, so
+ * that slideshow jumps and "n of m" displays do not have to walk a list of
+ * possibly millions of files. Removed nodes leave a hole which is counted in
+ * a Fenwick tree (index_holes) so that positions can still be computed in
+ * O(log n); the array is rebuilt once it is half empty, or after the
+ * filelist has been reordered (see feh_filelist_index_invalidate).
+ */
+static gib_list **index_nodes = NULL;
+static unsigned int *index_holes = NULL;
+static int index_size = 0;
+static int index_capacity = 0;
+static int index_hole_count = 0;
+static int index_valid = 0;
+static gib_list *index_tail = NULL;
+
+void feh_filelist_index_invalidate(void)
+{
+	index_valid = 0;
+}
+
+static void feh_filelist_index_build(void)
+{
+	gib_list *l;
+	int i = 0;
+
+	index_size = index_capacity = gib_list_length(filelist);
+	index_nodes = erealloc(index_nodes, (index_size + 1) * sizeof(gib_list *));
+	index_holes = erealloc(index_holes, (index_size + 1) * sizeof(unsigned int));
+	memset(index_holes, 0, (index_size + 1) * sizeof(unsigned int));
+
+	index_tail = NULL;
+	for (l = filelist; l; l = l->next) {
+		FEH_FILE(l->data)->slot = i;
+		index_nodes[i++] = l;
+		index_tail = l;
+	}
+	index_hole_count = 0;
+	index_valid = 1;
+}
+
+static void feh_filelist_index_grow(void)
+{
+	if (index_size == index_capacity) {
+		index_capacity = 2 * index_capacity + 64;
+		index_nodes = erealloc(index_nodes,
+				(index_capacity + 1) * sizeof(gib_list *));
+		index_holes = erealloc(index_holes,
+				(index_capacity + 1) * sizeof(unsigned int));
+	}
+}
+
+/* Adds the nodes from l on, which have been appended to the filelist */
+static void feh_filelist_index_append(gib_list * l)
+{
+	int slot, j;
+
+	if (!index_valid)
+		return;
+
+	for (; l; l = l->next) {
+		feh_filelist_index_grow();
+		FEH_FILE(l->data)->slot = index_size;
+		index_nodes[index_size++] = l;
+		index_tail = l;
+
+		/* the new Fenwick tree node covers the holes before it, too */
+		slot = index_size;
+		index_holes[slot] = 0;
+		for (j = slot - 1; j > slot - (slot & -slot); j -= j & -j)
+			index_holes[slot] += index_holes[j];
+	}
+}
+
+/* Returns the slot of l in the index, or -1 if l is not in the filelist */
+static int feh_filelist_index_slot(gib_list * l)
+{
+	int slot;
+
+	if (!index_valid)
+		feh_filelist_index_build();
+
+	slot = FEH_FILE(l->data)->slot;
+	if ((slot >= 0) && (slot < index_size) && (index_nodes[slot] == l))
+		return(slot);
+	return(-1);
+}
+
+static void feh_filelist_index_remove(gib_list * l)
+{
+	int slot;
+
+	if (!index_valid)
+		return;
+	if ((slot = feh_filelist_index_slot(l)) < 0) {
+		index_valid = 0;
+		return;
+	}
+
+	index_nodes[slot] = NULL;
+	if (l == index_tail)
+		index_tail = l->prev;
+	for (slot++; slot <= index_size; slot += slot & -slot)
+		index_holes[slot]++;
+	if (++index_hole_count > index_size / 2)
+		index_valid = 0;
+}
+
+/*
+ * Adds node l, which has just been linked into the filelist. Unless it was
+ * appended, the nodes after it move up one slot (after the holes have been
+ * squeezed out), which is a memmove rather than a rebuild.
+ */
+static void feh_filelist_index_insert(gib_list * l)
+{
+	int slot, i, j;
+
+	if (!index_valid)
+		return;
+	if (!l->next) {
+		feh_filelist_index_append(l);
+		return;
+	}
+
+	if (index_hole_count) {
+		for (i = j = 0; i < index_size; i++)
+			if (index_nodes[i]) {
+				FEH_FILE(index_nodes[i]->data)->slot = j;
+				index_nodes[j++] = index_nodes[i];
+			}
+		index_size = j;
+		index_hole_count = 0;
+		memset(index_holes, 0, (index_size + 1) * sizeof(unsigned int));
+	}
+	if ((slot = feh_filelist_index_slot(l->next)) < 0) {
+		index_valid = 0;
+		return;
+	}
+
+	feh_filelist_index_grow();
+	memmove(index_nodes + slot + 1, index_nodes + slot,
+			(index_size - slot) * sizeof(gib_list *));
+	index_nodes[slot] = l;
+	index_holes[++index_size] = 0;
+	for (i = slot; i < index_size; i++)
+		FEH_FILE(index_nodes[i]->data)->slot = i;
+}
+
+/* Returns the last node of the filelist, or NULL if it is empty */
+static gib_list *feh_filelist_last(void)
+{
+	if (!index_valid)
+		feh_filelist_index_build();
+	return(index_tail);
+}
+
+/* Returns the position of l in the filelist (starting at 0), or -1 */
+int feh_filelist_pos(gib_list * l)
+{
+	int slot, pos;
+
+	if (!l)
+		return(-1);
+	if ((slot = feh_filelist_index_slot(l)) < 0)
+		return(-1);
+
+	/* subtract the holes before slot */
+	for (pos = slot; slot > 0; slot -= slot & -slot)
+		pos -= index_holes[slot];
+	return(pos);
+}
+
+/* Returns the node at position n of the filelist, or NULL */
+gib_list *feh_filelist_nth(int n)
+{
+	int slot = 0, step;
+
+	if (!index_valid)
+		feh_filelist_index_build();
+	if ((n < 0) || (n >= index_size - index_hole_count))
+		return(NULL);
+	if (!index_hole_count)
+		return(index_nodes[n]);
+
+	/* find the slot with n + 1 files up to and including it */
+	for (step = 1; 2 * step <= index_size; step *= 2);
+	for (n++; step; step /= 2)
+		if ((slot + step <= index_size)
+				&& ((int) (step - index_holes[slot + step]) < n)) {
+			slot += step;
+			n -= step - index_holes[slot];
+		}
+	return(index_nodes[slot]);
+}
+
+/* Last node appended by feh_filelist_stream_step */
+static gib_list *stream_tail = NULL;
+
 gib_list *feh_file_remove_from_list(gib_list * list, gib_list * l)
 {
+	if (list == filelist)
+		feh_filelist_index_remove(l);
+#ifdef HAVE_INOTIFY
+	feh_watch_forget(l);
+#endif
+	if (l == stream_tail)
+		stream_tail = l->prev;
 	feh_file_free(FEH_FILE(l->data));
 	D(("filelist_len %d -> %d\n", filelist_len, filelist_len - 1));
 	filelist_len--;
@@ -193,8 +439,573 @@ static void add_stdin_to_filelist(void)
 	free(sfn);
 }
 
+/*
+ * For --reload: the command line items, directories and filelist file seen
+ * by the last scan. As long as none of them is modified, a new scan would
+ * find the same files. Changes within the second in which a scan started
+ * are not visible in st_mtime, so these entries always count as modified.
+ */
+typedef struct {
+	char *path;
+	time_t mtime;
+	char exists;
+	char is_dir;
+} feh_scan_entry;
+
+static gib_list *scan_entries = NULL;
+static time_t scan_time = 0;
+
+static void feh_scan_record(char *path, struct stat *st)
+{
+	feh_scan_entry *entry;
+
+	if (!scan_entries)
+		scan_time = time(NULL);
+
+	entry = emalloc(sizeof(feh_scan_entry));
+	entry->path = estrdup(path);
+	entry->exists = (st != NULL);
+	entry->is_dir = st && S_ISDIR(st->st_mode);
+	entry->mtime = st ? st->st_mtime : 0;
+	scan_entries = gib_list_add_front(scan_entries, entry);
+
+#ifdef HAVE_INOTIFY
+	if (opt.watch && st && S_ISDIR(st->st_mode))
+		feh_watch_add_dir(path);
+#endif
+}
+
+/* Returns 1 if entry was modified, filling in *st if it still exists */
+static int feh_scan_entry_changed(feh_scan_entry * entry, struct stat *st)
+{
+	if (stat(entry->path, st))
+		return(entry->exists);
+	return(!entry->exists || (st->st_mtime != entry->mtime)
+			|| (st->st_mtime >= scan_time));
+}
+
+static int feh_scan_changed(void)
+{
+	gib_list *l;
+	struct stat st;
+
+	for (l = scan_entries; l; l = l->next)
+		if (feh_scan_entry_changed(l->data, &st))
+			return(1);
+	return(0);
+}
+
+static void feh_scan_free(void)
+{
+	gib_list *l;
+
+	for (l = scan_entries; l; l = l->next)
+		free(((feh_scan_entry *) l->data)->path);
+	gib_list_free_and_data(scan_entries);
+	scan_entries = NULL;
+}
 
 /* Recursive */
+/*
+ * Directory scanner for add_file_to_filelist_recursively. Directories are
+ * read by a pool of --jobs threads: they classify the entries (trusting
+ * d_type where the file system provides it, and using fstatat otherwise) and
+ * queue the subdirectories they find, so that they read ahead of the main
+ * thread. The main thread walks the resulting tree depth-first in alphasort
+ * order, so the filelist does not depend on the number of threads. It reads
+ * directories itself when no thread has got to them yet.
+ */
+enum scan_item_type { SCAN_ITEM_OTHER, SCAN_ITEM_FILE, SCAN_ITEM_DIR,
+	SCAN_ITEM_ERROR };
+enum scan_dir_state { SCAN_DIR_QUEUED, SCAN_DIR_READING, SCAN_DIR_DONE };
+
+typedef struct feh_scan_dir feh_scan_dir;
+
+typedef struct {
+	char *name;
+	unsigned char type;
+	int error;		/* errno for SCAN_ITEM_ERROR */
+	feh_scan_dir *dir;	/* subdirectory to scan (only with --recursive) */
+} feh_scan_item;
+
+struct feh_scan_dir {
+	char *path;
+	struct stat st;
+	unsigned char state;
+	unsigned char stat_failed;
+	unsigned char read_failed;
+	int error;		/* errno if it cannot be stat'ed, opened or read */
+	feh_scan_item *items;
+	int item_count;
+};
+
+static pthread_mutex_t scan_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t scan_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t scan_done = PTHREAD_COND_INITIALIZER;
+
+/* directories to be read, most recently found first */
+static feh_scan_dir **scan_stack = NULL;
+static int scan_stack_len = 0;
+static int scan_stack_size = 0;
+static int scan_stop = 0;
+
+static feh_scan_dir *feh_scan_dir_new(char *path)
+{
+	feh_scan_dir *dir = emalloc(sizeof(feh_scan_dir));
+
+	memset(dir, 0, sizeof(feh_scan_dir));
+	dir->path = path;
+	dir->state = SCAN_DIR_QUEUED;
+	return(dir);
+}
+
+static int feh_scan_item_cmp(const void *item1, const void *item2)
+{
+	/* like alphasort */
+	return(strcoll(((feh_scan_item *) item1)->name,
+			((feh_scan_item *) item2)->name));
+}
+
+/* Classifies item by following it like stat(2) would */
+static void feh_scan_item_stat(int fd, feh_scan_item * item)
+{
+	struct stat st;
+
+	if (fstatat(fd, item->name, &st, 0)) {
+		item->type = SCAN_ITEM_ERROR;
+		item->error = errno;
+	} else if (S_ISREG(st.st_mode))
+		item->type = SCAN_ITEM_FILE;
+	else if (S_ISDIR(st.st_mode))
+		item->type = SCAN_ITEM_DIR;
+	else
+		item->type = SCAN_ITEM_OTHER;
+}
+
+/* Reads dir. Runs without scan_lock, possibly in a scanner thread */
+static void feh_scan_dir_read(feh_scan_dir * dir)
+{
+	struct dirent *de;
+	DIR *dirp;
+	feh_scan_item *item;
+	int fd, size = 0, i;
+
+	if ((fd = open(dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) {
+		dir->error = errno;
+		if (stat(dir->path, &dir->st)) {
+			dir->stat_failed = 1;
+			dir->error = errno;
+		}
+		return;
+	}
+	if (fstat(fd, &dir->st) || ((dirp = fdopendir(fd)) == NULL)) {
+		dir->error = errno;
+		close(fd);
+		return;
+	}
+
+	while ((errno = 0), (de = readdir(dirp)) != NULL) {
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+			continue;
+		if (dir->item_count == size) {
+			size = size ? 2 * size : 64;
+			dir->items = erealloc(dir->items, size * sizeof(feh_scan_item));
+		}
+		item = &dir->items[dir->item_count++];
+		item->name = estrdup(de->d_name);
+		item->dir = NULL;
+#ifdef DT_UNKNOWN
+		if (de->d_type == DT_REG)
+			item->type = SCAN_ITEM_FILE;
+		else if (de->d_type == DT_DIR)
+			item->type = SCAN_ITEM_DIR;
+		else if ((de->d_type == DT_LNK) || (de->d_type == DT_UNKNOWN))
+			feh_scan_item_stat(fd, item);
+		else
+			item->type = SCAN_ITEM_OTHER;
+#else
+		feh_scan_item_stat(fd, item);
+#endif
+		if ((item->type == SCAN_ITEM_FILE) && !feh_probe_name_wanted(item->name))
+			item->type = SCAN_ITEM_OTHER;
+	}
+
+	if (errno) {
+		/* like a failed scandir(3), ignore the entries read so far */
+		dir->error = errno;
+		dir->read_failed = 1;
+		for (i = 0; i < dir->item_count; i++)
+			free(dir->items[i].name);
+		dir->item_count = 0;
+	}
+	closedir(dirp);
+
+	qsort(dir->items, dir->item_count, sizeof(feh_scan_item), feh_scan_item_cmp);
+
+	if (opt.recursive)
+		for (i = 0; i < dir->item_count; i++)
+			if (dir->items[i].type == SCAN_ITEM_DIR)
+				dir->items[i].dir = feh_scan_dir_new(estrjoin("", dir->path,
+							"/", dir->items[i].name, NULL));
+}
+
+/* Marks dir as read and queues its subdirectories. Requires scan_lock */
+static void feh_scan_dir_finish(feh_scan_dir * dir)
+{
+	int i, queued = 0;
+
+	for (i = dir->item_count - 1; i >= 0; i--) {
+		if (!dir->items[i].dir)
+			continue;
+		if (scan_stack_len == scan_stack_size) {
+			scan_stack_size = scan_stack_size ? 2 * scan_stack_size : 64;
+			scan_stack = erealloc(scan_stack,
+					scan_stack_size * sizeof(feh_scan_dir *));
+		}
+		scan_stack[scan_stack_len++] = dir->items[i].dir;
+		queued = 1;
+	}
+
+	dir->state = SCAN_DIR_DONE;
+	pthread_cond_broadcast(&scan_done);
+	if (queued)
+		pthread_cond_broadcast(&scan_work);
+}
+
+static void *feh_scan_thread(void *unused __attribute__((unused)))
+{
+	feh_scan_dir *dir;
+
+	pthread_mutex_lock(&scan_lock);
+	while (1) {
+		while (!scan_stop && !scan_stack_len)
+			pthread_cond_wait(&scan_work, &scan_lock);
+		if (scan_stop)
+			break;
+
+		/* directories claimed by the main thread stay on the stack */
+		dir = scan_stack[--scan_stack_len];
+		if (dir->state != SCAN_DIR_QUEUED)
+			continue;
+		dir->state = SCAN_DIR_READING;
+
+		pthread_mutex_unlock(&scan_lock);
+		feh_scan_dir_read(dir);
+		pthread_mutex_lock(&scan_lock);
+		feh_scan_dir_finish(dir);
+	}
+	pthread_mutex_unlock(&scan_lock);
+	return(NULL);
+}
+
+/* Returns once dir has been read, reading it now if nobody else is */
+static void feh_scan_dir_wait(feh_scan_dir * dir)
+{
+	pthread_mutex_lock(&scan_lock);
+	if (dir->state == SCAN_DIR_QUEUED) {
+		dir->state = SCAN_DIR_READING;
+		pthread_mutex_unlock(&scan_lock);
+		feh_scan_dir_read(dir);
+		pthread_mutex_lock(&scan_lock);
+		feh_scan_dir_finish(dir);
+	}
+	while (dir->state != SCAN_DIR_DONE)
+		pthread_cond_wait(&scan_done, &scan_lock);
+	pthread_mutex_unlock(&scan_lock);
+}
+
+/*
+ * Walks a directory tree depth-first, adding its files to the filelist. The
+ * walk can be interrupted after any number of entries, which is what
+ * --stream uses to show images while the scan is still running.
+ */
+typedef struct {
+	feh_scan_dir *dir;
+	int next;		/* next item, or -1 if dir has not been entered yet */
+	int record;		/* whether to feh_scan_record dir */
+} feh_scan_frame;
+
+typedef struct {
+	feh_scan_frame *frames;
+	int depth;
+	int size;
+} feh_scan_walk;
+
+/* Thread pool of the scan. Directories are only freed once it stops */
+static pthread_t *scan_threads = NULL;
+static int scan_thread_count = 0;
+static int scan_pool_users = 0;
+static gib_list *scan_dirs = NULL;
+
+static void feh_scan_pool_start(void)
+{
+	sigset_t all, old;
+	int count = feh_worker_jobs() - 1;
+
+	if (scan_pool_users++)
+		return;
+
+	if (count > 0)
+		scan_threads = emalloc(count * sizeof(pthread_t));
+
+	/* signals are for the main thread */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	for (scan_thread_count = 0; scan_thread_count < count; scan_thread_count++)
+		if (pthread_create(&scan_threads[scan_thread_count], NULL,
+					feh_scan_thread, NULL))
+			break;
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+static void feh_scan_pool_stop(void)
+{
+	gib_list *l;
+	int i;
+
+	if (--scan_pool_users)
+		return;
+
+	pthread_mutex_lock(&scan_lock);
+	scan_stop = 1;
+	pthread_cond_broadcast(&scan_work);
+	pthread_mutex_unlock(&scan_lock);
+	for (i = 0; i < scan_thread_count; i++)
+		pthread_join(scan_threads[i], NULL);
+	free(scan_threads);
+	scan_threads = NULL;
+	scan_thread_count = 0;
+
+	scan_stop = 0;
+	scan_stack_len = 0;
+	for (l = scan_dirs; l; l = l->next) {
+		free(((feh_scan_dir *) l->data)->path);
+		free(l->data);
+	}
+	gib_list_free(scan_dirs);
+	scan_dirs = NULL;
+}
+
+static void feh_scan_walk_push(feh_scan_walk * walk, feh_scan_dir * dir,
+		int record)
+{
+	if (walk->depth == walk->size) {
+		walk->size = walk->size ? 2 * walk->size : 16;
+		walk->frames = erealloc(walk->frames,
+				walk->size * sizeof(feh_scan_frame));
+	}
+	walk->frames[walk->depth].dir = dir;
+	walk->frames[walk->depth].next = -1;
+	walk->frames[walk->depth].record = record;
+	walk->depth++;
+	scan_dirs = gib_list_add_front(scan_dirs, dir);
+}
+
+/* Starts a walk of path, which has already been stat'ed and recorded */
+static void feh_scan_walk_start(feh_scan_walk * walk, char *path)
+{
+	walk->frames = NULL;
+	walk->depth = walk->size = 0;
+	feh_scan_pool_start();
+	feh_scan_walk_push(walk, feh_scan_dir_new(estrdup(path)), 0);
+}
+
+/* Reports errors for dir and records it. Returns 0 if it does not exist */
+static int feh_scan_dir_enter(feh_scan_dir * dir, int record)
+{
+	feh_scan_dir_wait(dir);
+
+	if (dir->stat_failed) {
+		errno = dir->error;
+		feh_print_stat_error(dir->path);
+		return(0);
+	}
+	if (record)
+		feh_scan_record(dir->path, &dir->st);
+
+	if (dir->read_failed) {
+		errno = dir->error;
+		switch (errno) {
+		case ENOMEM:
+			weprintf("Insufficient memory to scan directory %s:", dir->path);
+			break;
+		default:
+			weprintf("Failed to scan directory %s:", dir->path);
+		}
+	} else if (dir->error) {
+		errno = dir->error;
+		if (!opt.quiet)
+			weprintf("couldn't open directory %s:", dir->path);
+	}
+	return(1);
+}
+
+/*
+ * Adds up to count entries of the walk to the filelist (front), in the order
+ * a recursive scan would. Returns 1 if there is more to do, and 0 once the
+ * walk is done (and has been cleaned up).
+ */
+static int feh_scan_walk_step(feh_scan_walk * walk, int count)
+{
+	feh_scan_frame *frame;
+	feh_scan_item *item;
+	char *path;
+
+	while (walk->depth && (count > 0)) {
+		frame = &walk->frames[walk->depth - 1];
+
+		if (frame->next == -1) {
+			frame->next = 0;
+			if (!feh_scan_dir_enter(frame->dir, frame->record))
+				walk->depth--;
+			continue;
+		}
+		if (frame->next == frame->dir->item_count) {
+			free(frame->dir->items);
+			frame->dir->items = NULL;
+			walk->depth--;
+			continue;
+		}
+
+		item = &frame->dir->items[frame->next++];
+		count--;
+		if (item->dir)
+			feh_scan_walk_push(walk, item->dir, 1);
+		else if (item->type == SCAN_ITEM_FILE) {
+			path = estrjoin("", frame->dir->path, "/", item->name, NULL);
+			filelist = gib_list_add_front(filelist, feh_file_new(path));
+			free(path);
+		} else if (item->type == SCAN_ITEM_ERROR) {
+			path = estrjoin("", frame->dir->path, "/", item->name, NULL);
+			errno = item->error;
+			feh_print_stat_error(path);
+			free(path);
+		}
+		free(item->name);
+	}
+
+	if (walk->depth)
+		return(1);
+
+	free(walk->frames);
+	walk->frames = NULL;
+	feh_scan_pool_stop();
+	return(0);
+}
+
+/*
+ * --stream: In slideshow mode, the files and directories given on the
+ * commandline are only queued while parsing options. feh_filelist_stream_step
+ * adds them to the filelist in small batches from the main loop, so that the
+ * first image is shown long before a large directory tree has been scanned.
+ *
+ * A --filelist which is not a regular file (e.g. "find | feh -f -") is read
+ * from the main loop in the same way, in slideshow as well as in thumbnail
+ * mode. Its files come first, so the commandline items wait for it.
+ */
+#define FEH_STREAM_STEP 256
+
+enum stream_state { STREAM_NONE, STREAM_QUEUED, STREAM_RUNNING, STREAM_DONE };
+
+static enum stream_state stream_state = STREAM_NONE;
+static gib_list *stream_items = NULL;
+static feh_scan_walk stream_walk;
+static int stream_walking = 0;
+static int stream_fd = -1;
+
+/* Unparsed rest of the --filelist input read so far */
+static char *stream_buf = NULL;
+static size_t stream_buf_len = 0;
+static size_t stream_buf_size = 0;
+
+/* Returns 1 if the filelist may still grow once the mode has been set up */
+static int feh_filelist_stream_mode(void)
+{
+	return(opt.display && !opt.index && !opt.multiwindow && !opt.list
+			&& !opt.customlist && !opt.loadables && !opt.unloadables
+			&& !opt.bgmode);
+}
+
+static int feh_filelist_stream_wanted(void)
+{
+	struct stat st;
+
+	if (!feh_filelist_stream_mode() || opt.thumbs)
+		return(0);
+	return(opt.stream || (opt.filelistfile && !stat(opt.filelistfile, &st)
+				&& !S_ISREG(st.st_mode)));
+}
+
+/*
+ * Adds the files named in the complete lines of buf to the front of list and
+ * returns the number of bytes used. If eof is set, a last line without
+ * newline is complete, too. Like the old fgets-based reader, a line ends at
+ * the first carriage return, and empty lines are skipped.
+ */
+static size_t feh_filelist_parse(char *buf, size_t len, int eof,
+		gib_list ** list)
+{
+	char *line = buf, *end = buf + len, *nl, *cr;
+
+	while (line < end) {
+		if (!(nl = memchr(line, '\n', end - line))) {
+			if (!eof)
+				break;
+			nl = end;
+		}
+		if (!(cr = memchr(line, '\r', nl - line)))
+			cr = nl;
+		if (cr > line)
+			*list = gib_list_add_front(*list, feh_file_new_len(line, cr - line));
+		if (nl == end)
+			return(len);
+		line = nl + 1;
+	}
+	return(line - buf);
+}
+
+/*
+ * Reads the next chunk of --filelist input from fd and adds the files named
+ * in it to the front of list. Returns 0 once the input is exhausted.
+ */
+static int feh_filelist_read_chunk(int fd, gib_list ** list)
+{
+	ssize_t count;
+	size_t used;
+
+	if (stream_buf_size - stream_buf_len < 4096) {
+		stream_buf_size = stream_buf_size ? 2 * stream_buf_size : 65536;
+		stream_buf = erealloc(stream_buf, stream_buf_size);
+	}
+
+	if ((count = read(fd, stream_buf + stream_buf_len,
+					stream_buf_size - stream_buf_len)) < 0) {
+		if (errno == EINTR)
+			return(1);
+		weprintf("cannot read filelist %s:", opt.filelistfile);
+	}
+
+	if (count > 0) {
+		stream_buf_len += count;
+		used = feh_filelist_parse(stream_buf, stream_buf_len, 0, list);
+		memmove(stream_buf, stream_buf + used, stream_buf_len - used);
+		stream_buf_len -= used;
+		return(1);
+	}
+
+	feh_filelist_parse(stream_buf, stream_buf_len, 1, list);
+	free(stream_buf);
+	stream_buf = NULL;
+	stream_buf_len = stream_buf_size = 0;
+	return(0);
+}
+
+/* Returns 1 while files are still being added to the filelist */
+int feh_filelist_streaming(void)
+{
+	return((stream_state == STREAM_QUEUED) || (stream_state == STREAM_RUNNING));
+}
+
 void add_file_to_filelist_recursively(char *origpath, unsigned char level)
 {
 	struct stat st;
@@ -203,6 +1014,13 @@ void add_file_to_filelist_recursively(char *origpath, unsigned char level)
 	if (!origpath || *origpath == '\0')
 		return;
 
+	if ((level == FILELIST_FIRST) && (stream_state <= STREAM_QUEUED)
+			&& feh_filelist_stream_wanted()) {
+		stream_items = gib_list_add_front(stream_items, estrdup(origpath));
+		stream_state = STREAM_QUEUED;
+		return;
+	}
+
 	path = estrdup(origpath);
 	D(("file is %s\n", path));
 
@@ -236,54 +1054,28 @@ void add_file_to_filelist_recursively(char *origpath, unsigned char level)
 	errno = 0;
 	if (stat(path, &st)) {
 		feh_print_stat_error(path);
+		if (level == FILELIST_FIRST)
+			feh_scan_record(path, NULL);
 		free(path);
 		return;
 	}
 
+	if ((level == FILELIST_FIRST)
+			|| ((S_ISDIR(st.st_mode)) && (level != FILELIST_LAST)))
+		feh_scan_record(path, &st);
+
 	if ((S_ISDIR(st.st_mode)) && (level != FILELIST_LAST)) {
-		struct dirent **de;
-		DIR *dir;
-		int cnt, n;
+		feh_scan_walk walk;
 
 		D(("It is a directory\n"));
-
-		if ((dir = opendir(path)) == NULL) {
-			if (!opt.quiet)
-				weprintf("couldn't open directory %s:", path);
-			free(path);
-			return;
-		}
-		n = scandir(path, &de, file_selector_all, alphasort);
-		if (n < 0) {
-			switch (errno) {
-			case ENOMEM:
-				weprintf("Insufficient memory to scan directory %s:", path);
-				break;
-			default:
-				weprintf("Failed to scan directory %s:", path);
-			}
+		if ((level == FILELIST_FIRST) && (stream_state == STREAM_RUNNING)) {
+			/* feh_filelist_stream_step takes it from here */
+			feh_scan_walk_start(&stream_walk, path);
+			stream_walking = 1;
 		} else {
-			for (cnt = 0; cnt < n; cnt++) {
-				if (strcmp(de[cnt]->d_name, ".")
-						&& strcmp(de[cnt]->d_name, "..")) {
-					char *newfile;
-
-					newfile = estrjoin("", path, "/", de[cnt]->d_name, NULL);
-
-					/* This ensures we go down one level even if not fully recursive
-					   - this way "feh some_dir" expands to some_dir's contents */
-					if (opt.recursive)
-						add_file_to_filelist_recursively(newfile, FILELIST_CONTINUE);
-					else
-						add_file_to_filelist_recursively(newfile, FILELIST_LAST);
-
-					free(newfile);
-				}
-				free(de[cnt]);
-			}
-			free(de);
+			feh_scan_walk_start(&walk, path);
+			while (feh_scan_walk_step(&walk, INT_MAX));
 		}
-		closedir(dir);
 	} else if (S_ISREG(st.st_mode)) {
 		D(("Adding regular file %s to filelist\n", path));
 		filelist = gib_list_add_front(filelist, feh_file_new(path));
@@ -307,26 +1099,116 @@ void delete_rm_files(void)
 	return;
 }
 
-gib_list *feh_file_info_preload(gib_list * list, int load_images)
+static int feh_file_stat_buf(feh_file * file, struct stat *st)
 {
-	gib_list *l;
-	feh_file *file = NULL;
-	gib_list *remove_list = NULL;
+	errno = 0;
+	if (stat(file->filename, st)) {
+		feh_print_stat_error(file->filename);
+		return(1);
+	}
 
-	for (l = list; l; l = l->next) {
-		file = FEH_FILE(l->data);
-		D(("file %p, file->next %p, file->name %s\n", l, l->next, file->name));
-		if (load_images) {
-			if (feh_file_info_load(file, NULL)) {
-				D(("Failed to load file %p\n", file));
-				remove_list = gib_list_add_front(remove_list, l);
-				if (opt.verbose)
-					feh_display_status('x');
-			} else if (((unsigned int)file->info->width < opt.min_width)
-					|| ((unsigned int)file->info->width > opt.max_width)
-					|| ((unsigned int)file->info->height < opt.min_height)
-					|| ((unsigned int)file->info->height > opt.max_height)) {
-				remove_list = gib_list_add_front(remove_list, l);
+	file->mtime = st->st_mtime;
+
+	file->size = st->st_size;
+
+	return(0);
+}
+
+int feh_file_stat(feh_file * file)
+{
+	struct stat st;
+
+	return(feh_file_stat_buf(file, &st));
+}
+
+/* files whose information is read by worker processes (see --jobs) */
+static feh_worker_queue info_jobs;
+
+static int feh_file_info_job_run(feh_worker_job * job)
+{
+	feh_file *file = feh_file_new(job->filename);
+	int ret = !feh_file_info_load(file, NULL);
+
+	if (ret) {
+		job->ret[0] = file->info->width;
+		job->ret[1] = file->info->height;
+		job->ret[2] = file->info->has_alpha;
+		strncpy(job->format, file->info->format, sizeof(job->format) - 1);
+	}
+	feh_file_free(file);
+	return(ret);
+}
+
+/* Reads file's information from the --cache-metadata store, if possible */
+static int feh_file_info_cached(feh_file * file)
+{
+	struct stat st;
+
+	if (!opt.cache_metadata || stat(file->filename, &st)
+			|| !feh_metadata_lookup(file, &st))
+		return(0);
+
+	file->mtime = st.st_mtime;
+	file->size = st.st_size;
+	return(1);
+}
+
+/* feh_file_info_load(file, NULL) for the file at l, possibly done by a worker */
+static int feh_file_info_load_next(gib_list * l)
+{
+	feh_file *file = FEH_FILE(l->data);
+	feh_worker_job job;
+	struct stat st;
+
+	if (file->info)
+		return(0);
+
+	if (!feh_worker_queue_next(&info_jobs, l, &job))
+		return(feh_file_info_load(file, NULL));
+
+	if (!job.status || feh_file_stat_buf(file, &st))
+		return(1);
+
+	file->info = feh_file_info_new();
+	file->info->width = job.ret[0];
+	file->info->height = job.ret[1];
+	file->info->has_alpha = job.ret[2];
+	file->info->pixels = file->info->width * file->info->height;
+	file->info->format = estrdup(job.format);
+	feh_metadata_store(file, &st);
+	return(0);
+}
+
+/* Returns 1 if file is excluded by --min-dimension or --max-dimension */
+static int feh_file_info_filtered(feh_file * file)
+{
+	return(((unsigned int)file->info->width < opt.min_width)
+			|| ((unsigned int)file->info->width > opt.max_width)
+			|| ((unsigned int)file->info->height < opt.min_height)
+			|| ((unsigned int)file->info->height > opt.max_height));
+}
+
+gib_list *feh_file_info_preload(gib_list * list, int load_images)
+{
+	gib_list *l;
+	feh_file *file = NULL;
+	gib_list *remove_list = NULL;
+
+	if (load_images)
+		feh_worker_queue_init(&info_jobs, feh_file_info_job_run,
+				feh_file_info_cached);
+
+	for (l = list; l; l = l->next) {
+		file = FEH_FILE(l->data);
+		D(("file %p, file->next %p, file->name %s\n", l, l->next, file->name));
+		if (load_images) {
+			if (feh_file_info_load_next(l)) {
+				D(("Failed to load file %p\n", file));
+				remove_list = gib_list_add_front(remove_list, l);
+				if (opt.verbose)
+					feh_display_status('x');
+			} else if (feh_file_info_filtered(file)) {
+				remove_list = gib_list_add_front(remove_list, l);
 				if (opt.verbose)
 					feh_display_status('s');
 			} else if (opt.verbose)
@@ -345,10 +1227,13 @@ gib_list *feh_file_info_preload(gib_list * list, int load_images)
 	if (opt.verbose)
 		feh_display_status(0);
 
+	if (load_images)
+		feh_worker_queue_abandon(&info_jobs);
+
 	if (remove_list) {
 		for (l = remove_list; l; l = l->next) {
 			feh_file_free(FEH_FILE(((gib_list *) l->data)->data));
-			filelist = list = gib_list_remove(list, (gib_list *) l->data);
+			list = gib_list_remove(list, (gib_list *) l->data);
 		}
 
 		gib_list_free(remove_list);
@@ -357,45 +1242,47 @@ gib_list *feh_file_info_preload(gib_list * list, int load_images)
 	return(list);
 }
 
-int feh_file_stat(feh_file * file)
-{
-	struct stat st;
-
-	errno = 0;
-	if (stat(file->filename, &st)) {
-		feh_print_stat_error(file->filename);
-		return(1);
-	}
-
-	file->mtime = st.st_mtime;
-
-	file->size = st.st_size;
-
-	return(0);
-}
-
 int feh_file_info_load(feh_file * file, Imlib_Image im)
 {
 	int need_free = 1;
 	Imlib_Image im1;
+	feh_probe_info probe;
+	char *format;
+	struct stat st;
 
-	if (feh_file_stat(file))
+	if (feh_file_stat_buf(file, &st))
 		return(1);
 
 	D(("im is %p\n", im));
 
+	if (!im && feh_metadata_lookup(file, &st))
+		return(0);
+
 	if (im)
 		need_free = 0;
 
 	if (im)
 		im1 = im;
-	else if (!feh_load_image(&im1, file) || !im1)
+	else if (feh_probe_image(file->filename, &probe)
+			&& (format = feh_probe_format(&probe))) {
+		/* no need to decode the image */
+		file->info = feh_file_info_new();
+		file->info->width = probe.width;
+		file->info->height = probe.height;
+		file->info->has_alpha = probe.has_alpha;
+		file->info->pixels = probe.width * probe.height;
+		file->info->format = estrdup(format);
+		feh_metadata_store(file, &st);
+		return(0);
+	} else if (!feh_load_image(&im1, file) || !im1)
 		return(1);
+	else
+		feh_probe_learn(&probe, im1);
 
 	file->info = feh_file_info_new();
 
-	file->info->width = gib_imlib_image_get_width(im1);
-	file->info->height = gib_imlib_image_get_height(im1);
+	file->info->width = feh_image_get_width(im1);
+	file->info->height = feh_image_get_height(im1);
 
 	file->info->has_alpha = gib_imlib_image_has_alpha(im1);
 
@@ -403,14 +1290,20 @@ int feh_file_info_load(feh_file * file, Imlib_Image im)
 
 	file->info->format = estrdup(gib_imlib_image_format(im1));
 
-	if (need_free)
+	/*
+	 * An image passed by the caller may come from a temporary file (see
+	 * feh_load_image_scaled), whose stat data must not end up in the cache.
+	 */
+	if (need_free) {
+		feh_metadata_store(file, &st);
 		gib_imlib_free_image_and_decache(im1);
+	}
 	return(0);
 }
 
 void feh_file_dirname(char *dst, feh_file * f, int maxlen)
 {
-	int n = strlen(f->filename) - strlen(f->name);
+	int n = strlen(f->dir);
 
 	/* Give up on long dirnames */
 	if (n <= 0 || n >= maxlen) {
@@ -418,7 +1311,7 @@ void feh_file_dirname(char *dst, feh_file * f, int maxlen)
 		return;
 	}
 
-	memcpy(dst, f->filename, n);
+	memcpy(dst, f->dir, n);
 	dst[n] = '\0';
 }
 
@@ -442,11 +1335,10 @@ int feh_cmp_name(void *file1, void *file2)
 
 int feh_cmp_dirname(void *file1, void *file2)
 {
-	char dir1[PATH_MAX], dir2[PATH_MAX];
 	int cmp;
-	feh_file_dirname(dir1, FEH_FILE(file1), PATH_MAX);
-	feh_file_dirname(dir2, FEH_FILE(file2), PATH_MAX);
-	if ((cmp = strcmp_or_strverscmp(dir1, dir2)) != 0)
+
+	if ((FEH_FILE(file1)->dir != FEH_FILE(file2)->dir) && ((cmp =
+				strcmp_or_strverscmp(FEH_FILE(file1)->dir, FEH_FILE(file2)->dir)) != 0))
 		return(cmp);
 	return(feh_cmp_name(file1, file2));
 }
@@ -483,7 +1375,11 @@ int feh_cmp_format(void *file1, void *file2)
 	return(strcmp(FEH_FILE(file1)->info->format, FEH_FILE(file2)->info->format));
 }
 
-void feh_prepare_filelist(void)
+/*
+ * Returns 2 if files need to be loaded by feh_file_info_preload before
+ * sorting, 1 if they only need to be stat(2)ed, and 0 otherwise.
+ */
+static int feh_filelist_preload_mode(void)
 {
 	/*
 	 * list and customlist mode as well as the somewhat more fancy sort modes
@@ -495,70 +1391,986 @@ void feh_prepare_filelist(void)
 	 * we can create a properly sized thumbnail list.
 	 */
 	if (opt.list || opt.preload || opt.customlist || (opt.sort >= SORT_WIDTH)
-			|| (opt.filter_by_dimensions && (opt.index || opt.thumbs || opt.bgmode))) {
-		/* For these sort options, we have to preload images */
-		filelist = feh_file_info_preload(filelist, TRUE);
-		if (!gib_list_length(filelist))
-			show_mini_usage();
-	} else if (opt.sort >= SORT_SIZE) {
-		/* For these sort options, we need stat(2) information on the files,
-		 * but there is no need to load the images. */
-		filelist = feh_file_info_preload(filelist, FALSE);
-		if (!gib_list_length(filelist))
-			show_mini_usage();
-	}
+			|| (opt.filter_by_dimensions && (opt.index || opt.thumbs || opt.bgmode)))
+		return(2);
+	/* For these sort options, we need stat(2) information on the files,
+	 * but there is no need to load the images. */
+	else if (opt.sort >= SORT_SIZE)
+		return(1);
+	return(0);
+}
 
-	D(("sort mode requested is: %d\n", opt.sort));
+static gib_compare_fn *feh_filelist_cmp(void)
+{
 	switch (opt.sort) {
-	case SORT_NONE:
-		if (opt.randomize) {
-			/* Randomize the filename order */
-			filelist = gib_list_randomize(filelist);
-		} else if (!opt.reverse) {
-			/* Let's reverse the list. Its back-to-front right now ;) */
-			filelist = gib_list_reverse(filelist);
-		}
-		break;
 	case SORT_NAME:
-		filelist = gib_list_sort(filelist, feh_cmp_name);
-		break;
+		return(feh_cmp_name);
 	case SORT_FILENAME:
-		filelist = gib_list_sort(filelist, feh_cmp_filename);
-		break;
+		return(feh_cmp_filename);
 	case SORT_DIRNAME:
-		filelist = gib_list_sort(filelist, feh_cmp_dirname);
-		break;
+		return(feh_cmp_dirname);
 	case SORT_MTIME:
-		filelist = gib_list_sort(filelist, feh_cmp_mtime);
-		break;
+		return(feh_cmp_mtime);
 	case SORT_WIDTH:
-		filelist = gib_list_sort(filelist, feh_cmp_width);
-		break;
+		return(feh_cmp_width);
 	case SORT_HEIGHT:
-		filelist = gib_list_sort(filelist, feh_cmp_height);
-		break;
+		return(feh_cmp_height);
 	case SORT_PIXELS:
-		filelist = gib_list_sort(filelist, feh_cmp_pixels);
-		break;
+		return(feh_cmp_pixels);
 	case SORT_SIZE:
-		filelist = gib_list_sort(filelist, feh_cmp_size);
-		break;
+		return(feh_cmp_size);
 	case SORT_FORMAT:
-		filelist = gib_list_sort(filelist, feh_cmp_format);
-		break;
+		return(feh_cmp_format);
 	default:
-		break;
+		return(NULL);
+	}
+}
+
+/*
+ * Sort keys for feh_filelist_sort, extracted once per file so that comparing
+ * two files neither splits their path nor follows their info pointer.
+ */
+typedef struct {
+	gib_list *node;
+	char *str;		/* name, filename or format */
+	char *dir;		/* directory, SORT_DIRNAME only */
+	long long num;		/* size, mtime, width, height or pixels */
+} feh_sort_key;
+
+/* Same results as the feh_cmp_* function for sort */
+static inline int feh_sort_key_cmp(feh_sort_key * k1, feh_sort_key * k2,
+		int sort)
+{
+	int cmp;
+
+	switch (sort) {
+	case SORT_NAME:
+	case SORT_FILENAME:
+		return(strcmp_or_strverscmp(k1->str, k2->str));
+	case SORT_DIRNAME:
+		if ((k1->dir != k2->dir)
+				&& ((cmp = strcmp_or_strverscmp(k1->dir, k2->dir)) != 0))
+			return(cmp);
+		return(strcmp_or_strverscmp(k1->str, k2->str));
+	case SORT_MTIME:
+		return(k1->num >= k2->num ? -1 : 1);
+	case SORT_FORMAT:
+		return(strcmp(k1->str, k2->str));
+	default:
+		return((k1->num > k2->num) - (k1->num < k2->num));
+	}
+}
+
+/*
+ * Merge sort which splits and merges exactly like gib_list_sort, so that
+ * files which compare equal end up in the same order as before.
+ */
+static void feh_sort_keys(feh_sort_key * keys, feh_sort_key * tmp, int n,
+		int sort)
+{
+	int half = n / 2, i = 0, j = half, k = 0;
+
+	if (n < 2)
+		return;
+
+	feh_sort_keys(keys, tmp, half, sort);
+	feh_sort_keys(keys + half, tmp, n - half, sort);
+
+	while ((i < half) && (j < n)) {
+		if (feh_sort_key_cmp(&keys[i], &keys[j], sort) < 0)
+			tmp[k++] = keys[i++];
+		else
+			tmp[k++] = keys[j++];
+	}
+	while (i < half)
+		tmp[k++] = keys[i++];
+	while (j < n)
+		tmp[k++] = keys[j++];
+	memcpy(keys, tmp, n * sizeof(feh_sort_key));
+}
+
+/* Sorts list (of feh_files) by sort, keeping its nodes */
+gib_list *feh_filelist_sort(gib_list * list, int sort)
+{
+	feh_sort_key *keys, *tmp;
+	feh_file *file;
+	gib_list *l;
+	int n = gib_list_length(list), i;
+
+	if (n < 2)
+		return(list);
+
+	keys = emalloc(n * sizeof(feh_sort_key));
+	tmp = emalloc(n * sizeof(feh_sort_key));
+
+	for (l = list, i = 0; l; l = l->next, i++) {
+		file = FEH_FILE(l->data);
+		keys[i].node = l;
+		keys[i].str = NULL;
+		keys[i].dir = NULL;
+		keys[i].num = 0;
+		switch (sort) {
+		case SORT_NAME:
+			keys[i].str = file->name;
+			break;
+		case SORT_FILENAME:
+			keys[i].str = file->filename;
+			break;
+		case SORT_DIRNAME:
+			keys[i].dir = file->dir;
+			keys[i].str = file->name;
+			break;
+		case SORT_SIZE:
+			keys[i].num = file->size;
+			break;
+		case SORT_MTIME:
+			keys[i].num = file->mtime;
+			break;
+		case SORT_WIDTH:
+			keys[i].num = file->info->width;
+			break;
+		case SORT_HEIGHT:
+			keys[i].num = file->info->height;
+			break;
+		case SORT_PIXELS:
+			keys[i].num = file->info->pixels;
+			break;
+		case SORT_FORMAT:
+			keys[i].str = file->info->format;
+			break;
+		}
+	}
+
+	feh_sort_keys(keys, tmp, n, sort);
+
+	for (i = 0; i < n; i++) {
+		keys[i].node->prev = i ? keys[i - 1].node : NULL;
+		keys[i].node->next = (i < n - 1) ? keys[i + 1].node : NULL;
+	}
+	list = keys[0].node;
+
+	free(keys);
+	free(tmp);
+	return(list);
+}
+
+void feh_prepare_filelist(void)
+{
+	int preload = feh_filelist_preload_mode();
+
+	if (preload) {
+		filelist = feh_file_info_preload(filelist, preload == 2);
+		feh_metadata_flush();
+		if (!gib_list_length(filelist) && !feh_filelist_streaming())
+			show_mini_usage();
+	}
+
+	/* files from --filelist, the rest is appended by feh_filelist_stream_step */
+	if (feh_filelist_streaming() && !opt.thumbs) {
+		filelist = gib_list_reverse(filelist);
+		filelist_len = gib_list_length(filelist);
+		return;
 	}
 
+	D(("sort mode requested is: %d\n", opt.sort));
+	if (opt.sort == SORT_NONE) {
+		if (opt.randomize) {
+			/* Randomize the filename order */
+			filelist = gib_list_randomize(filelist);
+		} else if (!opt.reverse) {
+			/* Let's reverse the list. Its back-to-front right now ;) */
+			filelist = gib_list_reverse(filelist);
+		}
+	} else if (feh_filelist_cmp())
+		filelist = feh_filelist_sort(filelist, opt.sort);
+
 	/* no point reversing a random list */
 	if (opt.reverse && (opt.sort != SORT_NONE)) {
 		D(("Reversing filelist as requested\n"));
 		filelist = gib_list_reverse(filelist);
 	}
 
+	feh_filelist_index_invalidate();
+	feh_timing_event("filelist complete");
 	return;
 }
 
+/* Links a new node for file into the filelist between prev and next */
+static gib_list *feh_filelist_link(gib_list * prev, gib_list * next,
+		feh_file * file)
+{
+	gib_list *node = gib_list_new();
+
+	node->data = file;
+	node->prev = prev;
+	node->next = next;
+	if (prev)
+		prev->next = node;
+	else
+		filelist = node;
+	if (next)
+		next->prev = node;
+	filelist_len++;
+	return(node);
+}
+
+/*
+ * Adds file to the filelist at the position feh_prepare_filelist would have
+ * given it. Returns its node, or NULL if the file was not added because it
+ * cannot be loaded or is excluded by the dimension filters.
+ */
+gib_list *feh_filelist_add(feh_file * file)
+{
+	gib_compare_fn *cmp = feh_filelist_cmp();
+	int preload = feh_filelist_preload_mode();
+	gib_list *node, *next = NULL, *prev = NULL;
+	int c, lo = 0, hi = filelist_len, mid;
+
+	if ((preload == 2) && (feh_file_info_load(file, NULL)
+				|| feh_file_info_filtered(file)))
+		return(NULL);
+	else if ((preload == 1) && feh_file_stat(file))
+		return(NULL);
+
+	/* find the nodes between which file belongs */
+	if (cmp) {
+		while (lo < hi) {
+			mid = lo + (hi - lo) / 2;
+			c = cmp(file, feh_filelist_nth(mid)->data);
+			if (opt.reverse ? (c > 0) : (c < 0))
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+		next = feh_filelist_nth(lo);
+	} else if (opt.randomize)
+		next = feh_filelist_nth(random() % (filelist_len + 1));
+	else if (opt.reverse)
+		next = filelist;
+
+	if (next)
+		prev = next->prev;
+	else
+		prev = feh_filelist_last();
+
+	node = feh_filelist_link(prev, next, file);
+	feh_filelist_index_insert(node);
+	return(node);
+}
+
+/*
+ * Adds the files in batch to the filelist like feh_filelist_add, but with
+ * a single pass over the filelist and one index update for all of them.
+ * Files which are not added are freed. Returns the list of files which
+ * were added, which the caller has to gib_list_free.
+ */
+gib_list *feh_filelist_add_batch(gib_list * batch)
+{
+	gib_compare_fn *cmp = feh_filelist_cmp();
+	int preload = feh_filelist_preload_mode();
+	gib_list *l, *node = filelist, *prev = NULL, *first;
+	int c, n1 = filelist_len, n2;
+
+	if (batch && preload)
+		batch = feh_file_info_preload(batch, preload == 2);
+	if (!batch)
+		return(NULL);
+
+	if (cmp) {
+		batch = feh_filelist_sort(batch, opt.sort);
+		if (opt.reverse)
+			batch = gib_list_reverse(batch);
+		for (l = batch; l; l = l->next) {
+			while (node && ((c = cmp(l->data, node->data)),
+						opt.reverse ? (c <= 0) : (c >= 0))) {
+				prev = node;
+				node = node->next;
+			}
+			prev = feh_filelist_link(prev, node, l->data);
+		}
+	} else if (opt.randomize) {
+		n2 = gib_list_length(batch);
+		for (l = batch; l;) {
+			if (random() % (n1 + n2) < n2) {
+				prev = feh_filelist_link(prev, node, l->data);
+				l = l->next;
+				n2--;
+			} else {
+				prev = node;
+				node = node->next;
+				n1--;
+			}
+		}
+	} else if (opt.reverse) {
+		for (l = batch; l; l = l->next)
+			feh_filelist_link(NULL, filelist, l->data);
+	} else {
+		prev = first = feh_filelist_link(feh_filelist_last(), NULL, batch->data);
+		for (l = batch->next; l; l = l->next)
+			prev = feh_filelist_link(prev, NULL, l->data);
+		feh_filelist_index_append(first);
+		return(batch);
+	}
+
+	feh_filelist_index_invalidate();
+	return(batch);
+}
+
+/*
+ * Brings the complete filelist into the order feh_prepare_filelist would
+ * have given it. The image currently shown stays where it is.
+ */
+static void feh_filelist_stream_finish(void)
+{
+	stream_state = STREAM_DONE;
+	stream_tail = NULL;
+	feh_metadata_flush();
+	feh_timing_event("filelist complete");
+
+	/* feh_thumbnail_stream_update has put each file in its place */
+	if (opt.thumbs)
+		return;
+
+	if (opt.sort == SORT_NONE) {
+		if (opt.randomize)
+			filelist = gib_list_randomize(filelist);
+		else if (opt.reverse)
+			filelist = gib_list_reverse(filelist);
+	} else {
+		if (feh_filelist_cmp())
+			filelist = feh_filelist_sort(filelist, opt.sort);
+		if (opt.reverse)
+			filelist = gib_list_reverse(filelist);
+	}
+	feh_filelist_index_invalidate();
+
+	slideshow_stream_done();
+}
+
+/*
+ * Adds the next batch of queued files to the end of the filelist. Returns 0
+ * if there is nothing (left) to do, or if it is waiting for --filelist input
+ * and block is not set.
+ */
+int feh_filelist_stream_step(int block)
+{
+	gib_list *saved, *batch;
+	struct pollfd pfd;
+	char *path;
+	int preload;
+
+	if (stream_state == STREAM_QUEUED) {
+		stream_items = gib_list_reverse(stream_items);
+		stream_state = STREAM_RUNNING;
+	}
+	if (stream_state != STREAM_RUNNING)
+		return(0);
+
+	if (stream_fd != -1) {
+		pfd.fd = stream_fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, block ? -1 : 0) <= 0)
+			return(block);
+	}
+
+	saved = filelist;
+	filelist = NULL;
+	if (stream_fd != -1) {
+		if (!feh_filelist_read_chunk(stream_fd, &filelist)) {
+			if (stream_fd != STDIN_FILENO)
+				close(stream_fd);
+			stream_fd = -1;
+		}
+	} else if (stream_walking)
+		stream_walking = feh_scan_walk_step(&stream_walk, FEH_STREAM_STEP);
+	else if (stream_items) {
+		path = stream_items->data;
+		stream_items = gib_list_remove(stream_items, stream_items);
+		add_file_to_filelist_recursively(path, FILELIST_FIRST);
+		free(path);
+	}
+	batch = gib_list_reverse(filelist);
+	filelist = saved;
+
+	if (batch && opt.thumbs)
+		feh_thumbnail_stream_update(batch);
+	else if (batch && (preload = feh_filelist_preload_mode()))
+		batch = feh_file_info_preload(batch, preload == 2);
+
+	if (batch && !opt.thumbs) {
+		/* the filelist may have been reordered in the meantime */
+		if (!stream_tail)
+			stream_tail = gib_list_last(filelist);
+		while (stream_tail && stream_tail->next)
+			stream_tail = stream_tail->next;
+
+		if (stream_tail) {
+			stream_tail->next = batch;
+			batch->prev = stream_tail;
+		} else
+			filelist = batch;
+		filelist_len += gib_list_length(batch);
+		feh_filelist_index_append(batch);
+		stream_tail = gib_list_last(batch);
+
+		slideshow_stream_update(batch);
+	}
+
+	if ((stream_fd == -1) && !stream_walking && !stream_items)
+		feh_filelist_stream_finish();
+	return(1);
+}
+
+void feh_filelist_stream_fdset(fd_set * fdset, int *fdsize)
+{
+	if (stream_fd == -1)
+		return;
+
+	FD_SET(stream_fd, fdset);
+	if (stream_fd >= *fdsize)
+		*fdsize = stream_fd + 1;
+}
+
+/* Returns 1 if file was modified since it was stat(2)ed or preloaded */
+static int feh_file_changed(feh_file * file)
+{
+	struct stat st;
+
+	if ((file->size < 0) || path_is_url(file->filename))
+		return(0);
+
+	return(stat(file->filename, &st) || (st.st_mtime != file->mtime)
+			|| (st.st_size != file->size));
+}
+
+static int feh_cmp_node_filename(const void *node1, const void *node2)
+{
+	return(strcmp(FEH_FILE((*(gib_list **) node1)->data)->filename,
+				FEH_FILE((*(gib_list **) node2)->data)->filename));
+}
+
+static gib_list **feh_filelist_to_array(gib_list * list, int len)
+{
+	gib_list **array = emalloc((len + 1) * sizeof(gib_list *));
+	int i;
+
+	for (i = 0; list; list = list->next)
+		array[i++] = list;
+	qsort(array, len, sizeof(gib_list *), feh_cmp_node_filename);
+	return(array);
+}
+
+/* Inserts the files in add at random positions of list, freeing both lists */
+static gib_list *feh_filelist_merge_randomly(gib_list * list, gib_list * add)
+{
+	gib_list *ret = NULL, *l1 = list, *l2 = add;
+	int n1 = gib_list_length(list), n2 = gib_list_length(add);
+
+	while (n1 + n2) {
+		if (random() % (n1 + n2) < n2) {
+			ret = gib_list_add_front(ret, l2->data);
+			l2 = l2->next;
+			n2--;
+		} else {
+			ret = gib_list_add_front(ret, l1->data);
+			l1 = l1->next;
+			n1--;
+		}
+	}
+	gib_list_free(list);
+	gib_list_free(add);
+	return(gib_list_reverse(ret));
+}
+
+/*
+ * Preloads the files in fresh if needed and merges them into the sorted or
+ * randomized filelist, whose order is kept otherwise. Nodes may be replaced.
+ */
+static void feh_filelist_merge_fresh(gib_list * fresh, int preload)
+{
+	gib_compare_fn *cmp = feh_filelist_cmp();
+
+	if (fresh && preload)
+		fresh = feh_file_info_preload(fresh, preload == 2);
+
+	if (!cmp)
+		filelist = feh_filelist_merge_randomly(filelist,
+				gib_list_randomize(fresh));
+	else if (fresh) {
+		fresh = feh_filelist_sort(fresh, opt.sort);
+		if (opt.reverse)
+			filelist = gib_list_reverse(filelist);
+		filelist = filelist ? gib_list_sort_merge(filelist, fresh, cmp) : fresh;
+		if (opt.reverse)
+			filelist = gib_list_reverse(filelist);
+	}
+}
+
+/* A modified directory which feh_filelist_refresh_dirs reads again */
+typedef struct {
+	feh_scan_entry *entry;
+	feh_scan_dir *scan;
+	char *dir;		/* interned path with trailing slash, see feh_file */
+	size_t dir_len;
+	gib_list *first, *last;	/* kept filelist nodes below it */
+	gib_list *tail;		/* last node below it seen so far */
+	int runs;		/* number of separate runs of nodes below it */
+	gib_list *fresh;
+} feh_refresh_dir;
+
+static void feh_refresh_dirs_free(feh_refresh_dir * dirs, int count)
+{
+	gib_list *l;
+	int i, j;
+
+	for (i = 0; i < count; i++) {
+		for (j = 0; j < dirs[i].scan->item_count; j++) {
+			if (dirs[i].scan->items[j].dir) {
+				free(dirs[i].scan->items[j].dir->path);
+				free(dirs[i].scan->items[j].dir);
+			}
+			free(dirs[i].scan->items[j].name);
+		}
+		free(dirs[i].scan->items);
+		free(dirs[i].scan->path);
+		free(dirs[i].scan);
+		for (l = dirs[i].fresh; l; l = l->next)
+			feh_file_free(l->data);
+		gib_list_free(dirs[i].fresh);
+	}
+	free(dirs);
+}
+
+static feh_scan_item *feh_refresh_dir_find(feh_refresh_dir * d, char *name)
+{
+	feh_scan_item key;
+
+	key.name = name;
+	return(bsearch(&key, d->scan->items, d->scan->item_count,
+				sizeof(feh_scan_item), feh_scan_item_cmp));
+}
+
+/*
+ * Returns 1 if, with --recursive, the subdirectories of d are still the ones
+ * which were scanned (and recorded) before.
+ */
+static int feh_refresh_dir_same_subdirs(feh_refresh_dir * d)
+{
+	gib_list *l;
+	feh_scan_entry *entry;
+	feh_scan_item *item;
+	int i, subdirs = 0, found = 0;
+
+	if (!opt.recursive)
+		return(1);
+
+	for (i = 0; i < d->scan->item_count; i++)
+		if (d->scan->items[i].type == SCAN_ITEM_DIR)
+			subdirs++;
+
+	for (l = scan_entries; l; l = l->next) {
+		entry = l->data;
+		if (strncmp(entry->path, d->dir, d->dir_len)
+				|| strchr(entry->path + d->dir_len, '/'))
+			continue;
+		if (!(item = feh_refresh_dir_find(d, entry->path + d->dir_len))
+				|| (item->type != SCAN_ITEM_DIR))
+			return(0);
+		found++;
+	}
+	return(found == subdirs);
+}
+
+/*
+ * Compares the position of a new file called name in directory d with that
+ * of the file at node (which is below d) in the order of a scan.
+ */
+static int feh_refresh_dir_cmp(feh_refresh_dir * d, gib_list * node, char *name)
+{
+	char *rest = FEH_FILE(node->data)->filename + d->dir_len;
+	char *slash = strchr(rest, '/');
+	char *component;
+	int ret;
+
+	if (!slash)
+		return(strcoll(rest, name));
+	component = estrjoin("", rest, NULL);
+	component[slash - rest] = '\0';
+	ret = strcoll(component, name);
+	free(component);
+	return(ret);
+}
+
+/*
+ * Puts the new files of d (in scan order) into the run of filelist nodes
+ * below it, where a scan would have put them.
+ */
+static void feh_refresh_dir_splice(feh_refresh_dir * d)
+{
+	gib_list *l, *prev = d->first->prev, *node = d->first, *end = d->last->next;
+	int sign = opt.reverse ? -1 : 1;
+
+	if (opt.reverse)
+		d->fresh = gib_list_reverse(d->fresh);
+
+	for (l = d->fresh; l; l = l->next) {
+		while ((node != end)
+				&& (sign * feh_refresh_dir_cmp(d, node, FEH_FILE(l->data)->name) < 0)) {
+			prev = node;
+			node = node->next;
+		}
+		prev = feh_filelist_link(prev, node, l->data);
+	}
+	gib_list_free(d->fresh);
+	d->fresh = NULL;
+}
+
+/*
+ * Updates the filelist for --reload by reading only the directories which
+ * were modified since the last scan and reloading only the files which were
+ * modified. Returns 0 without changing anything if that is not enough, e.g.
+ * because subdirectories or command line items came or went; the caller
+ * then has to scan everything again. Otherwise, stores the node of the
+ * previously current file (or the first node if it was removed) in *ret.
+ */
+static int feh_filelist_refresh_dirs(gib_list * current, gib_list ** ret)
+{
+	gib_list *l, *doomed = NULL, *refill = NULL, *fresh = NULL, *single;
+	feh_refresh_dir *dirs = NULL, *d, *direct;
+	feh_scan_entry *entry;
+	feh_scan_item *item;
+	feh_file *file, *current_data = FEH_FILE(current->data);
+	struct stat st;
+	char *path, *current_name = NULL;
+	int preload = feh_filelist_preload_mode();
+	int in_order = (opt.sort == SORT_NONE) && !opt.randomize;
+	int count = 0, size = 0, i, j, changed;
+	time_t now = time(NULL);
+
+	for (l = scan_entries; l; l = l->next) {
+		entry = l->data;
+		if (!feh_scan_entry_changed(entry, &st))
+			continue;
+		if (!entry->is_dir || stat(entry->path, &st) || !S_ISDIR(st.st_mode))
+			goto fallback;
+		for (i = 0; i < count; i++)
+			if (!strcmp(dirs[i].entry->path, entry->path))
+				goto fallback;
+
+		if (count == size) {
+			size = size ? 2 * size : 8;
+			dirs = erealloc(dirs, size * sizeof(feh_refresh_dir));
+		}
+		d = &dirs[count++];
+		memset(d, 0, sizeof(feh_refresh_dir));
+		d->entry = entry;
+		d->scan = feh_scan_dir_new(estrdup(entry->path));
+		feh_scan_dir_read(d->scan);
+		path = estrjoin("", entry->path, "/", NULL);
+		d->dir_len = strlen(path);
+		d->dir = feh_path_dir(path, d->dir_len);
+		free(path);
+		if (d->scan->error || !feh_refresh_dir_same_subdirs(d))
+			goto fallback;
+	}
+
+	/*
+	 * Decide which nodes to keep. Files in a modified directory stay if it
+	 * still contains them, the others are new. Modified files are reloaded.
+	 */
+	for (l = filelist; l; l = l->next) {
+		file = FEH_FILE(l->data);
+		changed = preload && feh_file_changed(file);
+		direct = NULL;
+		for (i = 0; i < count; i++)
+			if (file->dir == dirs[i].dir)
+				direct = &dirs[i];
+
+		if (direct) {
+			item = feh_refresh_dir_find(direct, file->name);
+			if (item && (item->type == SCAN_ITEM_FILE) && !changed)
+				item->type = SCAN_ITEM_OTHER;
+			else {
+				if (l->data == current_data)
+					current_name = estrdup(file->filename);
+				doomed = gib_list_add_front(doomed, l);
+			}
+		} else if (changed && in_order)
+			refill = gib_list_add_front(refill, l);
+		else if (changed) {
+			fresh = gib_list_add_front(fresh, feh_file_new(file->filename));
+			if (l->data == current_data)
+				current_name = estrdup(file->filename);
+			doomed = gib_list_add_front(doomed, l);
+		}
+
+		/* without sorting, new files go next to their neighbours of a scan */
+		for (i = 0; in_order && (i < count); i++) {
+			d = &dirs[i];
+			if (strncmp(file->filename, d->dir, d->dir_len))
+				continue;
+			if (!d->runs || (d->tail != l->prev))
+				d->runs++;
+			d->tail = l;
+			if (doomed && (doomed->data == l))
+				continue;
+			if (!d->first)
+				d->first = l;
+			d->last = l;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		d = &dirs[i];
+		for (j = 0; j < d->scan->item_count; j++) {
+			item = &d->scan->items[j];
+			if (item->type == SCAN_ITEM_FILE) {
+				path = estrjoin("", d->dir, item->name, NULL);
+				d->fresh = gib_list_add_front(d->fresh, feh_file_new(path));
+				free(path);
+			}
+		}
+		d->fresh = gib_list_reverse(d->fresh);
+		if (in_order && ((d->runs > 1) || (d->fresh && !d->first)))
+			goto fallback;
+	}
+
+	/* from here on, nothing can go wrong */
+	D(("reading %d modified directories\n", count));
+	scan_time = now;
+	for (i = 0; i < count; i++) {
+		d = &dirs[i];
+		d->entry->mtime = d->scan->st.st_mtime;
+		for (j = 0; j < d->scan->item_count; j++) {
+			item = &d->scan->items[j];
+			if (item->type == SCAN_ITEM_ERROR) {
+				path = estrjoin("", d->dir, item->name, NULL);
+				errno = item->error;
+				feh_print_stat_error(path);
+				free(path);
+			}
+		}
+	}
+
+	for (l = doomed; l; l = l->next)
+		filelist = feh_file_remove_from_list(filelist, l->data);
+	gib_list_free(doomed);
+
+	for (l = refill; l; l = l->next) {
+		file = FEH_FILE(((gib_list *) l->data)->data);
+		single = gib_list_add_front(NULL, feh_file_new(file->filename));
+		single = feh_file_info_preload(single, preload == 2);
+		if (single) {
+			feh_file_free(file);
+			((gib_list *) l->data)->data = single->data;
+			gib_list_free(single);
+		} else {
+			if (l->data == current)
+				current_name = estrdup(file->filename);
+			filelist = feh_file_remove_from_list(filelist, l->data);
+		}
+	}
+	gib_list_free(refill);
+
+	if (in_order) {
+		for (i = 0; i < count; i++) {
+			d = &dirs[i];
+			if (d->fresh && preload)
+				d->fresh = feh_file_info_preload(d->fresh, preload == 2);
+			if (d->fresh)
+				feh_refresh_dir_splice(d);
+		}
+	} else {
+		for (i = 0; i < count; i++) {
+			fresh = gib_list_cat(fresh, dirs[i].fresh);
+			dirs[i].fresh = NULL;
+		}
+		feh_filelist_merge_fresh(fresh, preload);
+		filelist_len = gib_list_length(filelist);
+	}
+	feh_refresh_dirs_free(dirs, count);
+
+	feh_filelist_index_invalidate();
+#ifdef HAVE_INOTIFY
+	feh_watch_invalidate();
+#endif
+	if (!filelist_len) {
+		eprintf("No files found to reload.");
+	}
+	feh_metadata_flush();
+
+	if (current_name || !in_order) {
+		for (l = filelist; l; l = l->next)
+			if (current_name ? !strcmp(FEH_FILE(l->data)->filename, current_name)
+					: (l->data == current_data))
+				break;
+		free(current_name);
+		current = l;
+	}
+	*ret = current ? current : filelist;
+	return(1);
+
+fallback:
+	if (dirs)
+		feh_refresh_dirs_free(dirs, count);
+	for (l = fresh; l; l = l->next)
+		feh_file_free(l->data);
+	gib_list_free(fresh);
+	gib_list_free(doomed);
+	gib_list_free(refill);
+	free(current_name);
+	return(0);
+}
+
+/*
+ * Updates the filelist for --reload. Nothing is scanned again unless one of
+ * the directories (or the filelist file) was modified, or a file whose
+ * stat(2) data is used for sorting has changed, and usually only the
+ * modified directories are read (see feh_filelist_refresh_dirs). Otherwise,
+ * it falls back to feh_filelist_rescan.
+ *
+ * Returns the node of the previously current file, or the first node if it
+ * was removed.
+ */
+gib_list *feh_filelist_refresh(gib_list * current)
+{
+	gib_list *l;
+	int preload = feh_filelist_preload_mode();
+
+	if (!feh_scan_changed()) {
+		for (l = filelist; preload && l; l = l->next)
+			if (feh_file_changed(FEH_FILE(l->data)))
+				break;
+		if (!preload || !l)
+			return(current);
+	}
+	if (feh_filelist_refresh_dirs(current, &l))
+		return(l);
+	return(feh_filelist_rescan(current));
+}
+
+/*
+ * Scans original_file_items and the filelist file again and returns the
+ * files found, in the (reversed) order of add_file_to_filelist_recursively.
+ * The filelist itself is left alone.
+ */
+gib_list *feh_filelist_scan(void)
+{
+	gib_list *l, *saved = filelist, *ret;
+
+	feh_scan_free();
+	filelist = NULL;
+
+	if (gib_list_length(original_file_items) > 0)
+		for (l = gib_list_last(original_file_items); l; l = l->prev)
+			add_file_to_filelist_recursively(l->data, FILELIST_FIRST);
+	else if (!opt.filelistfile && !opt.bgmode)
+		add_file_to_filelist_recursively(".", FILELIST_FIRST);
+
+	if (opt.filelistfile) {
+		filelist = gib_list_cat(filelist, feh_read_filelist(opt.filelistfile));
+	}
+
+	ret = filelist;
+	filelist = saved;
+	return(ret);
+}
+
+/*
+ * Scans everything again, e.g. for --reload when feh_filelist_refresh_dirs
+ * is not enough. Files which are still present after the scan keep their
+ * preloaded information and their place in the sorted list, and only new
+ * files are preloaded and merged into it.
+ *
+ * Returns the node of the previously current file, or the first node if it
+ * was removed.
+ */
+gib_list *feh_filelist_rescan(gib_list * current)
+{
+	gib_list *l, *kept = NULL, *fresh = NULL, **old_nodes, **new_nodes;
+	feh_file *current_data = FEH_FILE(current->data);
+	char *current_name = NULL;
+	int preload = feh_filelist_preload_mode();
+	int old_len = gib_list_length(filelist), new_len, i = 0, j = 0, c;
+
+	feh_filelist_index_invalidate();
+#ifdef HAVE_INOTIFY
+	feh_watch_invalidate();
+#endif
+
+	old_nodes = feh_filelist_to_array(filelist, old_len);
+	kept = filelist;
+	filelist = feh_filelist_scan();
+
+	if (!(new_len = gib_list_length(filelist))) {
+		eprintf("No files found to reload.");
+	}
+
+	/*
+	 * Match old and new files by name. Afterwards, the new list and the old
+	 * one (kept) point to the old feh_file of unchanged files, removed and
+	 * changed files are NULL in kept, and fresh lists the remaining new
+	 * files.
+	 */
+	new_nodes = feh_filelist_to_array(filelist, new_len);
+	while ((i < old_len) || (j < new_len)) {
+		if (i == old_len)
+			c = 1;
+		else if (j == new_len)
+			c = -1;
+		else
+			c = feh_cmp_node_filename(&old_nodes[i], &new_nodes[j]);
+
+		if ((c == 0) && !feh_file_changed(FEH_FILE(old_nodes[i]->data))) {
+			feh_file_free(new_nodes[j]->data);
+			new_nodes[j++]->data = old_nodes[i++]->data;
+			continue;
+		}
+		if (c <= 0) {
+			if (old_nodes[i]->data == current_data)
+				current_name = estrdup(current_data->filename);
+			feh_file_free(old_nodes[i]->data);
+			old_nodes[i++]->data = NULL;
+		}
+		if (c >= 0)
+			fresh = gib_list_add_front(fresh, new_nodes[j++]->data);
+	}
+	free(old_nodes);
+	free(new_nodes);
+
+	if ((opt.sort == SORT_NONE) && !opt.randomize) {
+		/* keep the order of the new scan, see feh_prepare_filelist */
+		gib_list_free(kept);
+		gib_list_free(fresh);
+		if (preload)
+			filelist = feh_file_info_preload(filelist, preload == 2);
+		if (!opt.reverse)
+			filelist = gib_list_reverse(filelist);
+	} else {
+		gib_list_free(filelist);
+		filelist = NULL;
+		for (l = gib_list_last(kept); l; l = l->prev)
+			if (l->data)
+				filelist = gib_list_add_front(filelist, l->data);
+		gib_list_free(kept);
+
+		feh_filelist_merge_fresh(fresh, preload);
+	}
+
+	if (!(filelist_len = gib_list_length(filelist))) {
+		eprintf("No files found to reload.");
+	}
+	feh_metadata_flush();
+
+	for (l = filelist; l; l = l->next)
+		if (current_name ? !strcmp(FEH_FILE(l->data)->filename, current_name)
+				: (l->data == current_data))
+			break;
+	free(current_name);
+
+	return(l ? l : filelist);
+}
+
 int feh_write_filelist(gib_list * list, char *filename)
 {
 	FILE *fp;
@@ -583,9 +2395,9 @@ int feh_write_filelist(gib_list * list, char *filename)
 
 gib_list *feh_read_filelist(char *filename)
 {
-	FILE *fp;
 	gib_list *list = NULL;
-	char s[1024], s1[1024];
+	char *map;
+	int fd;
 	Imlib_Load_Error err = IMLIB_LOAD_ERROR_NONE;
 	Imlib_Image tmp_im;
 	struct stat st;
@@ -594,6 +2406,8 @@ gib_list *feh_read_filelist(char *filename)
 	if (!filename)
 		return(NULL);
 
+	feh_scan_record(filename, stat(filename, &st) ? NULL : &st);
+
 	/*
 	 * feh_load_image will fail horribly if filename is not seekable
 	 */
@@ -614,28 +2428,33 @@ gib_list *feh_read_filelist(char *filename)
 	errno = 0;
 
 	if (!strcmp(filename, "/dev/stdin"))
-		fp = stdin;
+		fd = STDIN_FILENO;
 	else
-		fp = fopen(filename, "r");
+		fd = open(filename, O_RDONLY | O_CLOEXEC);
 
-	if (fp == NULL) {
+	if (fd == -1) {
 		/* return quietly, as it's okay to specify a filelist file that doesn't
 		   exist. In that case we create it on exit. */
 		return(NULL);
 	}
 
-	for (; fgets(s, sizeof(s), fp);) {
-		D(("Got line '%s'\n", s));
-		s1[0] = '\0';
-		sscanf(s, "%[^\r\n]", (char *) &s1);
-		if (!(*s1) || (*s1 == '\n'))
-			continue;
-		D(("Got filename %s from filelist file\n", s1));
-		/* Add it to the new list */
-		list = gib_list_add_front(list, feh_file_new(s1));
-	}
-	if (strcmp(filename, "/dev/stdin"))
-		fclose(fp);
+	if (!fstat(fd, &st) && S_ISREG(st.st_mode) && (st.st_size > 0)
+			&& ((map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))
+				!= MAP_FAILED)) {
+		posix_madvise(map, st.st_size, POSIX_MADV_SEQUENTIAL);
+		feh_filelist_parse(map, st.st_size, 1, &list);
+		munmap(map, st.st_size);
+	} else if (!S_ISREG(st.st_mode) && (stream_state <= STREAM_QUEUED)
+			&& feh_filelist_stream_mode()) {
+		/* see feh_filelist_stream_step */
+		stream_fd = fd;
+		stream_state = STREAM_QUEUED;
+		return(NULL);
+	} else
+		while (feh_filelist_read_chunk(fd, &list));
+
+	if (fd != STDIN_FILENO)
+		close(fd);
 
 	return(list);
 }
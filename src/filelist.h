@@ -27,6 +27,8 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #ifndef FILELIST_H
 #define FILELIST_H
 
+#include "worker.h"
+
 #ifdef HAVE_LIBEXIF
 #include <libexif/exif-data.h>
 #endif
@@ -34,12 +36,14 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 struct __feh_file {
 	char *filename;
 	char *caption;
-	char *name;
+	char *name;		/* points into filename */
+	char *dir;		/* interned, "" or ends with '/' */
 
 	/* info stuff */
 	time_t mtime;
 	int size;
 	feh_file_info *info;	/* only set when needed */
+	int slot;		/* position in the filelist index */
 #ifdef HAVE_LIBEXIF
 	ExifData *ed;
 #endif
@@ -82,6 +86,7 @@ enum sort_type {
 };
 
 feh_file *feh_file_new(char *filename);
+feh_file *feh_file_new_len(char *filename, size_t len);
 void feh_file_free(feh_file * file);
 feh_file_info *feh_file_info_new(void);
 void feh_file_info_free(feh_file_info * info);
@@ -94,7 +99,19 @@ gib_list *feh_file_info_preload(gib_list * list, int load_images);
 int feh_file_stat(feh_file * file);
 int feh_file_info_load(feh_file * file, Imlib_Image im);
 void feh_file_dirname(char *dst, feh_file * f, int maxlen);
+gib_list *feh_filelist_sort(gib_list * list, int sort);
 void feh_prepare_filelist(void);
+gib_list *feh_filelist_refresh(gib_list * current);
+gib_list *feh_filelist_scan(void);
+gib_list *feh_filelist_rescan(gib_list * current);
+gib_list *feh_filelist_add(feh_file * file);
+gib_list *feh_filelist_add_batch(gib_list * batch);
+void feh_filelist_index_invalidate(void);
+int feh_filelist_pos(gib_list * l);
+gib_list *feh_filelist_nth(int n);
+int feh_filelist_streaming(void);
+int feh_filelist_stream_step(int block);
+void feh_filelist_stream_fdset(fd_set * fdset, int *fdsize);
 int feh_write_filelist(gib_list * list, char *filename);
 gib_list *feh_read_filelist(char *filename);
 char *feh_absolute_path(char *path);
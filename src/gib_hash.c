@@ -22,6 +22,8 @@ IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
 CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 */
+#include <ctype.h>
+#include <string.h>
 #include <strings.h>
 
 #include "gib_hash.h"
@@ -53,97 +55,142 @@ void           gib_hash_node_free_and_data(gib_hash_node *node)
 	return;
 }
 
+/*
+ * Marks the slot of a removed node. Lookups have to probe past it, while
+ * gib_hash_set may reuse it.
+ */
+static gib_hash_node gib_hash_removed;
+
+/* FNV-1a of the lowercased key, as keys are compared with strcasecmp */
+static unsigned int gib_hash_key(char *key)
+{
+	unsigned int h = 2166136261u;
+
+	for (; *key; key++) {
+		h ^= (unsigned char) tolower((unsigned char) *key);
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/*
+ * Returns the slot holding key, or, if key is not in hash, the slot where it
+ * should be inserted.
+ */
+static unsigned int gib_hash_find(gib_hash *hash, char *key)
+{
+	unsigned int mask = hash->size - 1;
+	unsigned int i = gib_hash_key(key) & mask;
+	unsigned int insert = hash->size;
+	gib_hash_node *node;
+
+	while ((node = hash->nodes[i]) != NULL) {
+		if (node == &gib_hash_removed) {
+			if (insert == hash->size)
+				insert = i;
+		}
+		/* strncasecmp causes similar keys like key1 and key11 clobber each other */
+		else if (!strcasecmp(node->key, key))
+			return i;
+		i = (i + 1) & mask;
+	}
+	return (insert == hash->size) ? i : insert;
+}
+
+/* Moves all nodes to a new table with a load factor of at most 1/3 */
+static void gib_hash_resize(gib_hash *hash)
+{
+	gib_hash_node **old_nodes = hash->nodes;
+	unsigned int old_size = hash->size;
+	unsigned int i;
+
+	hash->size = 16;
+	while (hash->size < (hash->count + 1) * 3)
+		hash->size *= 2;
+	hash->nodes = emalloc(hash->size * sizeof(gib_hash_node *));
+	memset(hash->nodes, 0, hash->size * sizeof(gib_hash_node *));
+	hash->used = hash->count;
+
+	for (i = 0; i < old_size; i++)
+		if (old_nodes[i] && (old_nodes[i] != &gib_hash_removed))
+			hash->nodes[gib_hash_find(hash, old_nodes[i]->key)] = old_nodes[i];
+	free(old_nodes);
+}
+
 gib_hash *gib_hash_new(void)
 {
 	gib_hash *hash = emalloc(sizeof(gib_hash));
-	hash->base = gib_hash_node_new("__gib_hash_new",NULL);
+	hash->size = 16;
+	hash->count = 0;
+	hash->used = 0;
+	hash->nodes = emalloc(hash->size * sizeof(gib_hash_node *));
+	memset(hash->nodes, 0, hash->size * sizeof(gib_hash_node *));
 	return hash;
 }
 
-void      gib_hash_free(gib_hash *hash)
+static void gib_hash_free_nodes(gib_hash *hash, int free_data)
 {
-	/* free hash keys as it's not taken care of by gib_list_free */
-	gib_list *i;
-	for (i = GIB_LIST(hash->base); i; i = i->next)
-		free(GIB_HASH_NODE(i)->key);
-
-	gib_list_free(GIB_LIST(hash->base));
+	unsigned int i;
+
+	for (i = 0; i < hash->size; i++)
+		if (hash->nodes[i] && (hash->nodes[i] != &gib_hash_removed)) {
+			if (free_data)
+				gib_hash_node_free_and_data(hash->nodes[i]);
+			else
+				gib_hash_node_free(hash->nodes[i]);
+		}
+	free(hash->nodes);
 	free(hash);
-	return;
 }
 
-void      gib_hash_free_and_data(gib_hash *hash)
+void      gib_hash_free(gib_hash *hash)
 {
-	/* free hash keys as it's not taken care of by gib_list_free */
-	gib_list *i;
-	for (i = GIB_LIST(hash->base); i; i = i->next)
-		free(GIB_HASH_NODE(i)->key);
-
-	gib_list_free_and_data(GIB_LIST(hash->base));
-	free(hash);
+	gib_hash_free_nodes(hash, 0);
 	return;
 }
 
-static unsigned char gib_hash_find_callback(gib_list *list, void *data)
+void      gib_hash_free_and_data(gib_hash *hash)
 {
-	gib_hash_node *node = GIB_HASH_NODE(list);
-	char          *key  = (char*) data;
-
-	/* strncasecmp causes similar keys like key1 and key11 clobber each other */
-	return !strcasecmp(node->key, key);
+	gib_hash_free_nodes(hash, 1);
+	return;
 }
 
 void      gib_hash_set(gib_hash *hash, char *key, void *data)
 {
-	gib_list *l;
-	gib_hash_node *n;
-
-	n = GIB_HASH_NODE(gib_list_find(GIB_LIST(hash->base),
-	                                gib_hash_find_callback,
-	                                key));
-	if (n)	{
-		GIB_LIST(n)->data = data;
-	} else {
-		/* not using gib_list_add_end here as that would nest the
-			 data one level, doing manual insert instead */
-		n = gib_hash_node_new(key,data);
-		l = gib_list_last(GIB_LIST(hash->base));
-
-		GIB_LIST(n)->next = NULL;
-		GIB_LIST(n)->prev = l;
-
-		if (l)
-			l->next = GIB_LIST(n);
+	unsigned int i;
+
+	if ((hash->used + 1) * 3 > hash->size * 2)
+		gib_hash_resize(hash);
+
+	i = gib_hash_find(hash, key);
+	if (hash->nodes[i] && (hash->nodes[i] != &gib_hash_removed)) {
+		GIB_LIST(hash->nodes[i])->data = data;
+		return;
 	}
+
+	if (!hash->nodes[i])
+		hash->used++;
+	hash->nodes[i] = gib_hash_node_new(key, data);
+	hash->count++;
 }
 
 void     *gib_hash_get(gib_hash *hash, char *key)
 {
-	gib_list *n = gib_list_find(GIB_LIST(hash->base),gib_hash_find_callback,key);
-	return n?n->data:NULL;
-}
+	gib_hash_node *node = hash->nodes[gib_hash_find(hash, key)];
 
-/* unused
+	if (!node || (node == &gib_hash_removed))
+		return NULL;
+	return GIB_LIST(node)->data;
+}
 
 void      gib_hash_remove(gib_hash *hash, char *key)
 {
-	gib_list *n = gib_list_find(GIB_LIST(hash->base), gib_hash_find_callback, key);
-	if (n) {
-		gib_list_unlink(GIB_LIST(hash->base), n);
-    gib_hash_node_free(GIB_HASH_NODE(n->data));
-  }
-
-	return;
-}
+	unsigned int i = gib_hash_find(hash, key);
 
-void      gib_hash_foreach(gib_hash *hash, void (*foreach_cb)(gib_hash_node *node, void *data), void *data)
-{
-	gib_hash_node *i, *next;
-	for (i=hash->base; i; i=next) {
-		next = GIB_HASH_NODE(GIB_LIST(i)->next);
-		foreach_cb(i,data);
+	if (hash->nodes[i] && (hash->nodes[i] != &gib_hash_removed)) {
+		gib_hash_node_free(hash->nodes[i]);
+		hash->nodes[i] = &gib_hash_removed;
+		hash->count--;
 	}
 	return;
 }
-
-*/
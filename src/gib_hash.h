@@ -35,9 +35,13 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 typedef struct __gib_hash      gib_hash;
 typedef struct __gib_hash_node gib_hash_node;
 
+/* open addressing with linear probing, see gib_hash.c */
 struct __gib_hash
 {
-	gib_hash_node *base;
+	gib_hash_node **nodes;
+	unsigned int size;	/* number of slots, a power of two */
+	unsigned int count;	/* nodes in the table */
+	unsigned int used;	/* slots which are not empty, i.e. nodes and removed nodes */
 };
 
 struct __gib_hash_node
@@ -61,10 +65,9 @@ void      gib_hash_free_and_data(gib_hash *hash);
 
 void      gib_hash_set(gib_hash *hash, char *key, void *data);
 void     *gib_hash_get(gib_hash *hash, char *key);
-
-/* unused
 void      gib_hash_remove(gib_hash *hash, char *key);
 
+/* unused
 void      gib_hash_foreach(gib_hash *hash, void (*foreach_cb)(gib_hash_node *node, void *data), void *data);
 */
 
@@ -28,33 +28,57 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "utils.h"
 #include "debug.h"
 
+/*
+ * Nodes are allocated in blocks of GIB_LIST_BLOCK and never given back to
+ * malloc. Free nodes are kept in free_nodes (linked through next), and freed
+ * lists are kept as a whole in free_lists (linked through the prev pointer of
+ * their head), so that gib_list_free is O(1) even for huge lists. A node must
+ * therefore never be passed to free().
+ */
+#define GIB_LIST_BLOCK 1024
+
+static gib_list *free_nodes = NULL;
+static gib_list *free_lists = NULL;
+
 gib_list *
 gib_list_new(void)
 {
    gib_list *l;
+   int i;
+
+   if (!free_nodes)
+   {
+      if (free_lists)
+      {
+         free_nodes = free_lists;
+         free_lists = free_lists->prev;
+      }
+      else
+      {
+         free_nodes = (gib_list *) emalloc(GIB_LIST_BLOCK * sizeof(gib_list));
+         for (i = 0; i < GIB_LIST_BLOCK - 1; i++)
+            free_nodes[i].next = &free_nodes[i + 1];
+         free_nodes[i].next = NULL;
+      }
+   }
+   l = free_nodes;
+   free_nodes = l->next;
 
-   l = (gib_list *) emalloc(sizeof(gib_list));
    l->data = NULL;
    l->next = NULL;
    l->prev = NULL;
    return (l);
 }
 
+/* frees l and all nodes after it */
 void
 gib_list_free(gib_list * l)
 {
-   gib_list *ll;
-
    if (!l)
       return;
 
-   while (l)
-   {
-      ll = l;
-      l = l->next;
-      free(ll);
-   }
-
+   l->prev = free_lists;
+   free_lists = l;
    return;
 }
 
@@ -63,16 +87,9 @@ gib_list_free_and_data(gib_list * l)
 {
    gib_list *ll;
 
-   if (!l)
-      return;
-
-   while (l)
-   {
-      ll = l;
-      l = l->next;
+   for (ll = l; ll; ll = ll->next)
       free(ll->data);
-      free(ll);
-   }
+   gib_list_free(l);
    return;
 }
 
@@ -419,7 +436,8 @@ gib_list *
 gib_list_remove(gib_list * root, gib_list * l)
 {
    root = gib_list_unlink(root, l);
-   free(l);
+   l->next = free_nodes;
+   free_nodes = l;
    return (root);
 }
 
@@ -0,0 +1,518 @@
+/* http.c
+
+Copyright (C) 2024 feh contributors.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to
+deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+sell copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies of the Software and its documentation and acknowledgment shall be
+given in the documentation and software packages that this Software was
+used.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+/*
+ * mkstemps(3) is a nonstandard extension that requires defining
+ * _GNU_SOURCE for glibc
+ */
+#ifdef HAVE_MKSTEMPS
+#define _GNU_SOURCE
+#endif
+
+#include "feh.h"
+#include "options.h"
+#include "signals.h"
+#include "http.h"
+
+#ifdef HAVE_LIBCURL
+#include <curl/curl.h>
+
+/*
+ * Downloads for remote images. All transfers share one curl multi handle:
+ * while an image is shown, feh_prefetch_update queues the URLs among the
+ * next --prefetch slides and the main loop keeps their transfers going. At
+ * most --http-connections of them (and at most --http-host-connections to
+ * the same host) run at the same time, in the order they were queued.
+ * Transfers for slides the user has skipped past are cancelled.
+ *
+ * feh_http_fetch still waits until its URL has been downloaded, but the
+ * image to be shown next does not wait for a free connection, and the other
+ * transfers continue in the meantime.
+ */
+
+enum http_state { HTTP_QUEUED, HTTP_RUNNING, HTTP_DONE, HTTP_FAILED };
+
+typedef struct {
+	char *url;
+	char *host;		/* host[:port], for --http-host-connections */
+	char *sfn;		/* downloaded file */
+	FILE *sfp;
+	CURL *curl;
+	char *ebuff;
+	enum http_state state;
+} feh_http_transfer;
+
+static CURLM *multi = NULL;
+static pid_t multi_pid = 0;
+static gib_list *transfers = NULL;
+static gib_list *prefetch_queue = NULL;
+static int running = 0;
+
+#if LIBCURL_VERSION_NUM >= 0x072000 /* 07.32.0 */
+static int curl_quit_function(void *clientp,  curl_off_t dltotal,  curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
+#else
+static int curl_quit_function(void *clientp,  double dltotal,  double dlnow, double ultotal, double ulnow)
+#endif
+{
+	// ignore "unused parameter" warnings
+	(void)clientp;
+	(void)dltotal;
+	(void)dlnow;
+	(void)ultotal;
+	(void)ulnow;
+	if (sig_exit) {
+		/*
+		 * The user wants to quit feh. Tell libcurl to abort the transfer and
+		 * return control to the main loop, where we can quit gracefully.
+		 */
+		return 1;
+	}
+	return 0;
+}
+
+static int feh_http_init(void)
+{
+	if (multi && (multi_pid == getpid()))
+		return(1);
+
+	/* a worker process must leave the transfers of its parent alone */
+	transfers = prefetch_queue = NULL;
+	running = 0;
+
+	if (!(multi = curl_multi_init())) {
+		weprintf("open url: libcurl initialization failure");
+		return(0);
+	}
+	multi_pid = getpid();
+	return(1);
+}
+
+static char *feh_http_host(char *url)
+{
+	char *start = strstr(url, "://");
+	char *host;
+	size_t len, i;
+
+	start = start ? start + 3 : url;
+	len = strcspn(start, "/?#");
+	for (i = len; i > 0; i--) {
+		if (start[i - 1] == '@') {
+			start += i;
+			len -= i;
+			break;
+		}
+	}
+	host = emalloc(len + 1);
+	memcpy(host, start, len);
+	host[len] = '\0';
+	return(host);
+}
+
+static feh_http_transfer *feh_http_transfer_new(char *url)
+{
+	feh_http_transfer *t = emalloc(sizeof(feh_http_transfer));
+
+	memset(t, 0, sizeof(feh_http_transfer));
+	t->url = estrdup(url);
+	t->host = feh_http_host(url);
+	t->ebuff = emalloc(CURL_ERROR_SIZE);
+	t->ebuff[0] = '\0';
+	t->state = HTTP_QUEUED;
+	return(t);
+}
+
+static gib_list *feh_http_find(gib_list * list, char *url)
+{
+	gib_list *l;
+
+	for (l = list; l; l = l->next)
+		if (!strcmp(((feh_http_transfer *) l->data)->url, url))
+			return(l);
+	return(NULL);
+}
+
+/* Creates the temporary file for t and adds it to the multi handle */
+static void feh_http_start(feh_http_transfer * t)
+{
+	int fd = -1;
+	char *tmpname;
+	char *basename;
+	char *path = NULL;
+
+	t->state = HTTP_FAILED;
+
+	if (opt.keep_http) {
+		if (opt.output_dir)
+			path = opt.output_dir;
+		else
+			path = "";
+	} else
+		path = "/tmp/";
+
+	basename = strrchr(t->url, '/') + 1;
+
+#ifdef HAVE_MKSTEMPS
+	tmpname = estrjoin("_", "feh_curl_XXXXXX", basename, NULL);
+
+	if (strlen(tmpname) > NAME_MAX) {
+		tmpname[NAME_MAX] = '\0';
+	}
+#else
+	if (strlen(basename) > NAME_MAX-7) {
+		tmpname = estrdup("feh_curl_XXXXXX");
+	} else {
+		tmpname = estrjoin("_", "feh_curl", basename, "XXXXXX", NULL);
+	}
+#endif
+
+	t->sfn = estrjoin("", path, tmpname, NULL);
+
+	D(("sfn is %s\n", t->sfn))
+
+#ifdef HAVE_MKSTEMPS
+	fd = mkstemps(t->sfn, strlen(tmpname) - strlen("feh_curl_XXXXXX"));
+#else
+	fd = mkstemp(t->sfn);
+#endif
+	free(tmpname);
+
+	if (fd == -1) {
+#ifdef HAVE_MKSTEMPS
+		weprintf("open url: mkstemps failed:");
+#else
+		weprintf("open url: mkstemp failed:");
+#endif
+		free(t->sfn);
+		t->sfn = NULL;
+		return;
+	}
+	if (!(t->sfp = fdopen(fd, "w+"))) {
+		weprintf("open url: fdopen failed:");
+		close(fd);
+		unlink(t->sfn);
+		free(t->sfn);
+		t->sfn = NULL;
+		return;
+	}
+	if (!(t->curl = curl_easy_init())) {
+		weprintf("open url: libcurl initialization failure");
+		fclose(t->sfp);
+		unlink(t->sfn);
+		free(t->sfn);
+		t->sfn = NULL;
+		return;
+	}
+
+#ifdef DEBUG
+	curl_easy_setopt(t->curl, CURLOPT_VERBOSE, 1);
+#endif
+	/*
+	 * Do not allow requests to take longer than 30 minutes.
+	 * This should be sufficiently high to accommodate use cases with
+	 * unusually high latencies, while at the same time avoiding
+	 * feh hanging indefinitely in unattended slideshows.
+	 */
+	curl_easy_setopt(t->curl, CURLOPT_TIMEOUT, 1800L);
+	curl_easy_setopt(t->curl, CURLOPT_URL, t->url);
+	curl_easy_setopt(t->curl, CURLOPT_WRITEDATA, t->sfp);
+	curl_easy_setopt(t->curl, CURLOPT_ERRORBUFFER, t->ebuff);
+	curl_easy_setopt(t->curl, CURLOPT_PRIVATE, t);
+	curl_easy_setopt(t->curl, CURLOPT_USERAGENT, PACKAGE "/" VERSION);
+	curl_easy_setopt(t->curl, CURLOPT_FAILONERROR, 1L);
+	curl_easy_setopt(t->curl, CURLOPT_FOLLOWLOCATION, 1L);
+#if LIBCURL_VERSION_NUM >= 0x072000 /* 07.32.0 */
+	curl_easy_setopt(t->curl, CURLOPT_XFERINFOFUNCTION, curl_quit_function);
+#else
+	curl_easy_setopt(t->curl, CURLOPT_PROGRESSFUNCTION, curl_quit_function);
+#endif
+	curl_easy_setopt(t->curl, CURLOPT_NOPROGRESS, 0L);
+	if (opt.insecure_ssl) {
+		curl_easy_setopt(t->curl, CURLOPT_SSL_VERIFYPEER, 0L);
+		curl_easy_setopt(t->curl, CURLOPT_SSL_VERIFYHOST, 0L);
+	} else if (getenv("CURL_CA_BUNDLE") != NULL) {
+		// Allow the user to specify custom CA certificates.
+		curl_easy_setopt(t->curl, CURLOPT_CAINFO,
+				getenv("CURL_CA_BUNDLE"));
+	}
+
+	curl_multi_add_handle(multi, t->curl);
+	t->state = HTTP_RUNNING;
+	running++;
+	D(("downloading %s\n", t->url));
+}
+
+static void feh_http_stop(feh_http_transfer * t)
+{
+	curl_multi_remove_handle(multi, t->curl);
+	curl_easy_cleanup(t->curl);
+	t->curl = NULL;
+	fclose(t->sfp);
+	t->sfp = NULL;
+	running--;
+}
+
+static void feh_http_finish(feh_http_transfer * t, CURLcode res)
+{
+	feh_http_stop(t);
+
+	if (res == CURLE_OK) {
+		t->state = HTTP_DONE;
+		return;
+	}
+
+	t->state = HTTP_FAILED;
+	if (res == CURLE_ABORTED_BY_CALLBACK)
+		t->ebuff[0] = '\0';
+	else if (!t->ebuff[0])
+		snprintf(t->ebuff, CURL_ERROR_SIZE, "%s", curl_easy_strerror(res));
+	unlink(t->sfn);
+	free(t->sfn);
+	t->sfn = NULL;
+}
+
+/* Cancels t if it is still running and discards its download */
+static void feh_http_free(feh_http_transfer * t)
+{
+	if (t->state == HTTP_RUNNING) {
+		D(("cancelling %s\n", t->url));
+		feh_http_stop(t);
+	}
+	if (t->sfn) {
+		unlink(t->sfn);
+		free(t->sfn);
+	}
+	free(t->url);
+	free(t->host);
+	free(t->ebuff);
+	free(t);
+}
+
+static void feh_http_dispatch(void)
+{
+	gib_list *l, *m;
+	feh_http_transfer *t, *other;
+	int same_host;
+
+	for (l = transfers; l && (running < opt.http_connections); l = l->next) {
+		t = l->data;
+		if (t->state != HTTP_QUEUED)
+			continue;
+		for (same_host = 0, m = transfers; m; m = m->next) {
+			other = m->data;
+			if ((other->state == HTTP_RUNNING) && !strcmp(other->host, t->host))
+				same_host++;
+		}
+		if (same_host < opt.http_host_connections)
+			feh_http_start(t);
+	}
+}
+
+/* Collects finished transfers and starts queued ones */
+void feh_http_handle(void)
+{
+	feh_http_transfer *t;
+	CURLMsg *msg;
+	CURLcode res;
+	int count;
+
+	if (!running || (multi_pid != getpid()))
+		return;
+
+	curl_multi_perform(multi, &count);
+	while ((msg = curl_multi_info_read(multi, &count))) {
+		if (msg->msg != CURLMSG_DONE)
+			continue;
+		res = msg->data.result;
+		curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **) &t);
+		feh_http_finish(t, res);
+	}
+	feh_http_dispatch();
+}
+
+/*
+ * Adds the sockets of the running transfers to fdset and wfdset. Returns
+ * the number of milliseconds after which feh_http_handle must be called even
+ * if none of them becomes ready, or -1 if there is no such limit.
+ */
+long feh_http_fdset(fd_set * fdset, fd_set * wfdset, int *fdsize)
+{
+	fd_set efdset;
+	long timeout = -1;
+	int maxfd = -1;
+
+	if (!running || (multi_pid != getpid()))
+		return(-1);
+
+	FD_ZERO(&efdset);
+	curl_multi_fdset(multi, fdset, wfdset, &efdset, &maxfd);
+	curl_multi_timeout(multi, &timeout);
+
+	if (maxfd >= *fdsize)
+		*fdsize = maxfd + 1;
+	/* e.g. while resolving a host name, curl does not have a socket yet */
+	if ((maxfd == -1) && ((timeout < 0) || (timeout > 100)))
+		timeout = 100;
+	return(timeout);
+}
+
+/*
+ * Downloads url to a temporary file and returns its name, or NULL if it
+ * could not be downloaded. Picks up the transfer if url is being prefetched.
+ */
+char *feh_http_fetch(char *url)
+{
+	feh_http_transfer *t;
+	gib_list *l;
+	char *sfn;
+
+	if (!feh_http_init())
+		return(NULL);
+
+	if ((l = feh_http_find(transfers, url)))
+		t = l->data;
+	else {
+		t = feh_http_transfer_new(url);
+		transfers = gib_list_add_front(transfers, t);
+	}
+
+	/* the image to be shown does not wait for a free connection */
+	if (t->state == HTTP_QUEUED)
+		feh_http_start(t);
+
+	while (t->state == HTTP_RUNNING) {
+		curl_multi_wait(multi, NULL, 0, 1000, NULL);
+		feh_http_handle();
+	}
+
+	if ((t->state == HTTP_FAILED) && t->ebuff[0])
+		weprintf("open url: %s", t->ebuff);
+
+	sfn = t->sfn;
+	t->sfn = NULL;
+	transfers = gib_list_remove(transfers, gib_list_find_by_data(transfers, t));
+	feh_http_free(t);
+	feh_http_dispatch();
+	return(sfn);
+}
+
+/*
+ * feh_http_prefetch_begin, any number of feh_http_prefetch calls (most
+ * wanted first) and feh_http_prefetch_end replace the set of URLs which are
+ * downloaded in the background. Transfers of URLs which are no longer part
+ * of it are cancelled.
+ */
+void feh_http_prefetch_begin(void)
+{
+	prefetch_queue = NULL;
+}
+
+void feh_http_prefetch(char *url)
+{
+	gib_list *l;
+
+	if ((conversion_cache && gib_hash_get(conversion_cache, url))
+			|| !feh_http_init() || feh_http_find(prefetch_queue, url))
+		return;
+
+	if ((l = feh_http_find(transfers, url))) {
+		prefetch_queue = gib_list_add_end(prefetch_queue, l->data);
+		transfers = gib_list_remove(transfers, l);
+	} else
+		prefetch_queue = gib_list_add_end(prefetch_queue,
+				feh_http_transfer_new(url));
+}
+
+void feh_http_prefetch_end(void)
+{
+	gib_list *l;
+
+	for (l = transfers; l; l = l->next)
+		feh_http_free(l->data);
+	gib_list_free(transfers);
+	transfers = prefetch_queue;
+	prefetch_queue = NULL;
+	feh_http_dispatch();
+}
+
+void feh_http_shutdown(void)
+{
+	gib_list *l;
+
+	if (!multi || (multi_pid != getpid()))
+		return;
+
+	for (l = transfers; l; l = l->next)
+		feh_http_free(l->data);
+	gib_list_free(transfers);
+	transfers = NULL;
+	curl_multi_cleanup(multi);
+	multi = NULL;
+}
+
+#else				/* HAVE_LIBCURL */
+
+char *feh_http_fetch(char *url)
+{
+	weprintf(
+		"Cannot load image %s\nPlease recompile feh with libcurl support",
+		url
+	);
+	return NULL;
+}
+
+void feh_http_prefetch_begin(void)
+{
+	return;
+}
+
+void feh_http_prefetch(char *url)
+{
+	(void)url;
+}
+
+void feh_http_prefetch_end(void)
+{
+	return;
+}
+
+long feh_http_fdset(fd_set * fdset, fd_set * wfdset, int *fdsize)
+{
+	(void)fdset;
+	(void)wfdset;
+	(void)fdsize;
+	return(-1);
+}
+
+void feh_http_handle(void)
+{
+	return;
+}
+
+void feh_http_shutdown(void)
+{
+	return;
+}
+
+#endif				/* HAVE_LIBCURL */
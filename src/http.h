@@ -0,0 +1,43 @@
+/* http.h
+
+Copyright (C) 2024 feh contributors.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to
+deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+sell copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies of the Software and its documentation and acknowledgment shall be
+given in the documentation and software packages that this Software was
+used.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#ifndef HTTP_H
+#define HTTP_H
+
+/*
+ * HTTP(S) downloads with curl's multi interface. Several transfers can be in
+ * flight at once; the main loop drives them via feh_http_fdset and
+ * feh_http_handle.
+ */
+
+char *feh_http_fetch(char *url);
+void feh_http_prefetch_begin(void);
+void feh_http_prefetch(char *url);
+void feh_http_prefetch_end(void);
+long feh_http_fdset(fd_set * fdset, fd_set * wfdset, int *fdsize);
+void feh_http_handle(void);
+void feh_http_shutdown(void);
+
+#endif
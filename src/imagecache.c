@@ -0,0 +1,263 @@
+/* imagecache.c
+
+Copyright (C) 2024 feh contributors.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to
+deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+sell copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies of the Software and its documentation and acknowledgment shall be
+given in the documentation and software packages that this Software was
+used.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#include "feh.h"
+#include "filelist.h"
+#include "options.h"
+
+/*
+ * A cache of decoded images, limited to --image-cache MiB of pixel data.
+ *
+ * feh_load_image takes images out of the cache. Windows register the images
+ * they display with feh_imagecache_loan. Once a window lets go of an image
+ * (feh_imagecache_put), it moves to the front of the cache, so that going
+ * back to a recently viewed image does not require decoding it again.
+ * Images which were modified in memory must be withdrawn with
+ * feh_imagecache_forget. Reduced-size JPEG decodes (see feh_image_get_scale)
+ * are only handed out to callers which do not need more pixels.
+ */
+
+typedef struct {
+	char *filename;
+	time_t mtime;
+	int size;
+	int orientation;
+	int scale;
+	int orig_w, orig_h;
+	Imlib_Image im;
+	size_t bytes;
+} feh_imagecache_entry;
+
+static gib_list *cache = NULL;
+static gib_list *loans = NULL;
+static size_t cache_bytes = 0;
+static unsigned int cache_hits = 0;
+static unsigned int cache_misses = 0;
+
+static int feh_imagecache_orientation(void)
+{
+#ifdef HAVE_LIBEXIF
+	return(opt.auto_rotate);
+#else
+	return(0);
+#endif
+}
+
+static void feh_imagecache_entry_free(feh_imagecache_entry * e, int free_image)
+{
+	if (free_image && e->im)
+		gib_imlib_free_image(e->im);
+	free(e->filename);
+	free(e);
+}
+
+static int feh_imagecache_stat(feh_file * file)
+{
+	struct stat st;
+
+	if (!opt.image_cache || path_is_url(file->filename)
+			|| stat(file->filename, &st))
+		return(0);
+	file->mtime = st.st_mtime;
+	file->size = st.st_size;
+	return(1);
+}
+
+static int feh_imagecache_sufficient(feh_imagecache_entry * e, int max_w, int max_h)
+{
+	return((e->scale == 1)
+			|| (e->scale <= feh_image_max_scale(e->orig_w, e->orig_h, max_w, max_h)));
+}
+
+/*
+ * Looks up a decoded version of file which is suitable for a max_w x max_h
+ * area (see feh_load_image_scaled). Stale entries for the same filename are
+ * discarded along the way.
+ */
+static gib_list *feh_imagecache_find(feh_file * file, int max_w, int max_h)
+{
+	gib_list *l, *next;
+	feh_imagecache_entry *e;
+
+	for (l = cache; l; l = next) {
+		next = l->next;
+		e = l->data;
+		if (strcmp(e->filename, file->filename))
+			continue;
+		if ((e->mtime == file->mtime) && (e->size == file->size)
+				&& (e->orientation == feh_imagecache_orientation())) {
+			if (feh_imagecache_sufficient(e, max_w, max_h))
+				return(l);
+			continue;
+		}
+		cache_bytes -= e->bytes;
+		feh_imagecache_entry_free(e, 1);
+		cache = gib_list_remove(cache, l);
+	}
+	return(NULL);
+}
+
+int feh_imagecache_contains(feh_file * file, int max_w, int max_h)
+{
+	return(feh_imagecache_stat(file) && feh_imagecache_find(file, max_w, max_h));
+}
+
+/*
+ * If a current decoded copy of file is cached, transfers it to *im and
+ * returns 1. Also updates file->mtime and file->size, which
+ * feh_imagecache_loan relies on.
+ */
+int feh_imagecache_get(feh_file * file, Imlib_Image * im, int max_w, int max_h)
+{
+	gib_list *l;
+	feh_imagecache_entry *e;
+
+	if (!feh_imagecache_stat(file))
+		return(0);
+
+	if (!(l = feh_imagecache_find(file, max_w, max_h))) {
+		cache_misses++;
+		return(0);
+	}
+
+	e = l->data;
+	cache_bytes -= e->bytes;
+	*im = e->im;
+	feh_imagecache_entry_free(e, 0);
+	cache = gib_list_remove(cache, l);
+
+	cache_hits++;
+	D(("%s: hit\n", file->filename));
+	return(1);
+}
+
+static gib_list *feh_imagecache_find_loan(Imlib_Image im)
+{
+	gib_list *l;
+
+	for (l = loans; l; l = l->next)
+		if (((feh_imagecache_entry *) l->data)->im == im)
+			return(l);
+	return(NULL);
+}
+
+/*
+ * Remembers that im is the current decoded version of file (as of the stat
+ * performed by feh_imagecache_get), so that it can be cached once it is put
+ * back.
+ */
+void feh_imagecache_loan(feh_file * file, Imlib_Image im)
+{
+	feh_imagecache_entry *e;
+
+	if (!opt.image_cache || !im || !file->mtime || path_is_url(file->filename)
+			|| feh_imagecache_find_loan(im))
+		return;
+
+	e = emalloc(sizeof(feh_imagecache_entry));
+	e->filename = estrdup(file->filename);
+	e->mtime = file->mtime;
+	e->size = file->size;
+	e->orientation = feh_imagecache_orientation();
+	e->scale = feh_image_get_scale(im);
+	e->orig_w = feh_image_get_width(im);
+	e->orig_h = feh_image_get_height(im);
+	e->im = im;
+	e->bytes = (size_t)gib_imlib_image_get_width(im)
+		* gib_imlib_image_get_height(im) * sizeof(DATA32);
+	loans = gib_list_add_front(loans, e);
+}
+
+/*
+ * Returns 1 if im was loaded from file and file has not changed since.
+ */
+int feh_imagecache_is_current(feh_file * file, Imlib_Image im)
+{
+	gib_list *l;
+	feh_imagecache_entry *e;
+
+	if (!im || !(l = feh_imagecache_find_loan(im)) || !feh_imagecache_stat(file))
+		return(0);
+	e = l->data;
+	return(!strcmp(e->filename, file->filename) && (e->mtime == file->mtime)
+			&& (e->size == file->size)
+			&& (e->orientation == feh_imagecache_orientation()));
+}
+
+void feh_imagecache_forget(Imlib_Image im)
+{
+	gib_list *l;
+
+	if ((l = feh_imagecache_find_loan(im))) {
+		feh_imagecache_entry_free(l->data, 0);
+		loans = gib_list_remove(loans, l);
+	}
+}
+
+/*
+ * Hands im back to the cache. Returns 1 if it is now owned by the cache and 0
+ * if the caller should free it as usual.
+ */
+int feh_imagecache_put(Imlib_Image im)
+{
+	gib_list *l, *last;
+	feh_imagecache_entry *e;
+
+	if (!(l = feh_imagecache_find_loan(im)))
+		return(0);
+
+	e = l->data;
+	loans = gib_list_unlink(loans, l);
+	if (e->bytes > (size_t)opt.image_cache * 1024 * 1024) {
+		feh_imagecache_entry_free(e, 0);
+		l->next = NULL;
+		gib_list_free(l);
+		return(0);
+	}
+
+	l->prev = NULL;
+	l->next = cache;
+	if (cache)
+		cache->prev = l;
+	cache = l;
+	cache_bytes += e->bytes;
+
+	while (cache_bytes > (size_t)opt.image_cache * 1024 * 1024) {
+		last = gib_list_last(cache);
+		e = last->data;
+		D(("evicting %s\n", e->filename));
+		cache_bytes -= e->bytes;
+		feh_imagecache_entry_free(e, 1);
+		cache = gib_list_remove(cache, last);
+	}
+	return(1);
+}
+
+void feh_imagecache_print_stats(void)
+{
+	if (opt.image_cache)
+		fprintf(stderr, PACKAGE ": image cache: %u hits, %u misses\n",
+				cache_hits, cache_misses);
+}
@@ -37,6 +37,8 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "signals.h"
 #include "winwidget.h"
 #include "options.h"
+#include "probe.h"
+#include "http.h"
 
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -44,8 +46,8 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include <arpa/inet.h>
 #include <netdb.h>
 
-#ifdef HAVE_LIBCURL
-#include <curl/curl.h>
+#ifdef HAVE_LIBJPEG
+#include "feh_jpeg.h"
 #endif
 
 #ifdef HAVE_LIBEXIF
@@ -78,7 +80,6 @@ gib_hash* conversion_cache = NULL;
 
 int childpid = 0;
 
-static int feh_file_is_raw(char *filename);
 static char *feh_http_load_image(char *url);
 static char *feh_dcraw_load_image(char *filename);
 static char *feh_magick_load_image(char *filename);
@@ -158,8 +159,8 @@ void init_x_and_imlib(void)
 int feh_should_ignore_image(Imlib_Image * im)
 {
 	if (opt.filter_by_dimensions) {
-		unsigned int w = gib_imlib_image_get_width(im);
-		unsigned int h = gib_imlib_image_get_height(im);
+		unsigned int w = feh_image_get_width(im);
+		unsigned int h = feh_image_get_height(im);
 		if (w < opt.min_width || w > opt.max_width || h < opt.min_height || h > opt.max_height) {
 			return 1;
 		}
@@ -335,19 +336,128 @@ int feh_is_image(__attribute__((unused)) feh_file * file, __attribute__((unused)
 }
 #endif
 
+/*
+ * Rotates and flips im according to an EXIF orientation value.
+ */
+void feh_image_orientate(Imlib_Image im, int orientation)
+{
+	if (orientation == 2)
+		gib_imlib_image_flip_horizontal(im);
+	else if (orientation == 3)
+		gib_imlib_image_orientate(im, 2);
+	else if (orientation == 4)
+		gib_imlib_image_flip_vertical(im);
+	else if (orientation == 5) {
+		gib_imlib_image_orientate(im, 3);
+		gib_imlib_image_flip_vertical(im);
+	}
+	else if (orientation == 6)
+		gib_imlib_image_orientate(im, 1);
+	else if (orientation == 7) {
+		gib_imlib_image_orientate(im, 3);
+		gib_imlib_image_flip_horizontal(im);
+	}
+	else if (orientation == 8)
+		gib_imlib_image_orientate(im, 3);
+}
+
+/*
+ * Returns the largest DCT scaling denominator (1, 2, 4 or 8) at which a w x h
+ * image still has enough pixels to be shown at its size-to-fit zoom level
+ * in a max_w x max_h area. Since the EXIF orientation is not known at this
+ * point, both orientations are taken into account.
+ */
+int feh_image_max_scale(int w, int h, int max_w, int max_h)
+{
+	double zoom, zoom_rotated;
+	int scale;
+
+	if ((max_w <= 0) || (max_h <= 0) || (w <= 0) || (h <= 0))
+		return(1);
+
+	feh_calc_needed_zoom(&zoom, w, h, max_w, max_h);
+	feh_calc_needed_zoom(&zoom_rotated, h, w, max_w, max_h);
+	if (zoom_rotated > zoom)
+		zoom = zoom_rotated;
+
+	for (scale = 8; scale > 1; scale /= 2)
+		if (zoom * scale <= 1.0)
+			return(scale);
+	return(1);
+}
+
+/*
+ * Images decoded at reduced size remember their scaling denominator and the
+ * size they would have had when loaded normally (after EXIF rotation).
+ */
+void feh_image_set_scale(Imlib_Image im, int scale, int orig_w, int orig_h)
+{
+	imlib_context_set_image(im);
+	imlib_image_attach_data_value("feh_scale", NULL, scale, NULL);
+	imlib_image_attach_data_value("feh_width", NULL, orig_w, NULL);
+	imlib_image_attach_data_value("feh_height", NULL, orig_h, NULL);
+}
+
+int feh_image_get_scale(Imlib_Image im)
+{
+	int scale;
+
+	imlib_context_set_image(im);
+	scale = imlib_image_get_attached_value("feh_scale");
+	return(scale > 1 ? scale : 1);
+}
+
+int feh_image_get_width(Imlib_Image im)
+{
+	if (feh_image_get_scale(im) > 1)
+		return(imlib_image_get_attached_value("feh_width"));
+	return(gib_imlib_image_get_width(im));
+}
+
+int feh_image_get_height(Imlib_Image im)
+{
+	if (feh_image_get_scale(im) > 1)
+		return(imlib_image_get_attached_value("feh_height"));
+	return(gib_imlib_image_get_height(im));
+}
+
 int feh_load_image(Imlib_Image * im, feh_file * file)
+{
+	return(feh_load_image_scaled(im, file, 0, 0));
+}
+
+/*
+ * Like feh_load_image, but the image only needs to be shown at its
+ * size-to-fit zoom level in a max_w x max_h area. Where possible (JPEG), it
+ * is then decoded at a reduced size, see feh_image_get_scale. max_w == 0
+ * requests the full-size image.
+ */
+int feh_load_image_scaled(Imlib_Image * im, feh_file * file, int max_w, int max_h)
 {
 	Imlib_Load_Error err = IMLIB_LOAD_ERROR_NONE;
 	enum feh_load_error feh_err = LOAD_ERROR_IMLIB;
 	enum { SRC_IMLIB, SRC_HTTP, SRC_MAGICK, SRC_DCRAW } image_source = SRC_IMLIB;
 	char *tmpname = NULL;
 	char *real_filename = NULL;
+	enum feh_probe_class class = FEH_CLASS_UNKNOWN;
+#ifdef HAVE_LIBJPEG
+	int scale = 1, orig_w = 0, orig_h = 0;
+#endif
 
 	D(("filename is %s, image is %p\n", file->filename, im));
 
 	if (!file || !file->filename)
 		return 0;
 
+	if (feh_imagecache_get(file, im, max_w, max_h)) {
+#ifdef HAVE_LIBEXIF
+		if (file->ed)
+			exif_data_unref(file->ed);
+		file->ed = exif_data_new_from_file(file->filename);
+#endif
+		return(1);
+	}
+
 	if (path_is_url(file->filename)) {
 		image_source = SRC_HTTP;
 
@@ -356,8 +466,20 @@ int feh_load_image(Imlib_Image * im, feh_file * file)
 			err = IMLIB_LOAD_ERROR_FILE_DOES_NOT_EXIST;
 		}
 	}
+	else if ((class = feh_probe_classify(file->filename)) == FEH_CLASS_OTHER) {
+		feh_err = LOAD_ERROR_MAGICBYTES;
+		err = IMLIB_LOAD_ERROR_NO_LOADER_FOR_FILE_FORMAT;
+	}
 	else {
-		if (feh_is_image(file, 0)) {
+		if ((class == FEH_CLASS_IMAGE) || (class == FEH_CLASS_RAW)
+				|| feh_is_image(file, 0)) {
+			*im = NULL;
+#ifdef HAVE_LIBJPEG
+			if (max_w > 0)
+				*im = feh_jpeg_load_scaled(file->filename, max_w, max_h,
+						&orig_w, &orig_h, &scale);
+			if (!*im)
+#endif
 			*im = imlib_load_image_with_error_return(file->filename, &err);
 		} else {
 			feh_err = LOAD_ERROR_MAGICBYTES;
@@ -365,10 +487,10 @@ int feh_load_image(Imlib_Image * im, feh_file * file)
 		}
 	}
 
-	if (opt.conversion_timeout >= 0 && (
+	if (opt.conversion_timeout >= 0 && (class != FEH_CLASS_OTHER) && (
 			(err == IMLIB_LOAD_ERROR_UNKNOWN) ||
 			(err == IMLIB_LOAD_ERROR_NO_LOADER_FOR_FILE_FORMAT))) {
-		if (feh_file_is_raw(file->filename)) {
+		if (class == FEH_CLASS_RAW) {
 			image_source = SRC_DCRAW;
 			tmpname = feh_dcraw_load_image(file->filename);
 			if (!tmpname) {
@@ -466,36 +588,53 @@ int feh_load_image(Imlib_Image * im, feh_file * file)
 		}
 	}
 
-	if (orientation == 2)
-		gib_imlib_image_flip_horizontal(*im);
-	else if (orientation == 3)
-		gib_imlib_image_orientate(*im, 2);
-	else if (orientation == 4)
-		gib_imlib_image_flip_vertical(*im);
-	else if (orientation == 5) {
-		gib_imlib_image_orientate(*im, 3);
-		gib_imlib_image_flip_vertical(*im);
-	}
-	else if (orientation == 6)
-		gib_imlib_image_orientate(*im, 1);
-	else if (orientation == 7) {
-		gib_imlib_image_orientate(*im, 3);
-		gib_imlib_image_flip_horizontal(*im);
+	feh_image_orientate(*im, orientation);
+#endif
+
+#ifdef HAVE_LIBJPEG
+	if (scale > 1) {
+#ifdef HAVE_LIBEXIF
+		if ((orientation >= 5) && (orientation <= 8))
+			feh_image_set_scale(*im, scale, orig_h, orig_w);
+		else
+#endif
+		feh_image_set_scale(*im, scale, orig_w, orig_h);
 	}
-	else if (orientation == 8)
-		gib_imlib_image_orientate(*im, 3);
 #endif
 
 	D(("Loaded ok\n"));
 	return(1);
 }
 
+/*
+ * Loads an image for a max_w x max_h thumbnail. With --embedded-thumbnails,
+ * this uses a preview image stored in the file if possible.
+ */
+int feh_load_thumbnail(Imlib_Image * im, feh_file * file, int max_w, int max_h)
+{
+#ifdef HAVE_LIBJPEG
+	int orig_w, orig_h, scale;
+
+	if (opt.embedded_thumbnails && !path_is_url(file->filename)
+			&& (*im = feh_jpeg_load_embedded(file->filename, max_w, max_h,
+					&orig_w, &orig_h))) {
+		/* keep reporting the dimensions of the actual image */
+		scale = orig_w / gib_imlib_image_get_width(*im);
+		if (scale > 1)
+			feh_image_set_scale(*im, scale, orig_w, orig_h);
+		return(1);
+	}
+#endif
+	return(feh_load_image_scaled(im, file, max_w, max_h));
+}
+
 void feh_reload_image(winwidget w, int resize, int force_new)
 {
 	char *new_title;
 	int len;
 	Imlib_Image tmp;
 	int old_w, old_h;
+	int max_w = 0, max_h = 0;
 
 	if (!w->file) {
 		im_weprintf(w, "couldn't reload, this image has no file associated with it.");
@@ -514,8 +653,9 @@ void feh_reload_image(winwidget w, int resize, int force_new)
 	winwidget_rename(w, new_title);
 	free(new_title);
 
-	old_w = gib_imlib_image_get_width(w->im);
-	old_h = gib_imlib_image_get_height(w->im);
+	old_w = feh_image_get_width(w->im);
+	old_h = feh_image_get_height(w->im);
+	winwidget_get_target_size(w, &max_w, &max_h);
 
 	/*
 	 * If we don't free the old image before loading the new one, Imlib2's
@@ -533,7 +673,9 @@ void feh_reload_image(winwidget w, int resize, int force_new)
 		gib_hash_set(conversion_cache, FEH_FILE(w->file->data)->filename, NULL);
 	}
 
-	if ((feh_load_image(&tmp, FEH_FILE(w->file->data))) == 0) {
+	if (!force_new && feh_imagecache_is_current(FEH_FILE(w->file->data), w->im))
+		tmp = w->im;
+	else if ((feh_load_image_scaled(&tmp, FEH_FILE(w->file->data), max_w, max_h)) == 0) {
 		if (force_new)
 			eprintf("failed to reload image\n");
 		else {
@@ -543,19 +685,21 @@ void feh_reload_image(winwidget w, int resize, int force_new)
 		return;
 	}
 
-	if (!resize && ((old_w != gib_imlib_image_get_width(tmp)) ||
-			(old_h != gib_imlib_image_get_height(tmp))))
+	if (!resize && ((old_w != feh_image_get_width(tmp)) ||
+			(old_h != feh_image_get_height(tmp))))
 		resize = 1;
 
-	if (!force_new)
+	feh_imagecache_loan(FEH_FILE(w->file->data), tmp);
+
+	if (!force_new && (tmp != w->im))
 		winwidget_free_image(w);
 
 	w->im = tmp;
 	winwidget_reset_image(w);
 
 	w->mode = MODE_NORMAL;
-	if ((w->im_w != gib_imlib_image_get_width(w->im))
-	    || (w->im_h != gib_imlib_image_get_height(w->im)))
+	if ((w->im_w != feh_image_get_width(w->im))
+	    || (w->im_h != feh_image_get_height(w->im)))
 		w->had_resize = 1;
 	if (w->has_rotated) {
 		Imlib_Image temp;
@@ -565,41 +709,14 @@ void feh_reload_image(winwidget w, int resize, int force_new)
 		w->im_h = gib_imlib_image_get_height(temp);
 		gib_imlib_free_image_and_decache(temp);
 	} else {
-		w->im_w = gib_imlib_image_get_width(w->im);
-		w->im_h = gib_imlib_image_get_height(w->im);
+		w->im_w = feh_image_get_width(w->im);
+		w->im_h = feh_image_get_height(w->im);
 	}
 	winwidget_render_image(w, resize, 0);
 
 	return;
 }
 
-static int feh_file_is_raw(char *filename)
-{
-	childpid = fork();
-	if (childpid == -1) {
-		perror("fork");
-		return 0;
-	}
-
-	if (childpid == 0) {
-		int devnull = open("/dev/null", O_WRONLY);
-		dup2(devnull, 1);
-		dup2(devnull, 2);
-		execlp("dcraw", "dcraw", "-i", filename, NULL);
-		_exit(1);
-	} else {
-		int status;
-		do {
-			waitpid(childpid, &status, WUNTRACED);
-			if (WIFEXITED(status)) {
-				return !WEXITSTATUS(status);
-			}
-		} while (!WIFEXITED(status) && !WIFSIGNALED(status));
-	}
-
-	return 0;
-}
-
 static char *feh_dcraw_load_image(char *filename)
 {
 	char *basename;
@@ -653,7 +770,7 @@ static char *feh_dcraw_load_image(char *filename)
 	}
 
 	int status;
-	waitpid(-1, &status, 0);
+	waitpid(childpid, &status, 0);
 	if (WIFSIGNALED(status)) {
 		unlink(sfn);
 		free(sfn);
@@ -811,41 +928,9 @@ static char *feh_magick_load_image(char *filename)
 	return sfn;
 }
 
-#ifdef HAVE_LIBCURL
-
-#if LIBCURL_VERSION_NUM >= 0x072000 /* 07.32.0 */
-static int curl_quit_function(void *clientp,  curl_off_t dltotal,  curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow)
-#else
-static int curl_quit_function(void *clientp,  double dltotal,  double dlnow, double ultotal, double ulnow)
-#endif
-{
-	// ignore "unused parameter" warnings
-	(void)clientp;
-	(void)dltotal;
-	(void)dlnow;
-	(void)ultotal;
-	(void)ulnow;
-	if (sig_exit) {
-		/*
-		 * The user wants to quit feh. Tell libcurl to abort the transfer and
-		 * return control to the main loop, where we can quit gracefully.
-		 */
-		return 1;
-	}
-	return 0;
-}
-
 static char *feh_http_load_image(char *url)
 {
-	CURL *curl;
-	CURLcode res;
 	char *sfn;
-	FILE *sfp;
-	int fd = -1;
-	char *ebuff;
-	char *tmpname;
-	char *basename;
-	char *path = NULL;
 
 	if (opt.use_conversion_cache) {
 		if (!conversion_cache)
@@ -854,130 +939,14 @@ static char *feh_http_load_image(char *url)
 			return sfn;
 	}
 
-	if (opt.keep_http) {
-		if (opt.output_dir)
-			path = opt.output_dir;
-		else
-			path = "";
-	} else
-		path = "/tmp/";
-
-	curl = curl_easy_init();
-	if (!curl) {
-		weprintf("open url: libcurl initialization failure");
-		return NULL;
-	}
-
-	basename = strrchr(url, '/') + 1;
-
-#ifdef HAVE_MKSTEMPS
-	tmpname = estrjoin("_", "feh_curl_XXXXXX", basename, NULL);
-
-	if (strlen(tmpname) > NAME_MAX) {
-		tmpname[NAME_MAX] = '\0';
-	}
-#else
-	if (strlen(basename) > NAME_MAX-7) {
-		tmpname = estrdup("feh_curl_XXXXXX");
-	} else {
-		tmpname = estrjoin("_", "feh_curl", basename, "XXXXXX", NULL);
-	}
-#endif
-
-	sfn = estrjoin("", path, tmpname, NULL);
-
-	D(("sfn is %s\n", sfn))
-
-#ifdef HAVE_MKSTEMPS
-	fd = mkstemps(sfn, strlen(tmpname) - strlen("feh_curl_XXXXXX"));
-#else
-	fd = mkstemp(sfn);
-#endif
-	free(tmpname);
-
-	if (fd != -1) {
-		sfp = fdopen(fd, "w+");
-		if (sfp != NULL) {
-#ifdef DEBUG
-			curl_easy_setopt(curl, CURLOPT_VERBOSE, 1);
-#endif
-			/*
-			 * Do not allow requests to take longer than 30 minutes.
-			 * This should be sufficiently high to accommodate use cases with
-			 * unusually high latencies, while at the same time avoiding
-			 * feh hanging indefinitely in unattended slideshows.
-			 */
-			curl_easy_setopt(curl, CURLOPT_TIMEOUT, 1800L);
-			curl_easy_setopt(curl, CURLOPT_URL, url);
-			curl_easy_setopt(curl, CURLOPT_WRITEDATA, sfp);
-			ebuff = emalloc(CURL_ERROR_SIZE);
-			curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, ebuff);
-			curl_easy_setopt(curl, CURLOPT_USERAGENT, PACKAGE "/" VERSION);
-			curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
-			curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-#if LIBCURL_VERSION_NUM >= 0x072000 /* 07.32.0 */
-			curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, curl_quit_function);
-#else
-			curl_easy_setopt(curl, CURLOPT_PROGRESSFUNCTION, curl_quit_function);
-#endif
-			curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
-			if (opt.insecure_ssl) {
-				curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-				curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
-			} else if (getenv("CURL_CA_BUNDLE") != NULL) {
-				// Allow the user to specify custom CA certificates.
-				curl_easy_setopt(curl, CURLOPT_CAINFO,
-						getenv("CURL_CA_BUNDLE"));
-			}
-
-			res = curl_easy_perform(curl);
-			curl_easy_cleanup(curl);
-			if (res != CURLE_OK) {
-				if (res != CURLE_ABORTED_BY_CALLBACK) {
-					weprintf("open url: %s", ebuff);
-				}
-				unlink(sfn);
-				close(fd);
-				free(sfn);
-				sfn = NULL;
-			}
-
-			free(ebuff);
-			fclose(sfp);
-			if (opt.use_conversion_cache)
-				gib_hash_set(conversion_cache, url, sfn);
-			return sfn;
-		} else {
-			weprintf("open url: fdopen failed:");
-			unlink(sfn);
-			free(sfn);
-			close(fd);
-		}
-	} else {
-#ifdef HAVE_MKSTEMPS
-		weprintf("open url: mkstemps failed:");
-#else
-		weprintf("open url: mkstemp failed:");
-#endif
-		free(sfn);
-	}
-	curl_easy_cleanup(curl);
-	return NULL;
-}
+	sfn = feh_http_fetch(url);
 
-#else				/* HAVE_LIBCURL */
+	if ((sfn != NULL) && opt.use_conversion_cache)
+		gib_hash_set(conversion_cache, url, sfn);
 
-char *feh_http_load_image(char *url)
-{
-	weprintf(
-		"Cannot load image %s\nPlease recompile feh with libcurl support",
-		url
-	);
-	return NULL;
+	return sfn;
 }
 
-#endif				/* HAVE_LIBCURL */
-
 void feh_imlib_image_fill_text_bg(Imlib_Image im, int w, int h)
 {
 	gib_imlib_image_set_has_alpha(im, 1);
@@ -1119,16 +1088,15 @@ void feh_draw_filename(winwidget w)
 	gib_imlib_get_text_size(fn, FEH_FILE(w->file->data)->filename, NULL, &tw,
 			&th, IMLIB_TEXT_TO_RIGHT);
 
-	if (gib_list_length(filelist) > 1) {
-		len = snprintf(NULL, 0, "%d of %d",  gib_list_length(filelist),
-				gib_list_length(filelist)) + 1;
+	if (filelist_len > 1) {
+		len = snprintf(NULL, 0, "%d of %d", filelist_len, filelist_len) + 1;
 		s = emalloc(len);
 		if (w->file)
-			snprintf(s, len, "%d of %d", gib_list_num(filelist, w->file) +
-					1, gib_list_length(filelist));
+			snprintf(s, len, "%d of %d", feh_filelist_pos(w->file) + 1,
+					filelist_len);
 		else
-			snprintf(s, len, "%d of %d", gib_list_num(filelist, current_file) +
-					1, gib_list_length(filelist));
+			snprintf(s, len, "%d of %d", feh_filelist_pos(current_file) + 1,
+					filelist_len);
 
 		gib_imlib_get_text_size(fn, s, NULL, &nw, NULL, IMLIB_TEXT_TO_RIGHT);
 
@@ -1545,6 +1513,10 @@ void feh_edit_inplace(winwidget w, int op)
 	if (!w->file || !w->file->data || !FEH_FILE(w->file->data)->filename)
 		return;
 
+	/* the window's image no longer matches a fresh decode of the file */
+	winwidget_ensure_full_image(w);
+	feh_imagecache_forget(w->im);
+
 	if (!opt.edit) {
 		imlib_context_set_image(w->im);
 		if (op == INPLACE_EDIT_FLIP)
@@ -28,7 +28,142 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "filelist.h"
 #include "winwidget.h"
 #include "options.h"
+#include "worker.h"
 #include "index.h"
+#include "thumbnail.h"
+
+/* thumbnails being created by worker processes (see --jobs) */
+static feh_worker_queue jobs;
+
+/* whether index mode reads (and fills) the thumbnail cache */
+static int use_thumbnail_cache = 0;
+
+/*
+ * Scales im, which shows a ww x hh image, to its size in the index and
+ * applies --alpha. Frees im.
+ */
+Imlib_Image index_scale_thumbnail(Imlib_Image im, int ww, int hh)
+{
+	Imlib_Image im_thumb;
+	int www = opt.thumb_w;
+	int hhh = opt.thumb_h;
+
+	if (opt.aspect) {
+		double ratio = 0.0;
+
+		/* Keep the aspect ratio for the thumbnail */
+		ratio = ((double) ww / hh) / ((double) www / hhh);
+
+		if (ratio > 1.0)
+			hhh = opt.thumb_h / ratio;
+		else if (ratio != 1.0)
+			www = opt.thumb_w * ratio;
+	}
+
+	if ((!opt.stretch) && ((www > ww) || (hhh > hh))) {
+		/* Don't make the image larger unless stretch is specified */
+		www = ww;
+		hhh = hh;
+	}
+
+	im_thumb = gib_imlib_create_cropped_scaled_image(im, 0, 0,
+			gib_imlib_image_get_width(im),
+			gib_imlib_image_get_height(im), www, hhh, 1);
+	gib_imlib_free_image_and_decache(im);
+
+	if (opt.alpha) {
+		DATA8 atab[256];
+
+		D(("Applying alpha options\n"));
+		gib_imlib_image_set_has_alpha(im_thumb, 1);
+		memset(atab, opt.alpha_level, sizeof(atab));
+		gib_imlib_apply_color_modifier_to_rectangle
+		    (im_thumb, 0, 0, www, hhh, NULL, NULL, NULL, atab);
+	}
+	return(im_thumb);
+}
+
+static int index_create(feh_file * file, Imlib_Image * im_thumb,
+		int *orig_w, int *orig_h, int *has_alpha)
+{
+	Imlib_Image im_temp;
+	int ret;
+
+	if (use_thumbnail_cache)
+		ret = feh_thumbnail_get_thumbnail(&im_temp, file, orig_w, orig_h);
+	else
+		ret = feh_load_thumbnail(&im_temp, file, opt.aspect ? opt.thumb_w : 0,
+				opt.thumb_h);
+	if (!ret)
+		return(0);
+
+	if (!*orig_w) {
+		*orig_w = feh_image_get_width(im_temp);
+		*orig_h = feh_image_get_height(im_temp);
+	}
+	*has_alpha = gib_imlib_image_has_alpha(im_temp) ? 1 : 0;
+	*im_thumb = index_scale_thumbnail(im_temp, *orig_w, *orig_h);
+	return(1);
+}
+
+static int index_job_run(feh_worker_job * job)
+{
+	feh_file *file = feh_file_new(job->filename);
+	int ret = index_create(file, &(job->im), &(job->ret[0]), &(job->ret[1]),
+			&(job->ret[2]));
+
+	if (!ret)
+		job->im = NULL;
+	feh_file_free(file);
+	return(ret);
+}
+
+/*
+ * Starts the worker processes for index_jobs_next if requested with --jobs.
+ * work is run on the files and must call the create function later passed
+ * to index_jobs_next. Any global state the workers rely on must be set up
+ * before.
+ */
+void index_jobs_init(feh_worker_fn work)
+{
+	feh_worker_retire();
+	feh_worker_queue_init(&jobs, work, NULL);
+}
+
+/*
+ * Returns the thumbnail for the filelist entry l as created by create. With
+ * --jobs, the thumbnails of the following files are created in the
+ * background while the caller is busy with l. Either way, the result is the
+ * same.
+ */
+int index_jobs_next(gib_list * l, index_create_fn create,
+		Imlib_Image * im_thumb, int *orig_w, int *orig_h, int *has_alpha)
+{
+	feh_worker_job job;
+
+	*orig_w = *orig_h = 0;
+
+	if (!feh_worker_queue_next(&jobs, l, &job))
+		return(create(FEH_FILE(l->data), im_thumb, orig_w, orig_h, has_alpha));
+
+	if (!job.status || !job.im) {
+		if (job.im)
+			gib_imlib_free_image_and_decache(job.im);
+		return(0);
+	}
+
+	*im_thumb = job.im;
+	*orig_w = job.ret[0];
+	*orig_h = job.ret[1];
+	*has_alpha = job.ret[2];
+	return(1);
+}
+
+/* Discards the results of jobs for thumbnails which will not be shown */
+void index_jobs_abandon(void)
+{
+	feh_worker_queue_abandon(&jobs);
+}
 
 
 /* TODO Break this up a bit ;) */
@@ -37,8 +172,8 @@ void init_index_mode(void)
 {
 	Imlib_Load_Error err;
 	Imlib_Image im_main;
-	Imlib_Image im_temp;
-	int w = 800, h = 600, ww = 0, hh = 0, www, hhh, xxx, yyy;
+	int w = 800, h = 600, www, hhh, xxx, yyy;
+	int orig_w, orig_h, has_alpha;
 	int x = 0, y = 0;
 	int bg_w = 0, bg_h = 0;
 	winwidget winwid = NULL;
@@ -176,6 +311,14 @@ void init_index_mode(void)
 		winwidget_show(winwid);
 	}
 
+	/*
+	 * With --cache-thumbnails, cached thumbnails are used instead of the
+	 * images if they are large enough
+	 */
+	if (opt.cache_thumbnails && opt.aspect)
+		use_thumbnail_cache = feh_thumbnail_setup_cache();
+	index_jobs_init(index_job_run);
+
 	for (l = filelist; l; l = l->next) {
 		file = FEH_FILE(l->data);
 		if (last) {
@@ -183,47 +326,15 @@ void init_index_mode(void)
 			last = NULL;
 		}
 		D(("About to load image %s\n", file->filename));
-		if (feh_load_image(&im_temp, file) != 0) {
+		if (index_jobs_next(l, index_create, &im_thumb,
+				&orig_w, &orig_h, &has_alpha)) {
 			if (opt.verbose)
 				feh_display_status('.');
 			D(("Successfully loaded %s\n", file->filename));
-			www = opt.thumb_w;
-			hhh = opt.thumb_h;
-			ww = gib_imlib_image_get_width(im_temp);
-			hh = gib_imlib_image_get_height(im_temp);
+			www = gib_imlib_image_get_width(im_thumb);
+			hhh = gib_imlib_image_get_height(im_thumb);
 			thumbnailcount++;
 
-			if (opt.aspect) {
-				double ratio = 0.0;
-
-				/* Keep the aspect ratio for the thumbnail */
-				ratio = ((double) ww / hh) / ((double) www / hhh);
-
-				if (ratio > 1.0)
-					hhh = opt.thumb_h / ratio;
-				else if (ratio != 1.0)
-					www = opt.thumb_w * ratio;
-			}
-
-			if ((!opt.stretch) && ((www > ww) || (hhh > hh))) {
-				/* Don't make the image larger unless stretch is specified */
-				www = ww;
-				hhh = hh;
-			}
-
-			im_thumb = gib_imlib_create_cropped_scaled_image(im_temp, 0, 0, ww, hh, www, hhh, 1);
-			gib_imlib_free_image_and_decache(im_temp);
-
-			if (opt.alpha) {
-				DATA8 atab[256];
-
-				D(("Applying alpha options\n"));
-				gib_imlib_image_set_has_alpha(im_thumb, 1);
-				memset(atab, opt.alpha_level, sizeof(atab));
-				gib_imlib_apply_color_modifier_to_rectangle
-				    (im_thumb, 0, 0, www, hhh, NULL, NULL, NULL, atab);
-			}
-
 			text_area_w = opt.thumb_w;
 			/* Now draw on the info text */
 			if (opt.index_info) {
@@ -305,6 +416,8 @@ void init_index_mode(void)
 				exit(0);
 		}
 	}
+	index_jobs_abandon();
+
 	if (opt.verbose)
 		putc('\n', stderr);
 
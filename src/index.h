@@ -32,4 +32,13 @@ void get_index_string_dim(feh_file *file, Imlib_Font fn, int *w, int *h);
 void index_calculate_height(Imlib_Font fn, int w, int *h, int *tot_thumb_w);
 void index_calculate_width(Imlib_Font fn, int *w, int h, int *tot_thumb_h);
 
+typedef int (*index_create_fn) (feh_file * file, Imlib_Image * im_thumb,
+		int *orig_w, int *orig_h, int *has_alpha);
+
+Imlib_Image index_scale_thumbnail(Imlib_Image im, int ww, int hh);
+void index_jobs_init(feh_worker_fn work);
+int index_jobs_next(gib_list * l, index_create_fn create,
+		Imlib_Image * im_thumb, int *orig_w, int *orig_h, int *has_alpha);
+void index_jobs_abandon(void);
+
 #endif
@@ -75,20 +75,42 @@ void init_unloadables_mode(void)
 	return;
 }
 
+static int loadables_job_run(feh_worker_job * job)
+{
+	Imlib_Image im = NULL;
+	feh_file *file = feh_file_new(job->filename);
+	int ret = feh_load_image(&im, file);
+
+	if (ret)
+		gib_imlib_free_image_and_decache(im);
+	feh_file_free(file);
+	return(ret);
+}
+
 void real_loadables_mode(int loadable)
 {
 	feh_file *file;
+	feh_worker_queue jobs;
+	feh_worker_job job;
 	gib_list *l;
 	char ret = 0;
+	int loaded;
 
 	opt.quiet = 1;
 
+	feh_worker_queue_init(&jobs, loadables_job_run, NULL);
+
 	for (l = filelist; l; l = l->next) {
 		Imlib_Image im = NULL;
 
 		file = FEH_FILE(l->data);
 
-		if (feh_load_image(&im, file)) {
+		if (feh_worker_queue_next(&jobs, l, &job))
+			loaded = job.status;
+		else if ((loaded = feh_load_image(&im, file)))
+			gib_imlib_free_image_and_decache(im);
+
+		if (loaded) {
 			/* loaded ok */
 			if (loadable) {
 				if (opt.verbose)
@@ -102,7 +124,6 @@ void real_loadables_mode(int loadable)
 					feh_display_status('s');
 				ret = 1;
 			}
-			gib_imlib_free_image_and_decache(im);
 		} else {
 			/* Oh dear. */
 			if (!loadable) {
@@ -119,6 +140,7 @@ void real_loadables_mode(int loadable)
 			}
 		}
 	}
+	feh_worker_queue_abandon(&jobs);
 	if (opt.verbose)
 		feh_display_status(0);
 	exit(ret);
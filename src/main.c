@@ -32,6 +32,11 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "events.h"
 #include "signals.h"
 #include "wallpaper.h"
+#include "worker.h"
+#include "thumbnail.h"
+#include "metadata.h"
+#include "watch.h"
+#include "http.h"
 #include <termios.h>
 
 #ifdef HAVE_INOTIFY
@@ -44,6 +49,7 @@ char *mode = NULL;
 
 int main(int argc, char **argv)
 {
+	feh_timing_start();
 	atexit(feh_clean_exit);
 
 	srandom(getpid() * time(NULL) % ((unsigned int) -1));
@@ -101,8 +107,11 @@ int main(int argc, char **argv)
 		eprintf("Invalid option combination");
 	}
 
+	/* with --stream, the slideshow window opens while the filelist is read */
+	while (!window_num && !sig_exit && feh_filelist_stream_step(1));
+
 	/* main event loop */
-	while (feh_main_iteration(1));
+	while (feh_main_iteration(!feh_filelist_stream_step(0)));
 
 	return(sig_exit);
 }
@@ -138,8 +147,9 @@ int feh_main_iteration(int block)
 	static double pt = 0.0;
 	XEvent ev;
 	struct timeval tval;
-	fd_set fdset;
-	int count = 0;
+	fd_set fdset, wfdset;
+	int count = 0, http_first = 0;
+	long http_wait;
 	double t1 = 0.0, t2 = 0.0;
 	fehtimer ft;
 
@@ -202,7 +212,12 @@ int feh_main_iteration(int block)
         if (opt.inotify_fd >= fdsize)
             fdsize = opt.inotify_fd + 1;
     }
+	feh_watch_fdset(&fdset, &fdsize);
 #endif
+	feh_worker_fdset(&fdset, &fdsize);
+	feh_filelist_stream_fdset(&fdset, &fdsize);
+	FD_ZERO(&wfdset);
+	http_wait = feh_http_fdset(&fdset, &wfdset, &fdsize);
 
 	/* Timers */
 	ft = first_timer;
@@ -227,6 +242,11 @@ int feh_main_iteration(int block)
 		/* Only do a blocking select if there's a timer due, or no events
 		   waiting */
 		if (t1 == 0.0 || (block && !XPending(disp))) {
+			/* curl may need to be called before the timer is due */
+			if ((http_wait >= 0) && (http_wait / 1000.0 < t1)) {
+				t1 = http_wait / 1000.0;
+				http_first = 1;
+			}
 			tval.tv_sec = (long) t1;
 			tval.tv_usec = (long) ((t1 - ((double) tval.tv_sec)) * 1000000);
 			if (tval.tv_sec < 0)
@@ -235,12 +255,12 @@ int feh_main_iteration(int block)
 				tval.tv_usec = 1000;
 			errno = 0;
 			D(("Performing blocking select - waiting for timer or event\n"));
-			count = select(fdsize, &fdset, NULL, NULL, &tval);
+			count = select(fdsize, &fdset, &wfdset, NULL, &tval);
 			if ((count < 0)
 					&& ((errno == ENOMEM) || (errno == EINVAL)
 						|| (errno == EBADF)))
 				eprintf("Connection to X display lost");
-			if (count == 0) {
+			if ((count == 0) && !http_first) {
 				/* This means the timer is due to be executed. If count was > 0,
 				   that would mean an X event had woken us, we're not interested
 				   in that */
@@ -256,14 +276,23 @@ int feh_main_iteration(int block)
 #ifdef HAVE_INOTIFY
 			else if ((count > 0) && (FD_ISSET(opt.inotify_fd, &fdset)))
                 feh_event_handle_inotify();
+			if (count > 0)
+				feh_watch_handle_fdset(&fdset);
 #endif
+			if ((count > 0) && feh_worker_busy())
+				feh_worker_handle_fdset(&fdset);
 		}
 	} else {
 		/* Don't block if there are events in the queue. That's a bit rude ;-) */
 		if (block && !XPending(disp)) {
 			errno = 0;
 			D(("Performing blocking select - no timers, or zooming\n"));
-			count = select(fdsize, &fdset, NULL, NULL, NULL);
+			if (http_wait >= 0) {
+				tval.tv_sec = http_wait / 1000;
+				tval.tv_usec = (http_wait % 1000) * 1000;
+			}
+			count = select(fdsize, &fdset, &wfdset, NULL,
+					(http_wait >= 0) ? &tval : NULL);
 			if ((count < 0)
 					&& ((errno == ENOMEM) || (errno == EINVAL)
 						|| (errno == EBADF)))
@@ -273,9 +302,15 @@ int feh_main_iteration(int block)
 #ifdef HAVE_INOTIFY
 			else if ((count > 0) && (FD_ISSET(opt.inotify_fd, &fdset)))
                 feh_event_handle_inotify();
+			if (count > 0)
+				feh_watch_handle_fdset(&fdset);
 #endif
+			if ((count > 0) && feh_worker_busy())
+				feh_worker_handle_fdset(&fdset);
 		}
 	}
+	feh_http_handle();
+
 	if (window_num == 0 || sig_exit != 0)
 		return(0);
 
@@ -288,6 +323,18 @@ int feh_main_iteration(int block)
 
 void feh_clean_exit(void)
 {
+	/* worker processes share our X connection and temporary files */
+	if (feh_worker_child)
+		return;
+
+	feh_worker_shutdown();
+	feh_http_shutdown();
+	feh_thumbnail_flush_cache();
+	feh_metadata_flush();
+
+	if (opt.verbose)
+		feh_imagecache_print_stats();
+
 	delete_rm_files();
 
 	free(opt.menu_font);
@@ -316,7 +363,8 @@ void feh_clean_exit(void)
 	if (control_via_stdin && isatty(STDIN_FILENO) && getpgrp() == (tcgetpgrp(STDIN_FILENO)))
 		restore_stdin();
 
-	if (opt.filelistfile)
+	/* an incomplete filelist would lose entries */
+	if (opt.filelistfile && !feh_filelist_streaming())
 		feh_write_filelist(filelist, opt.filelistfile);
 
 	return;
@@ -1214,30 +1214,38 @@ void feh_menu_cb(feh_menu * m, feh_menu_item * i, int action, unsigned short dat
 	switch (action) {
 		case CB_BG_TILED:
 			path = FEH_FILE(m->fehwin->file->data)->filename;
+			winwidget_ensure_full_image(m->fehwin);
 			feh_wm_set_bg(path, m->fehwin->im, 0, 0, 0, data, 0);
 			break;
 		case CB_BG_SCALED:
 			path = FEH_FILE(m->fehwin->file->data)->filename;
+			winwidget_ensure_full_image(m->fehwin);
 			feh_wm_set_bg(path, m->fehwin->im, 0, 1, 0, data, 0);
 			break;
 		case CB_BG_CENTERED:
 			path = FEH_FILE(m->fehwin->file->data)->filename;
+			winwidget_ensure_full_image(m->fehwin);
 			feh_wm_set_bg(path, m->fehwin->im, 1, 0, 0, data, 0);
 			break;
 		case CB_BG_FILLED:
 			path = FEH_FILE(m->fehwin->file->data)->filename;
+			winwidget_ensure_full_image(m->fehwin);
 			feh_wm_set_bg(path, m->fehwin->im, 0, 0, 1, data, 0);
 			break;
 		case CB_BG_TILED_NOFILE:
+			winwidget_ensure_full_image(m->fehwin);
 			feh_wm_set_bg(NULL, m->fehwin->im, 0, 0, 0, data, 0);
 			break;
 		case CB_BG_SCALED_NOFILE:
+			winwidget_ensure_full_image(m->fehwin);
 			feh_wm_set_bg(NULL, m->fehwin->im, 0, 1, 0, data, 0);
 			break;
 		case CB_BG_CENTERED_NOFILE:
+			winwidget_ensure_full_image(m->fehwin);
 			feh_wm_set_bg(NULL, m->fehwin->im, 1, 0, 0, data, 0);
 			break;
 		case CB_BG_FILLED_NOFILE:
+			winwidget_ensure_full_image(m->fehwin);
 			feh_wm_set_bg(NULL, m->fehwin->im, 0, 0, 1, data, 0);
 			break;
 		case CB_CLOSE:
@@ -1273,37 +1281,43 @@ void feh_menu_cb(feh_menu * m, feh_menu_item * i, int action, unsigned short dat
 			feh_filelist_image_remove(m->fehwin, 1);
 			break;
 		case CB_SORT_FILENAME:
-			filelist = gib_list_sort(filelist, feh_cmp_filename);
+			filelist = feh_filelist_sort(filelist, SORT_FILENAME);
+			feh_filelist_index_invalidate();
 			if (opt.jump_on_resort) {
 				slideshow_change_image(m->fehwin, SLIDE_FIRST, 1);
 			}
 			break;
 		case CB_SORT_IMAGENAME:
-			filelist = gib_list_sort(filelist, feh_cmp_name);
+			filelist = feh_filelist_sort(filelist, SORT_NAME);
+			feh_filelist_index_invalidate();
 			if (opt.jump_on_resort) {
 				slideshow_change_image(m->fehwin, SLIDE_FIRST, 1);
 			}
 			break;
 		case CB_SORT_DIRNAME:
-			filelist = gib_list_sort(filelist, feh_cmp_dirname);
+			filelist = feh_filelist_sort(filelist, SORT_DIRNAME);
+			feh_filelist_index_invalidate();
 			if (opt.jump_on_resort) {
 				slideshow_change_image(m->fehwin, SLIDE_FIRST, 1);
 			}
 			break;
 		case CB_SORT_MTIME:
-			filelist = gib_list_sort(filelist, feh_cmp_mtime);
+			filelist = feh_filelist_sort(filelist, SORT_MTIME);
+			feh_filelist_index_invalidate();
 			if (opt.jump_on_resort) {
 				slideshow_change_image(m->fehwin, SLIDE_FIRST, 1);
 			}
 			break;
 		case CB_SORT_FILESIZE:
-			filelist = gib_list_sort(filelist, feh_cmp_size);
+			filelist = feh_filelist_sort(filelist, SORT_SIZE);
+			feh_filelist_index_invalidate();
 			if (opt.jump_on_resort) {
 				slideshow_change_image(m->fehwin, SLIDE_FIRST, 1);
 			}
 			break;
 		case CB_SORT_RANDOMIZE:
 			filelist = gib_list_randomize(filelist);
+			feh_filelist_index_invalidate();
 			if (opt.jump_on_resort) {
 				slideshow_change_image(m->fehwin, SLIDE_FIRST, 1);
 			}
@@ -0,0 +1,337 @@
+/* metadata.c
+
+Copyright (C) 2024 feh contributors.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to
+deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+sell copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies of the Software and its documentation and acknowledgment shall be
+given in the documentation and software packages that this Software was
+used.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#include "feh.h"
+#include "filelist.h"
+#include "options.h"
+#include "metadata.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+/*
+ * Persistent image information for --cache-metadata. The dimensions, alpha
+ * channel and format of every image feh loads are stored in
+ * $XDG_CACHE_HOME/feh/metadata, a hash table of fixed-size records which is
+ * mmap()ed as a whole. Records are keyed by device, inode and path and are
+ * only used while mtime and size still match, so sorting and filtering a
+ * known collection does not need to read any image data.
+ *
+ * New records are collected in memory. feh_metadata_flush merges them into
+ * a new copy of the table which then replaces the old file. Records do not
+ * know their path, so stale ones cannot be recognized. Instead, once the
+ * table grows beyond FEH_METADATA_MAX_RECORDS, only the records used or
+ * added in this session are kept.
+ */
+
+#define FEH_METADATA_MAGIC "fehmeta1"
+#define FEH_METADATA_MIN_SLOTS 1024
+#define FEH_METADATA_MAX_RECORDS (1 << 17)
+
+typedef struct {
+	char magic[8];
+	uint32_t slots;
+	uint32_t count;
+} feh_metadata_header;
+
+typedef struct {
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t path;
+	int64_t mtime;
+	int64_t size;
+	int32_t width;
+	int32_t height;
+	uint8_t used;
+	uint8_t has_alpha;
+	char format[14];
+} feh_metadata_record;
+
+static char *metadata_file = NULL;
+static feh_metadata_header *metadata = NULL;
+static size_t metadata_size = 0;
+
+/* one bit per slot of metadata, set for records found by lookups */
+static unsigned char *metadata_hits = NULL;
+
+static feh_metadata_record *pending = NULL;
+static int pending_count = 0;
+static int pending_size = 0;
+
+static uint64_t feh_metadata_hash_path(char *path)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	for (; *path; path++) {
+		hash ^= (unsigned char) *path;
+		hash *= 0x100000001b3ULL;
+	}
+	return(hash);
+}
+
+static feh_metadata_record *feh_metadata_records(feh_metadata_header * header)
+{
+	return((feh_metadata_record *) (header + 1));
+}
+
+/*
+ * Returns the record for key in the table, or the empty slot where it
+ * belongs. Tables are never more than two thirds full.
+ */
+static feh_metadata_record *feh_metadata_find(feh_metadata_header * header,
+		feh_metadata_record * key)
+{
+	feh_metadata_record *records = feh_metadata_records(header);
+	uint64_t hash = key->path ^ key->dev ^ (key->ino * 0x9e3779b97f4a7c15ULL);
+	uint32_t i = (uint32_t) (hash ^ (hash >> 32)) & (header->slots - 1);
+
+	while (records[i].used && ((records[i].path != key->path)
+				|| (records[i].ino != key->ino)
+				|| (records[i].dev != key->dev)))
+		i = (i + 1) & (header->slots - 1);
+
+	return(&records[i]);
+}
+
+static void feh_metadata_map(void)
+{
+	struct stat st;
+	feh_metadata_header *header;
+	int fd;
+
+	if ((fd = open(metadata_file, O_RDONLY)) == -1)
+		return;
+
+	if (!fstat(fd, &st) && (st.st_size > (off_t) sizeof(feh_metadata_header))) {
+		header = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (header == MAP_FAILED)
+			weprintf("cannot map %s:", metadata_file);
+		else if (memcmp(header->magic, FEH_METADATA_MAGIC, 8)
+				|| !header->slots || (header->slots & (header->slots - 1))
+				|| ((uint64_t) header->count * 3 > (uint64_t) header->slots * 2)
+				|| ((size_t) st.st_size != sizeof(feh_metadata_header)
+					+ (size_t) header->slots * sizeof(feh_metadata_record)))
+			/* unknown or broken, will be replaced by the next flush */
+			munmap(header, st.st_size);
+		else {
+			metadata = header;
+			metadata_size = st.st_size;
+		}
+	}
+	close(fd);
+}
+
+static int feh_metadata_init(void)
+{
+	static int initialized = 0;
+	char *dir = NULL, *home, *xdg_cache_home;
+
+	if (initialized || !opt.cache_metadata)
+		return(metadata_file != NULL);
+	initialized = 1;
+
+	xdg_cache_home = getenv("XDG_CACHE_HOME");
+	if (xdg_cache_home && xdg_cache_home[0] == '/')
+		dir = estrjoin("/", xdg_cache_home, "feh", NULL);
+	else if ((home = getenv("HOME")) && home[0] == '/')
+		dir = estrjoin("/", home, ".cache/feh", NULL);
+
+	if (dir && feh_mkdir_p(dir)) {
+		metadata_file = estrjoin("/", dir, "metadata", NULL);
+		feh_metadata_map();
+	}
+	free(dir);
+
+	return(metadata_file != NULL);
+}
+
+static void feh_metadata_key(feh_metadata_record * key, feh_file * file,
+		struct stat *st)
+{
+	memset(key, 0, sizeof(feh_metadata_record));
+	key->dev = st->st_dev;
+	key->ino = st->st_ino;
+	key->path = feh_metadata_hash_path(file->filename);
+	key->mtime = st->st_mtime;
+	key->size = st->st_size;
+}
+
+/* Returns the valid record for file, if any */
+static feh_metadata_record *feh_metadata_get(feh_metadata_record * key)
+{
+	feh_metadata_record *record;
+
+	if (!metadata)
+		return(NULL);
+
+	record = feh_metadata_find(metadata, key);
+	if (!record->used || (record->mtime != key->mtime)
+			|| (record->size != key->size) || (record->width <= 0)
+			|| (record->height <= 0)
+			|| record->format[sizeof(record->format) - 1])
+		return(NULL);
+
+	return(record);
+}
+
+int feh_metadata_lookup(feh_file * file, struct stat *st)
+{
+	feh_metadata_record key, *record;
+	uint32_t i;
+
+	if (!feh_metadata_init())
+		return(0);
+
+	feh_metadata_key(&key, file, st);
+	if (!(record = feh_metadata_get(&key)))
+		return(0);
+
+	i = record - feh_metadata_records(metadata);
+	if (!metadata_hits) {
+		metadata_hits = emalloc(metadata->slots / 8 + 1);
+		memset(metadata_hits, 0, metadata->slots / 8 + 1);
+	}
+	metadata_hits[i / 8] |= 1 << (i % 8);
+
+	file->info = feh_file_info_new();
+	file->info->width = record->width;
+	file->info->height = record->height;
+	file->info->has_alpha = record->has_alpha;
+	file->info->pixels = file->info->width * file->info->height;
+	file->info->format = estrdup(record->format);
+
+	return(1);
+}
+
+void feh_metadata_store(feh_file * file, struct stat *st)
+{
+	feh_metadata_record key, *record;
+
+	/* workers pass their results to the main process, which stores them */
+	if (feh_worker_child || !file->info || !file->info->format
+			|| (strlen(file->info->format) >= sizeof(key.format))
+			|| !feh_metadata_init())
+		return;
+
+	feh_metadata_key(&key, file, st);
+	if ((record = feh_metadata_get(&key))
+			&& (record->width == file->info->width)
+			&& (record->height == file->info->height)
+			&& (record->has_alpha == file->info->has_alpha)
+			&& !strcmp(record->format, file->info->format))
+		return;
+
+	if (pending_count == pending_size) {
+		pending_size = pending_size ? 2 * pending_size : 256;
+		pending = erealloc(pending, pending_size * sizeof(feh_metadata_record));
+	}
+	key.used = 1;
+	key.width = file->info->width;
+	key.height = file->info->height;
+	key.has_alpha = file->info->has_alpha;
+	strcpy(key.format, file->info->format);
+	pending[pending_count++] = key;
+}
+
+void feh_metadata_flush(void)
+{
+	feh_metadata_header *header;
+	feh_metadata_record *record;
+	char *tmp_file;
+	size_t size;
+	uint32_t slots = FEH_METADATA_MIN_SLOTS, count, i;
+	int fd, prune;
+
+	if (!pending_count || feh_worker_child)
+		return;
+
+	count = (metadata ? metadata->count : 0) + pending_count;
+	if ((prune = (count > FEH_METADATA_MAX_RECORDS))) {
+		count = pending_count;
+		if (metadata_hits)
+			for (i = 0; i < metadata->slots; i++)
+				if (metadata_hits[i / 8] & (1 << (i % 8)))
+					count++;
+	}
+	while (slots < count + count / 2)
+		slots *= 2;
+	size = sizeof(feh_metadata_header) + (size_t) slots * sizeof(feh_metadata_record);
+
+	tmp_file = estrjoin("", metadata_file, ".XXXXXX", NULL);
+	if ((fd = mkstemp(tmp_file)) == -1) {
+		weprintf("cannot create %s:", tmp_file);
+		free(tmp_file);
+		return;
+	}
+	if (ftruncate(fd, size)
+			|| ((header = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+						fd, 0)) == MAP_FAILED)) {
+		weprintf("cannot write %s:", tmp_file);
+		close(fd);
+		unlink(tmp_file);
+		free(tmp_file);
+		return;
+	}
+	close(fd);
+
+	memcpy(header->magic, FEH_METADATA_MAGIC, 8);
+	header->slots = slots;
+	header->count = 0;
+
+	if (metadata)
+		for (i = 0; i < metadata->slots; i++)
+			if (feh_metadata_records(metadata)[i].used && (!prune
+						|| (metadata_hits
+							&& (metadata_hits[i / 8] & (1 << (i % 8)))))) {
+				*feh_metadata_find(header, &feh_metadata_records(metadata)[i])
+					= feh_metadata_records(metadata)[i];
+				header->count++;
+			}
+
+	for (i = 0; i < (uint32_t) pending_count; i++) {
+		record = feh_metadata_find(header, &pending[i]);
+		if (!record->used)
+			header->count++;
+		*record = pending[i];
+	}
+
+	munmap(header, size);
+	if (rename(tmp_file, metadata_file)) {
+		weprintf("cannot rename %s to %s:", tmp_file, metadata_file);
+		unlink(tmp_file);
+	}
+	free(tmp_file);
+
+	free(pending);
+	pending = NULL;
+	pending_count = pending_size = 0;
+
+	if (metadata)
+		munmap(metadata, metadata_size);
+	metadata = NULL;
+	free(metadata_hits);
+	metadata_hits = NULL;
+	feh_metadata_map();
+}
@@ -28,6 +28,7 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "feh.h"
 #include "filelist.h"
 #include "options.h"
+#include "feh_png.h"
 
 static void check_options(void);
 static void feh_getopt_theme(int argc, char **argv);
@@ -94,6 +95,11 @@ void init_parse_options(int argc, char **argv)
 	opt.max_height = opt.max_width = UINT_MAX;
 	opt.slideshow_delay = 0.0;
 	opt.conversion_timeout = -1;
+	opt.jobs = 1;
+	opt.http_connections = 8;
+	opt.http_host_connections = 4;
+	opt.thumb_compression = 3;
+	opt.thumb_filters = -1;
 	
 	feh_getopt_theme(argc, argv);
 
@@ -116,7 +122,7 @@ void init_parse_options(int argc, char **argv)
 	D(("Options parsed\n"));
 
 	filelist_len = gib_list_length(filelist);
-	if (!filelist_len)
+	if (!filelist_len && !feh_filelist_streaming())
 		show_mini_usage();
 
 	check_options();
@@ -341,6 +347,7 @@ static void feh_getopt_theme(int argc, char **argv)
 static void feh_parse_option_array(int argc, char **argv, int finalrun)
 {
 	int discard;
+	char *endptr;
 	static char stropts[] =
 		"a:A:b:B:C:dD:e:E:f:Fg:GhH:iIj:J:kK:lL:mM:nNo:O:pPqrR:sS:tT:uUvVwW:xXy:YzZ"
 		".@:^:~:|:+:<:>:";
@@ -453,6 +460,22 @@ static void feh_parse_option_array(int argc, char **argv, int finalrun)
 		{"class"         , 1, 0, OPTION_class},
 		{"no-conversion-cache", 0, 0, OPTION_no_conversion_cache},
 		{"window-id", 1, 0, OPTION_window_id},
+		{"prefetch"      , 1, 0, OPTION_prefetch},
+		{"image-cache"   , 1, 0, OPTION_image_cache},
+#ifdef HAVE_LIBJPEG
+		{"embedded-thumbnails", 0, 0, OPTION_embedded_thumbnails},
+#endif
+		{"jobs"          , 1, 0, OPTION_jobs},
+		{"thumb-compression", 1, 0, OPTION_thumb_compression},
+		{"cache-metadata", 0, 0, OPTION_cache_metadata},
+#ifdef HAVE_INOTIFY
+		{"watch"         , 0, 0, OPTION_watch},
+#endif
+		{"stream"        , 0, 0, OPTION_stream},
+		{"extensions"    , 1, 0, OPTION_extensions},
+		{"ignore-extensions", 1, 0, OPTION_ignore_extensions},
+		{"http-connections", 1, 0, OPTION_http_connections},
+		{"http-host-connections", 1, 0, OPTION_http_host_connections},
 		{0, 0, 0, 0}
 	};
 	int optch = 0, cmdx = 0;
@@ -866,6 +889,65 @@ static void feh_parse_option_array(int argc, char **argv, int finalrun)
 		case OPTION_window_id:
 			opt.x11_windowid = strtol(optarg, NULL, 0);
 			break;
+		case OPTION_image_cache:
+			opt.image_cache = atoi(optarg);
+			if (opt.image_cache < 0)
+				opt.image_cache = 0;
+			break;
+		case OPTION_embedded_thumbnails:
+			opt.embedded_thumbnails = 1;
+			break;
+		case OPTION_jobs:
+			opt.jobs = atoi(optarg);
+			if (opt.jobs < 0)
+				opt.jobs = 0;
+			break;
+		case OPTION_thumb_compression:
+			opt.thumb_compression = strtol(optarg, &endptr, 10);
+			if ((opt.thumb_compression < 0) || (opt.thumb_compression > 9)) {
+				weprintf("--thumb-compression: level must be between 0 and 9");
+				opt.thumb_compression = 3;
+			}
+			if (*endptr == ':') {
+				opt.thumb_filters = feh_png_parse_filters(endptr + 1);
+				if (opt.thumb_filters < 0)
+					weprintf("--thumb-compression: unknown filter \"%s\". "
+							"Supported filters: none, sub, up, avg, paeth, all",
+							endptr + 1);
+			}
+			break;
+		case OPTION_cache_metadata:
+			opt.cache_metadata = 1;
+			break;
+#ifdef HAVE_INOTIFY
+		case OPTION_watch:
+			opt.watch = 1;
+			break;
+#endif
+		case OPTION_stream:
+			opt.stream = 1;
+			break;
+		case OPTION_extensions:
+			opt.extensions = estrdup(optarg);
+			break;
+		case OPTION_ignore_extensions:
+			opt.ignore_extensions = estrdup(optarg);
+			break;
+		case OPTION_http_connections:
+			opt.http_connections = atoi(optarg);
+			if (opt.http_connections < 1)
+				opt.http_connections = 1;
+			break;
+		case OPTION_http_host_connections:
+			opt.http_host_connections = atoi(optarg);
+			if (opt.http_host_connections < 1)
+				opt.http_host_connections = 1;
+			break;
+		case OPTION_prefetch:
+			opt.prefetch = atoi(optarg);
+			if (opt.prefetch < 0)
+				opt.prefetch = 0;
+			break;
 		case OPTION_zoom_step:
 			opt.zoom_rate = atof(optarg);
 			if ((opt.zoom_rate <= 0)) {
@@ -997,6 +1079,10 @@ static void show_version(void)
 		"help "
 #endif
 
+#ifdef HAVE_LIBJPEG
+		"jpeg "
+#endif
+
 #ifdef HAVE_LIBMAGIC
 		"magic "
 #endif
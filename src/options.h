@@ -62,6 +62,7 @@ struct __fehoptions {
 #ifdef HAVE_INOTIFY
 	unsigned char auto_reload;
     int inotify_fd;
+	unsigned char watch;
 #endif
 	unsigned char list;
 	unsigned char quiet;
@@ -78,6 +79,8 @@ struct __fehoptions {
 	unsigned char draw_actions;
 	unsigned char draw_info;
 	unsigned char cache_thumbnails;
+	unsigned char cache_metadata;
+	unsigned char stream;
 	unsigned char on_last_slide;
 	unsigned char hold_actions[10];
 	unsigned char text_bg;
@@ -86,6 +89,7 @@ struct __fehoptions {
 	unsigned char insecure_ssl;
 	unsigned char filter_by_dimensions;
 	unsigned char edit;
+	unsigned char embedded_thumbnails;
 
 	char *output_file;
 	char *output_dir;
@@ -105,6 +109,8 @@ struct __fehoptions {
 	char *start_list_at;
 	char *info_cmd;
 	char *index_info;
+	char *extensions;
+	char *ignore_extensions;
 
 	int force_aliasing;
 	int tap_zones;
@@ -140,6 +146,9 @@ struct __fehoptions {
 	// imlib cache size in mebibytes
 	int cache_size;
 
+	// decoded image cache size in mebibytes
+	int image_cache;
+
 	unsigned int min_width, min_height, max_width, max_height;
 
 	unsigned char mode;
@@ -149,6 +158,20 @@ struct __fehoptions {
 
 	signed int conversion_timeout;
 
+	// number of upcoming slides to decode in the background
+	int prefetch;
+
+	// concurrent HTTP transfers, in total and per host
+	int http_connections;
+	int http_host_connections;
+
+	// number of worker processes for thumbnail creation, 0 = one per CPU
+	int jobs;
+
+	// zlib level and libpng filters (-1 = default) for cached thumbnails
+	int thumb_compression;
+	int thumb_filters;
+
 	Imlib_Font menu_fn;
 };
 
@@ -256,6 +279,18 @@ OPTION_auto_reload,
 OPTION_class,
 OPTION_no_conversion_cache,
 OPTION_window_id,
+OPTION_prefetch,
+OPTION_image_cache,
+OPTION_embedded_thumbnails,
+OPTION_jobs,
+OPTION_thumb_compression,
+OPTION_cache_metadata,
+OPTION_watch,
+OPTION_stream,
+OPTION_extensions,
+OPTION_ignore_extensions,
+OPTION_http_connections,
+OPTION_http_host_connections,
 };
 
 //typedef enum __fehoption fehoption;
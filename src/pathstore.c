@@ -0,0 +1,146 @@
+/* pathstore.c
+
+Copyright (C) 2024 feh contributors.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to
+deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+sell copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies of the Software and its documentation and acknowledgment shall be
+given in the documentation and software packages that this Software was
+used.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+#include "feh.h"
+#include "pathstore.h"
+#include <stdint.h>
+
+/*
+ * Storage for the filenames of the filelist, which may well have millions of
+ * entries. Filenames are packed into chunks of PATH_CHUNK_SIZE bytes instead
+ * of being malloc'ed one by one. Each chunk counts the filenames which still
+ * use it and is freed once the last of them has been released. Chunks are
+ * aligned to their size, so the chunk of a filename is found by masking its
+ * address. A filename which does not fit into a chunk gets one of its own.
+ *
+ * Directories are interned: all files in a directory share one copy of its
+ * name, which is never released. So two files are in the same directory if
+ * and only if their dir pointers are equal.
+ *
+ * Like the rest of the filelist, this may only be used by the main thread.
+ */
+#define PATH_CHUNK_SIZE (64 * 1024)
+
+typedef struct {
+	size_t used;
+	unsigned int live;
+} feh_path_chunk;
+
+static feh_path_chunk *path_chunk = NULL;
+
+static char **dirs = NULL;
+static unsigned int dirs_size = 0;
+static unsigned int dirs_count = 0;
+
+static feh_path_chunk *feh_path_chunk_new(size_t size)
+{
+	void *chunk;
+
+	if (posix_memalign(&chunk, PATH_CHUNK_SIZE, size))
+		eprintf("Out of memory allocating %zu bytes for filenames", size);
+	((feh_path_chunk *) chunk)->used = sizeof(feh_path_chunk);
+	((feh_path_chunk *) chunk)->live = 0;
+	return(chunk);
+}
+
+/* Returns a NUL-terminated copy of the first len bytes of path */
+char *feh_path_store(char *path, size_t len)
+{
+	feh_path_chunk *chunk;
+	char *ret;
+
+	if (sizeof(feh_path_chunk) + len + 1 > PATH_CHUNK_SIZE)
+		chunk = feh_path_chunk_new(sizeof(feh_path_chunk) + len + 1);
+	else {
+		/* a full chunk is freed by the release of its last filename */
+		if (!path_chunk || (path_chunk->used + len + 1 > PATH_CHUNK_SIZE))
+			path_chunk = feh_path_chunk_new(PATH_CHUNK_SIZE);
+		chunk = path_chunk;
+	}
+
+	ret = (char *) chunk + chunk->used;
+	memcpy(ret, path, len);
+	ret[len] = '\0';
+	chunk->used += len + 1;
+	chunk->live++;
+	return(ret);
+}
+
+void feh_path_release(char *path)
+{
+	feh_path_chunk *chunk = (feh_path_chunk *)
+		((uintptr_t) path & ~(uintptr_t) (PATH_CHUNK_SIZE - 1));
+
+	if (--chunk->live)
+		return;
+	if (chunk == path_chunk)
+		chunk->used = sizeof(feh_path_chunk);
+	else
+		free(chunk);
+}
+
+static unsigned int feh_path_hash(char *path, size_t len)
+{
+	unsigned int hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		hash = (hash ^ (unsigned char) path[i]) * 16777619u;
+	return(hash);
+}
+
+/* Returns the interned copy of the directory name path[0 .. len) */
+char *feh_path_dir(char *path, size_t len)
+{
+	char **old = dirs;
+	unsigned int old_size = dirs_size, i, slot;
+
+	if (!len)
+		return("");
+
+	if (2 * (dirs_count + 1) > dirs_size) {
+		dirs_size = dirs_size ? 2 * dirs_size : 256;
+		dirs = emalloc(dirs_size * sizeof(char *));
+		memset(dirs, 0, dirs_size * sizeof(char *));
+		for (i = 0; i < old_size; i++) {
+			if (!old[i])
+				continue;
+			slot = feh_path_hash(old[i], strlen(old[i])) & (dirs_size - 1);
+			while (dirs[slot])
+				slot = (slot + 1) & (dirs_size - 1);
+			dirs[slot] = old[i];
+		}
+		free(old);
+	}
+
+	slot = feh_path_hash(path, len) & (dirs_size - 1);
+	for (; dirs[slot]; slot = (slot + 1) & (dirs_size - 1))
+		if (!strncmp(dirs[slot], path, len) && !dirs[slot][len])
+			return(dirs[slot]);
+
+	/* interned names are never released, so their chunk stays */
+	dirs[slot] = feh_path_store(path, len);
+	dirs_count++;
+	return(dirs[slot]);
+}
@@ -0,0 +1,391 @@
+/* prefetch.c
+
+Copyright (C) 2024 feh contributors.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to
+deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+sell copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies of the Software and its documentation and acknowledgment shall be
+given in the documentation and software packages that this Software was
+used.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#include "feh.h"
+#include "filelist.h"
+#include "options.h"
+#include "winwidget.h"
+#include "worker.h"
+#include "http.h"
+
+/*
+ * Slideshow prefetching: after every slide change, the next --prefetch
+ * images in the direction of travel (and the one right behind the current
+ * slide) are decoded by worker processes. slideshow_change_image then only
+ * needs to pick up the finished image instead of loading it.
+ *
+ * Images are prefetched at the size the slideshow window needs (see
+ * winwidget_get_target_size). Remote images are only downloaded in advance
+ * (see http.c), they are decoded when they are shown.
+ */
+
+enum prefetch_state {
+	PREFETCH_QUEUED,
+	PREFETCH_RUNNING,
+	PREFETCH_READY,
+	PREFETCH_FAILED,
+	PREFETCH_LOST		/* the worker died or was stopped */
+};
+
+typedef struct {
+	char *filename;
+	Imlib_Image im;
+	enum prefetch_state state;
+	char wanted;
+	time_t mtime;
+	off_t size;
+} feh_prefetch_slot;
+
+static gib_list *slots = NULL;
+static int target_w = 0, target_h = 0;
+
+static int feh_prefetch_load(feh_worker_job * job)
+{
+	feh_file *file = feh_file_new(job->filename);
+	int ret = feh_load_image_scaled(&(job->im), file, job->arg[0], job->arg[1]);
+
+	if (!ret)
+		job->im = NULL;
+	else {
+		job->ret[0] = feh_image_get_scale(job->im);
+		job->ret[1] = feh_image_get_width(job->im);
+		job->ret[2] = feh_image_get_height(job->im);
+	}
+	feh_file_free(file);
+	return(ret);
+}
+
+static void feh_prefetch_drop(gib_list * l)
+{
+	feh_prefetch_slot *slot = l->data;
+
+	if (slot->im)
+		gib_imlib_free_image_and_decache(slot->im);
+	free(slot->filename);
+	free(slot);
+	slots = gib_list_remove(slots, l);
+}
+
+static void feh_prefetch_dispatch(void);
+
+static void feh_prefetch_done(feh_worker_job * job)
+{
+	feh_prefetch_slot *slot = job->data;
+
+	if (job->status && job->im) {
+		if (job->ret[0] > 1)
+			feh_image_set_scale(job->im, job->ret[0], job->ret[1], job->ret[2]);
+		slot->im = job->im;
+		slot->state = PREFETCH_READY;
+	} else if (job->lost)
+		slot->state = PREFETCH_LOST;
+	else
+		slot->state = PREFETCH_FAILED;
+	free(job);
+
+	if (!slot->wanted)
+		feh_prefetch_drop(gib_list_find_by_data(slots, slot));
+
+	feh_prefetch_dispatch();
+}
+
+static void feh_prefetch_dispatch(void)
+{
+	gib_list *l;
+	feh_prefetch_slot *slot;
+	feh_worker_job *job;
+	struct stat st;
+
+	for (l = slots; l && feh_worker_idle(); l = l->next) {
+		slot = l->data;
+		if (slot->state != PREFETCH_QUEUED)
+			continue;
+		if (stat(slot->filename, &st)) {
+			slot->state = PREFETCH_FAILED;
+			continue;
+		}
+		slot->mtime = st.st_mtime;
+		slot->size = st.st_size;
+		job = emalloc(sizeof(feh_worker_job));
+		memset(job, 0, sizeof(feh_worker_job));
+		job->work = feh_prefetch_load;
+		job->done = feh_prefetch_done;
+		job->filename = slot->filename;
+		job->arg[0] = target_w;
+		job->arg[1] = target_h;
+		job->data = slot;
+		if (!feh_worker_submit(job)) {
+			free(job);
+			break;
+		}
+		slot->state = PREFETCH_RUNNING;
+		D(("prefetching %s\n", slot->filename));
+	}
+}
+
+static gib_list *feh_prefetch_find(gib_list * list, char *filename)
+{
+	gib_list *l;
+
+	for (l = list; l; l = l->next)
+		if (!strcmp(((feh_prefetch_slot *) l->data)->filename, filename))
+			return(l);
+	return(NULL);
+}
+
+/*
+ * Like feh_list_jump, but without side effects: returns NULL instead of
+ * wrapping around if the slideshow would quit, hold or reshuffle there.
+ */
+static gib_list *feh_prefetch_step(gib_list * l, int direction)
+{
+	if (direction == FORWARD) {
+		if (l->next)
+			return(l->next);
+		if ((opt.on_last_slide != ON_LAST_SLIDE_RESUME) || opt.randomize)
+			return(NULL);
+		return(filelist);
+	}
+	if (l->prev)
+		return(l->prev);
+	if (opt.on_last_slide == ON_LAST_SLIDE_HOLD)
+		return(NULL);
+	return(feh_filelist_nth(filelist_len - 1));
+}
+
+/*
+ * Returns the file slideshow_change_image(change) would move to from l,
+ * assuming that all files on the way can be loaded.
+ */
+static gib_list *feh_prefetch_predict(gib_list * l, int change)
+{
+	char *dir;
+	int direction = FORWARD;
+	int i, pos, num = 1;
+
+	switch (change) {
+	case SLIDE_PREV:
+	case SLIDE_LAST:
+		direction = BACK;
+		break;
+	case SLIDE_JUMP_BACK:
+		direction = BACK;
+		num = slideshow_jump_length();
+		break;
+	case SLIDE_JUMP_FWD:
+		num = slideshow_jump_length();
+		break;
+	case SLIDE_JUMP_NEXT_DIR:
+		dir = FEH_FILE(l->data)->dir;
+		for (i = 0; l && i < filelist_len; i++) {
+			l = feh_prefetch_step(l, FORWARD);
+			if (l && (FEH_FILE(l->data)->dir != dir))
+				break;
+		}
+		return(l);
+	case SLIDE_JUMP_PREV_DIR:
+		if (!(l = feh_prefetch_step(l, BACK)))
+			return(NULL);
+		dir = FEH_FILE(l->data)->dir;
+		for (i = 0; l && i < filelist_len; i++) {
+			l = feh_prefetch_step(l, BACK);
+			if (l && (FEH_FILE(l->data)->dir != dir))
+				break;
+		}
+		return(l ? feh_prefetch_step(l, FORWARD) : NULL);
+	}
+
+	if (num == 1)
+		return(feh_prefetch_step(l, direction));
+
+	if ((pos = feh_filelist_pos(l)) < 0)
+		return(NULL);
+	if (direction == FORWARD) {
+		if ((pos + num >= filelist_len)
+				&& ((opt.on_last_slide != ON_LAST_SLIDE_RESUME) || opt.randomize))
+			return(NULL);
+		return(feh_filelist_nth((pos + num) % filelist_len));
+	}
+	if ((pos - num < 0) && (opt.on_last_slide == ON_LAST_SLIDE_HOLD))
+		return(NULL);
+	return(feh_filelist_nth(((pos - num) % filelist_len + filelist_len)
+			% filelist_len));
+}
+
+static gib_list *feh_prefetch_want(gib_list * wanted, gib_list * l)
+{
+	feh_prefetch_slot *slot;
+	gib_list *node;
+	char *filename = FEH_FILE(l->data)->filename;
+
+	if ((l == current_file)
+			|| feh_imagecache_contains(FEH_FILE(l->data), target_w, target_h))
+		return(wanted);
+
+	if (path_is_url(filename)) {
+		feh_http_prefetch(filename);
+		return(wanted);
+	}
+
+	if (feh_prefetch_find(wanted, filename))
+		return(wanted);
+
+	if ((node = feh_prefetch_find(slots, filename))) {
+		slot = node->data;
+		slots = gib_list_remove(slots, node);
+	} else {
+		slot = emalloc(sizeof(feh_prefetch_slot));
+		slot->filename = estrdup(filename);
+		slot->im = NULL;
+		slot->state = PREFETCH_QUEUED;
+		slot->mtime = 0;
+		slot->size = 0;
+	}
+	slot->wanted = 1;
+	return(gib_list_add_end(wanted, slot));
+}
+
+/*
+ * Called after the slideshow moved to current_file using change. Queues the
+ * images the user is most likely to look at next and discards prefetched
+ * images which are no longer of interest.
+ */
+void feh_prefetch_update(winwidget w, int change)
+{
+	gib_list *l, *wanted = NULL, *next;
+	feh_prefetch_slot *slot;
+	int i;
+
+	if ((opt.prefetch <= 0) || !current_file)
+		return;
+
+	if (!winwidget_get_target_size(w, &target_w, &target_h))
+		target_w = target_h = 0;
+
+	i = feh_worker_cpus();
+	if (!feh_worker_init(opt.prefetch < i ? opt.prefetch : i)) {
+		opt.prefetch = 0;
+		return;
+	}
+
+	if (change == SLIDE_RAND || change == SLIDE_FIRST)
+		change = SLIDE_NEXT;
+	else if (change == SLIDE_LAST)
+		change = SLIDE_PREV;
+
+	feh_http_prefetch_begin();
+	for (i = 0, l = current_file; i < opt.prefetch; i++) {
+		if (!(l = feh_prefetch_predict(l, change)) || (l == current_file))
+			break;
+		wanted = feh_prefetch_want(wanted, l);
+	}
+	if ((l = feh_prefetch_predict(current_file,
+			(change == SLIDE_PREV || change == SLIDE_JUMP_BACK
+			 || change == SLIDE_JUMP_PREV_DIR) ? SLIDE_NEXT : SLIDE_PREV)))
+		wanted = feh_prefetch_want(wanted, l);
+	feh_http_prefetch_end();
+
+	/* Whatever is left in slots is no longer wanted */
+	for (l = slots; l; l = next) {
+		next = l->next;
+		slot = l->data;
+		slot->wanted = 0;
+		if (slot->state != PREFETCH_RUNNING)
+			feh_prefetch_drop(l);
+	}
+	slots = gib_list_cat(wanted, slots);
+
+	feh_prefetch_dispatch();
+}
+
+/*
+ * If file was prefetched at a size suitable for a max_w x max_h area, stores
+ * its image in im and returns 1 (or 0 if it could not be loaded). Waits for
+ * the worker if file is still being decoded. Returns -1 if file was not
+ * prefetched, changed since or its worker went away. A prefetched image is loaned to the image
+ * cache just like a freshly loaded one.
+ */
+int feh_prefetch_take(feh_file * file, Imlib_Image * im, int max_w, int max_h)
+{
+	gib_list *l;
+	feh_prefetch_slot *slot;
+	struct stat st;
+	int ret;
+
+	if (!slots || !(l = feh_prefetch_find(slots, file->filename)))
+		return(-1);
+
+	slot = l->data;
+	while ((slot->state == PREFETCH_RUNNING) && feh_worker_wait());
+
+	if ((slot->state == PREFETCH_QUEUED) || (slot->state == PREFETCH_RUNNING)) {
+		if (slot->state == PREFETCH_RUNNING)
+			slot->wanted = 0;
+		else
+			feh_prefetch_drop(gib_list_find_by_data(slots, slot));
+		return(-1);
+	}
+
+	/* Only a load error from the worker says anything about the file */
+	if (slot->state == PREFETCH_LOST) {
+		feh_prefetch_drop(gib_list_find_by_data(slots, slot));
+		return(-1);
+	}
+
+	if (slot->im && (feh_image_get_scale(slot->im) > feh_image_max_scale(
+			feh_image_get_width(slot->im), feh_image_get_height(slot->im),
+			max_w, max_h))) {
+		feh_prefetch_drop(gib_list_find_by_data(slots, slot));
+		return(-1);
+	}
+
+	/* The file changed after it was handed to the worker */
+	if (stat(file->filename, &st) || (st.st_mtime != slot->mtime)
+			|| (st.st_size != slot->size)) {
+		feh_prefetch_drop(gib_list_find_by_data(slots, slot));
+		return(-1);
+	}
+
+	ret = (slot->state == PREFETCH_READY);
+	*im = slot->im;
+	slot->im = NULL;
+	feh_prefetch_drop(gib_list_find_by_data(slots, slot));
+
+	if (ret) {
+		file->mtime = st.st_mtime;
+		file->size = st.st_size;
+		feh_imagecache_loan(file, *im);
+	}
+
+#ifdef HAVE_LIBEXIF
+	if (ret) {
+		if (file->ed)
+			exif_data_unref(file->ed);
+		file->ed = exif_data_new_from_file(file->filename);
+	}
+#endif
+	D(("%s: prefetched, %s\n", file->filename, ret ? "ok" : "failed"));
+	return(ret);
+}
@@ -0,0 +1,790 @@
+/* probe.c
+
+Copyright (C) 2024 feh contributors.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to
+deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+sell copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies of the Software and its documentation and acknowledgment shall be
+given in the documentation and software packages that this Software was
+used.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#include "feh.h"
+#include "options.h"
+#include "probe.h"
+#include <fcntl.h>
+#include <strings.h>
+
+/*
+ * Reads the dimensions of common image formats from their headers, so that
+ * --list, --sort and the dimension filters do not need to decode every image.
+ *
+ * The results must be the same as those of feh_load_image. The format names
+ * (which differ between Imlib2 versions) are therefore taken from the first
+ * image of each type that is loaded with Imlib2, and a type whose probed
+ * dimensions turn out to differ from Imlib2's is not probed any more.
+ */
+
+/* same condition as in feh_jpeg.c */
+#if defined(IMLIB2_VERSION_MAJOR) && defined(IMLIB2_VERSION_MINOR) && defined(IMLIB2_VERSION_MICRO) && (IMLIB2_VERSION_MAJOR > 1 || IMLIB2_VERSION_MINOR > 7 || IMLIB2_VERSION_MICRO >= 5)
+#define FEH_PROBE_AUTO_ORIENTATION 1
+#else
+#define FEH_PROBE_AUTO_ORIENTATION 0
+#endif
+
+/* headers of all supported formats fit in here, except for JPEG and TIFF */
+#define FEH_PROBE_HEADER_SIZE 1024
+
+static char *probe_format[FEH_PROBE_TYPES];
+static char probe_unusable[FEH_PROBE_TYPES];
+
+static unsigned int feh_probe_get16(unsigned char *p, int big_endian)
+{
+	return big_endian ? ((p[0] << 8) | p[1]) : ((p[1] << 8) | p[0]);
+}
+
+static unsigned int feh_probe_get32(unsigned char *p, int big_endian)
+{
+	if (big_endian)
+		return ((unsigned int) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+	return ((unsigned int) p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+}
+
+/*
+ * Returns whether images with the given EXIF/TIFF orientation are rotated by
+ * 90 degrees when loaded.
+ */
+static int feh_probe_is_rotated(int orientation)
+{
+	if (orientation < 5)
+		return 0;
+#ifdef HAVE_LIBEXIF
+	if (opt.auto_rotate)
+		return 1;
+#endif
+	return FEH_PROBE_AUTO_ORIENTATION;
+}
+
+/* Returns the orientation tag of a JPEG file's EXIF data, 0 if it has none */
+static int feh_probe_exif_orientation(unsigned char *tiff, unsigned int len)
+{
+	int big_endian;
+	unsigned int ifd, entries, i;
+
+	if ((len < 8) || !(((tiff[0] == 'I') && (tiff[1] == 'I'))
+				|| ((tiff[0] == 'M') && (tiff[1] == 'M'))))
+		return 0;
+
+	big_endian = (tiff[0] == 'M');
+	ifd = feh_probe_get32(tiff + 4, big_endian);
+	if ((ifd < 8) || (ifd > len - 2))
+		return 0;
+
+	entries = feh_probe_get16(tiff + ifd, big_endian);
+	for (i = 0; (i < entries) && (ifd + 2 + (i + 1) * 12 <= len); i++) {
+		if (feh_probe_get16(tiff + ifd + 2 + i * 12, big_endian) == 0x0112)
+			return feh_probe_get16(tiff + ifd + 2 + i * 12 + 8, big_endian);
+	}
+	return 0;
+}
+
+static int feh_probe_jpeg(FILE * fp, feh_probe_info * info)
+{
+	unsigned char seg[8];
+	unsigned char *exif;
+	unsigned int len;
+	int marker, orientation = 0;
+
+	if (fseek(fp, 2, SEEK_SET))
+		return 0;
+
+	while (1) {
+		/* markers may be preceded by any number of fill bytes */
+		if (fgetc(fp) != 0xff)
+			return 0;
+		while ((marker = fgetc(fp)) == 0xff);
+		if ((marker == EOF) || (marker == 0xd9) || (marker == 0xda))
+			return 0;
+		if ((marker == 0x01) || ((marker >= 0xd0) && (marker <= 0xd7)))
+			continue;
+
+		if (fread(seg, 1, 2, fp) != 2)
+			return 0;
+		len = feh_probe_get16(seg, 1);
+		if (len < 2)
+			return 0;
+		len -= 2;
+
+		if ((marker >= 0xc0) && (marker <= 0xcf) && (marker != 0xc4)
+				&& (marker != 0xc8) && (marker != 0xcc)) {
+			/* start of frame */
+			if ((len < 5) || (fread(seg, 1, 5, fp) != 5))
+				return 0;
+			if (feh_probe_is_rotated(orientation)) {
+				info->width = feh_probe_get16(seg + 1, 1);
+				info->height = feh_probe_get16(seg + 3, 1);
+			} else {
+				info->width = feh_probe_get16(seg + 3, 1);
+				info->height = feh_probe_get16(seg + 1, 1);
+			}
+			info->has_alpha = 0;
+			return (info->width > 0) && (info->height > 0);
+		}
+
+		if ((marker == 0xe1) && (len > 6) && !orientation) {
+			exif = emalloc(len);
+			if (fread(exif, 1, len, fp) != len) {
+				free(exif);
+				return 0;
+			}
+			if (!memcmp(exif, "Exif\0\0", 6))
+				orientation = feh_probe_exif_orientation(exif + 6, len - 6);
+			free(exif);
+		} else if (fseek(fp, len, SEEK_CUR))
+			return 0;
+	}
+}
+
+static int feh_probe_png(FILE * fp, unsigned char *buf, size_t len,
+		feh_probe_info * info)
+{
+	unsigned char chunk[8];
+	int i;
+
+	if ((len < 26) || memcmp(buf + 12, "IHDR", 4))
+		return 0;
+
+	info->width = feh_probe_get32(buf + 16, 1);
+	info->height = feh_probe_get32(buf + 20, 1);
+	info->has_alpha = (buf[25] & 4) ? 1 : 0;
+
+	if ((info->width <= 0) || (info->height <= 0))
+		return 0;
+	if (info->has_alpha)
+		return 1;
+
+	/* a tRNS chunk (which precedes the image data) also means alpha */
+	if (fseek(fp, 8 + 8 + 13 + 4, SEEK_SET))
+		return 0;
+	for (i = 0; i < 64; i++) {
+		if (fread(chunk, 1, 8, fp) != 8)
+			return 0;
+		if (!memcmp(chunk + 4, "tRNS", 4)) {
+			info->has_alpha = 1;
+			return 1;
+		}
+		if (!memcmp(chunk + 4, "IDAT", 4))
+			return 1;
+		if (fseek(fp, feh_probe_get32(chunk, 1) + 4, SEEK_CUR))
+			return 0;
+	}
+	return 0;
+}
+
+static int feh_probe_gif_skip_blocks(FILE * fp)
+{
+	int size;
+
+	while ((size = fgetc(fp)) > 0)
+		if (fseek(fp, size, SEEK_CUR))
+			return 0;
+	return size == 0;
+}
+
+static int feh_probe_gif(FILE * fp, unsigned char *buf, size_t len,
+		feh_probe_info * info)
+{
+	unsigned char desc[9];
+	int block;
+
+	if (len < 13)
+		return 0;
+
+	info->width = feh_probe_get16(buf + 6, 0);
+	info->height = feh_probe_get16(buf + 8, 0);
+	info->has_alpha = 0;
+
+	if (fseek(fp, 13 + ((buf[10] & 0x80) ? 3 << ((buf[10] & 7) + 1) : 0),
+				SEEK_SET))
+		return 0;
+
+	/*
+	 * Imlib2 uses the first image, which is usually as large as the logical
+	 * screen. If it is not, leave it to Imlib2.
+	 */
+	while ((block = fgetc(fp)) == 0x21) {
+		if (fgetc(fp) == 0xf9) {
+			if ((fread(desc, 1, 6, fp) != 6) || (desc[0] != 4))
+				return 0;
+			info->has_alpha = desc[1] & 1;
+			if (desc[5] && !feh_probe_gif_skip_blocks(fp))
+				return 0;
+		} else if (!feh_probe_gif_skip_blocks(fp))
+			return 0;
+	}
+
+	if ((block != 0x2c) || (fread(desc, 1, 8, fp) != 8))
+		return 0;
+
+	return !feh_probe_get16(desc, 0) && !feh_probe_get16(desc + 2, 0)
+		&& (feh_probe_get16(desc + 4, 0) == (unsigned int) info->width)
+		&& (feh_probe_get16(desc + 6, 0) == (unsigned int) info->height);
+}
+
+static int feh_probe_bmp(unsigned char *buf, size_t len, feh_probe_info * info)
+{
+	unsigned int header_size, bpp;
+
+	if (len < 30)
+		return 0;
+
+	header_size = feh_probe_get32(buf + 14, 0);
+	if (header_size == 12) {
+		info->width = feh_probe_get16(buf + 18, 0);
+		info->height = feh_probe_get16(buf + 20, 0);
+		bpp = feh_probe_get16(buf + 24, 0);
+	} else if (header_size >= 40) {
+		info->width = (int) feh_probe_get32(buf + 18, 0);
+		info->height = abs((int) feh_probe_get32(buf + 22, 0));
+		bpp = feh_probe_get16(buf + 28, 0);
+	} else
+		return 0;
+
+	/* whether a 32 bit image has alpha depends on the Imlib2 version */
+	info->has_alpha = 0;
+	return (bpp != 32) && (info->width > 0) && (info->height > 0);
+}
+
+static int feh_probe_pnm_number(unsigned char *buf, size_t len, size_t *pos)
+{
+	int n = 0;
+
+	while (*pos < len) {
+		if (buf[*pos] == '#')
+			while ((*pos < len) && (buf[*pos] != '\n'))
+				(*pos)++;
+		else if (isspace(buf[*pos]))
+			(*pos)++;
+		else
+			break;
+	}
+	if ((*pos >= len) || !isdigit(buf[*pos]))
+		return -1;
+	while ((*pos < len) && isdigit(buf[*pos]) && (n < 1 << 24))
+		n = n * 10 + buf[(*pos)++] - '0';
+	return n;
+}
+
+static int feh_probe_pnm(unsigned char *buf, size_t len, feh_probe_info * info)
+{
+	size_t pos = 2;
+
+	info->width = feh_probe_pnm_number(buf, len, &pos);
+	info->height = feh_probe_pnm_number(buf, len, &pos);
+	info->has_alpha = 0;
+	return (info->width > 0) && (info->height > 0);
+}
+
+static int feh_probe_webp(unsigned char *buf, size_t len, feh_probe_info * info)
+{
+	unsigned int bits;
+
+	if (len < 30)
+		return 0;
+
+	if (!memcmp(buf + 12, "VP8 ", 4)) {
+		if ((buf[23] != 0x9d) || (buf[24] != 0x01) || (buf[25] != 0x2a))
+			return 0;
+		info->width = feh_probe_get16(buf + 26, 0) & 0x3fff;
+		info->height = feh_probe_get16(buf + 28, 0) & 0x3fff;
+		info->has_alpha = 0;
+	} else if (!memcmp(buf + 12, "VP8L", 4)) {
+		if (buf[20] != 0x2f)
+			return 0;
+		bits = feh_probe_get32(buf + 21, 0);
+		info->width = (bits & 0x3fff) + 1;
+		info->height = ((bits >> 14) & 0x3fff) + 1;
+		info->has_alpha = (bits >> 28) & 1;
+	} else if (!memcmp(buf + 12, "VP8X", 4)) {
+		info->width = (buf[24] | (buf[25] << 8) | (buf[26] << 16)) + 1;
+		info->height = (buf[27] | (buf[28] << 8) | (buf[29] << 16)) + 1;
+		info->has_alpha = (buf[20] & 0x10) ? 1 : 0;
+	} else
+		return 0;
+
+	return (info->width > 0) && (info->height > 0);
+}
+
+static int feh_probe_tiff(FILE * fp, unsigned char *buf, size_t len,
+		feh_probe_info * info)
+{
+	int big_endian = (buf[0] == 'M');
+	unsigned char entry[12];
+	unsigned int entries, i, tag, type, value;
+
+	if ((len < 8) || fseek(fp, feh_probe_get32(buf + 4, big_endian), SEEK_SET)
+			|| (fread(entry, 1, 2, fp) != 2))
+		return 0;
+
+	info->width = info->height = 0;
+	info->has_alpha = 0;
+
+	entries = feh_probe_get16(entry, big_endian);
+	for (i = 0; i < entries; i++) {
+		if (fread(entry, 1, 12, fp) != 12)
+			return 0;
+		tag = feh_probe_get16(entry, big_endian);
+		type = feh_probe_get16(entry + 2, big_endian);
+		if (type == 3)
+			value = feh_probe_get16(entry + 8, big_endian);
+		else
+			value = feh_probe_get32(entry + 8, big_endian);
+
+		switch (tag) {
+		case 254:	/* NewSubfileType: IFD0 is a preview */
+			if (value)
+				return 0;
+			break;
+		case 256:
+			info->width = value;
+			break;
+		case 257:
+			info->height = value;
+			break;
+		case 274:	/* Orientation */
+			if (value >= 5)
+				return 0;
+			break;
+		case 330:	/* SubIFDs (camera raw files) */
+		case 50706:	/* DNGVersion */
+			return 0;
+		case 338:	/* ExtraSamples: associated or unassociated alpha */
+			if ((value == 1) || (value == 2))
+				info->has_alpha = 1;
+			break;
+		}
+	}
+
+	return (info->width > 0) && (info->height > 0);
+}
+
+static enum feh_probe_type feh_probe_type(unsigned char *buf, size_t len)
+{
+	if ((len >= 3) && !memcmp(buf, "\xff\xd8\xff", 3))
+		return FEH_PROBE_JPEG;
+	if ((len >= 8) && !memcmp(buf, "\x89PNG\r\n\x1a\n", 8))
+		return FEH_PROBE_PNG;
+	if ((len >= 6) && (!memcmp(buf, "GIF87a", 6) || !memcmp(buf, "GIF89a", 6)))
+		return FEH_PROBE_GIF;
+	if ((len >= 2) && !memcmp(buf, "BM", 2))
+		return FEH_PROBE_BMP;
+	if ((len >= 2) && (buf[0] == 'P') && (buf[1] >= '1') && (buf[1] <= '6'))
+		return FEH_PROBE_PNM;
+	if ((len >= 12) && !memcmp(buf, "RIFF", 4) && !memcmp(buf + 8, "WEBP", 4))
+		return FEH_PROBE_WEBP;
+	if ((len >= 4) && (!memcmp(buf, "II*\0", 4) || !memcmp(buf, "MM\0*", 4)))
+		return FEH_PROBE_TIFF;
+	return FEH_PROBE_UNKNOWN;
+}
+
+int feh_probe_image(char *filename, feh_probe_info * info)
+{
+	FILE *fp;
+	unsigned char buf[FEH_PROBE_HEADER_SIZE];
+	size_t len;
+	int ret = 0;
+
+	info->type = FEH_PROBE_UNKNOWN;
+
+	if (path_is_url(filename) || !(fp = fopen(filename, "rb")))
+		return 0;
+
+	len = fread(buf, 1, sizeof(buf), fp);
+	info->type = feh_probe_type(buf, len);
+
+	if ((info->type == FEH_PROBE_UNKNOWN) || probe_unusable[info->type]) {
+		fclose(fp);
+		return 0;
+	}
+
+	switch (info->type) {
+	case FEH_PROBE_JPEG:
+		ret = feh_probe_jpeg(fp, info);
+		break;
+	case FEH_PROBE_PNG:
+		ret = feh_probe_png(fp, buf, len, info);
+		break;
+	case FEH_PROBE_GIF:
+		ret = feh_probe_gif(fp, buf, len, info);
+		break;
+	case FEH_PROBE_BMP:
+		ret = feh_probe_bmp(buf, len, info);
+		break;
+	case FEH_PROBE_PNM:
+		ret = feh_probe_pnm(buf, len, info);
+		break;
+	case FEH_PROBE_WEBP:
+		ret = feh_probe_webp(buf, len, info);
+		break;
+	case FEH_PROBE_TIFF:
+		ret = feh_probe_tiff(fp, buf, len, info);
+		break;
+	default:
+		break;
+	}
+
+	fclose(fp);
+
+	if (!ret)
+		info->type = FEH_PROBE_UNKNOWN;
+	return ret;
+}
+
+char *feh_probe_format(feh_probe_info * info)
+{
+	if (info->type == FEH_PROBE_UNKNOWN)
+		return NULL;
+	return probe_format[info->type];
+}
+
+void feh_probe_learn(feh_probe_info * info, Imlib_Image im)
+{
+	char *format = gib_imlib_image_format(im);
+
+	if ((info->type == FEH_PROBE_UNKNOWN) || probe_unusable[info->type])
+		return;
+
+	if ((info->width != feh_image_get_width(im))
+			|| (info->height != feh_image_get_height(im))
+			|| (!info->has_alpha != !gib_imlib_image_has_alpha(im))
+			|| !format
+			|| (probe_format[info->type] && strcmp(probe_format[info->type], format))) {
+		D(("Probe type %d does not match Imlib2, disabling it\n", info->type));
+		probe_unusable[info->type] = 1;
+		return;
+	}
+
+	if (!probe_format[info->type])
+		probe_format[info->type] = estrdup(format);
+}
+
+/*
+ * --extensions and --ignore-extensions: Returns 0 if a file found while
+ * scanning a directory is to be skipped. This is also called from the
+ * scanner threads, so it must not change any state.
+ */
+static int feh_probe_extension_listed(char *list, char *ext)
+{
+	size_t len = strlen(ext), n;
+
+	while (*list) {
+		if (*list == '.')
+			list++;
+		n = strcspn(list, ",");
+		if ((n == len) && !strncasecmp(list, ext, len))
+			return 1;
+		list += list[n] ? n + 1 : n;
+	}
+	return 0;
+}
+
+int feh_probe_name_wanted(char *name)
+{
+	char *base = strrchr(name, '/');
+	char *ext;
+
+	base = base ? base + 1 : name;
+	ext = strrchr(base, '.');
+	ext = (ext && (ext != base)) ? ext + 1 : "";
+
+	if (opt.extensions && !feh_probe_extension_listed(opt.extensions, ext))
+		return 0;
+	if (opt.ignore_extensions && *ext
+			&& feh_probe_extension_listed(opt.ignore_extensions, ext))
+		return 0;
+	return 1;
+}
+
+/*
+ * Decides from its first few bytes whether a file is an image before
+ * feh_load_image hands it to libmagic, Imlib2's loaders, dcraw or
+ * ImageMagick. Sidecar files, videos and the like are rejected right away,
+ * while formats known to feh_probe_image skip the libmagic check. Camera raw
+ * files are recognized as well, so that only they are passed to dcraw if
+ * Imlib2 cannot load them. Anything else is left to the loaders as before.
+ *
+ * Results are kept per inode, so reloading a file (or another link to it)
+ * does not read it again unless its modification time or size changed.
+ */
+#define FEH_CLASS_HEADER_SIZE 256
+
+#define FEH_CLASS_MAGIC(offset, magic) { offset, sizeof(magic) - 1, magic }
+
+static const struct {
+	unsigned int offset;
+	unsigned int size;
+	char *magic;
+} feh_class_other[] = {
+	FEH_CLASS_MAGIC(0, "<?xpacket"),
+	FEH_CLASS_MAGIC(0, "<x:xmpmeta"),
+	FEH_CLASS_MAGIC(0, "{"),	/* JSON */
+	FEH_CLASS_MAGIC(0, "["),	/* INI style, e.g. RawTherapee .pp3 */
+	FEH_CLASS_MAGIC(0, "\x1a\x45\xdf\xa3"),	/* Matroska, WebM */
+	FEH_CLASS_MAGIC(0, "\0\0\1\xba"),	/* MPEG program stream */
+	FEH_CLASS_MAGIC(0, "\0\0\1\xb3"),	/* MPEG video */
+	FEH_CLASS_MAGIC(0, "OggS"),
+	FEH_CLASS_MAGIC(0, "fLaC"),
+	FEH_CLASS_MAGIC(0, "\x7f" "ELF"),
+	/* QuickTime without a file type box */
+	FEH_CLASS_MAGIC(4, "moov"),
+	FEH_CLASS_MAGIC(4, "mdat"),
+	FEH_CLASS_MAGIC(4, "wide"),
+	/* video brands of QuickTime and MP4 files, HEIF and AVIF have others */
+	FEH_CLASS_MAGIC(4, "ftypqt  "),
+	FEH_CLASS_MAGIC(4, "ftypisom"),
+	FEH_CLASS_MAGIC(4, "ftypiso2"),
+	FEH_CLASS_MAGIC(4, "ftypmp41"),
+	FEH_CLASS_MAGIC(4, "ftypmp42"),
+	FEH_CLASS_MAGIC(4, "ftypavc1"),
+	FEH_CLASS_MAGIC(4, "ftypM4V "),
+	FEH_CLASS_MAGIC(4, "ftypM4A "),
+	FEH_CLASS_MAGIC(4, "ftyp3gp4"),
+	FEH_CLASS_MAGIC(4, "ftyp3gp5"),
+	FEH_CLASS_MAGIC(4, "ftyp3gp6"),
+	FEH_CLASS_MAGIC(4, "ftyp3g2a"),
+	FEH_CLASS_MAGIC(4, "ftypdash"),
+	FEH_CLASS_MAGIC(4, "ftypXAVC"),
+	FEH_CLASS_MAGIC(4, "ftypMSNV"),
+	/* RIFF */
+	FEH_CLASS_MAGIC(8, "AVI "),
+	FEH_CLASS_MAGIC(8, "WAVE"),
+};
+
+/* camera raw formats which are not based on TIFF */
+static const struct {
+	unsigned int offset;
+	unsigned int size;
+	char *magic;
+} feh_class_raw[] = {
+	FEH_CLASS_MAGIC(0, "FUJIFILMCCD-RAW "),	/* RAF */
+	FEH_CLASS_MAGIC(0, "IIRO"),	/* ORF */
+	FEH_CLASS_MAGIC(0, "IIRS"),
+	FEH_CLASS_MAGIC(0, "MMOR"),
+	FEH_CLASS_MAGIC(0, "IIU\0"),	/* RW2 */
+	FEH_CLASS_MAGIC(6, "HEAPCCDR"),	/* CRW */
+	FEH_CLASS_MAGIC(0, "\0MRM"),	/* MRW */
+	FEH_CLASS_MAGIC(0, "FOVb"),	/* X3F */
+};
+
+/* makers of cameras which write TIFF based raw files without SubIFDs */
+static char *feh_class_raw_makers[] = {
+	"Canon", "NIKON", "SONY", "PENTAX", "RICOH", "SAMSUNG", "OLYMPUS",
+	"Panasonic", "LEICA", "FUJIFILM", "Hasselblad", "Phase One", "Kodak",
+	"EASTMAN KODAK", "Leaf", "Mamiya", "SEIKO EPSON", "Minolta",
+	"KONICA MINOLTA", NULL
+};
+
+typedef struct {
+	dev_t dev;
+	ino_t ino;
+	time_t mtime;
+	off_t size;
+	unsigned char used;
+	unsigned char class;
+} feh_class_entry;
+
+static feh_class_entry *class_cache = NULL;
+static unsigned int class_cache_size = 0;
+static unsigned int class_cache_count = 0;
+
+static int feh_probe_raw_maker(unsigned char *make, unsigned int len)
+{
+	int i;
+
+	for (i = 0; feh_class_raw_makers[i]; i++)
+		if ((strlen(feh_class_raw_makers[i]) <= len) && !memcmp(make,
+					feh_class_raw_makers[i], strlen(feh_class_raw_makers[i])))
+			return 1;
+	return 0;
+}
+
+/*
+ * Returns whether the TIFF file fd (whose header is in buf) is a camera raw
+ * file: CR2, DNG, a format with the actual image in a SubIFD (NEF, ARW, ...)
+ * or one whose IFD0 names a camera maker.
+ */
+static int feh_probe_tiff_is_raw(int fd, unsigned char *buf, size_t len)
+{
+	int big_endian = (buf[0] == 'M');
+	unsigned char *ifd, *entry, make[16];
+	unsigned int ifd_offset, entries, i, count;
+	int ret = 0;
+
+	if ((len >= 10) && (buf[8] == 'C') && (buf[9] == 'R'))
+		return 1;
+	if (len < 8)
+		return 0;
+
+	ifd_offset = feh_probe_get32(buf + 4, big_endian);
+	if (pread(fd, make, 2, ifd_offset) != 2)
+		return 0;
+	entries = feh_probe_get16(make, big_endian);
+	if (entries > 256)
+		entries = 256;
+
+	ifd = emalloc(entries * 12);
+	if (pread(fd, ifd, entries * 12, ifd_offset + 2) != (ssize_t) (entries * 12)) {
+		free(ifd);
+		return 0;
+	}
+
+	for (i = 0; (i < entries) && !ret; i++) {
+		entry = ifd + i * 12;
+		switch (feh_probe_get16(entry, big_endian)) {
+		case 330:	/* SubIFDs */
+		case 50706:	/* DNGVersion */
+			ret = 1;
+			break;
+		case 271:	/* Make */
+			count = feh_probe_get32(entry + 4, big_endian);
+			if (count > sizeof(make))
+				count = sizeof(make);
+			if (count <= 4)
+				memcpy(make, entry + 8, count);
+			else if (pread(fd, make, count, feh_probe_get32(entry + 8, big_endian))
+					!= (ssize_t) count)
+				break;
+			ret = feh_probe_raw_maker(make, count);
+			break;
+		}
+	}
+	free(ifd);
+	return ret;
+}
+
+/* Like memmem(3), which is not available everywhere */
+static unsigned char *feh_probe_find(unsigned char *buf, size_t len,
+		char *needle, size_t needle_len)
+{
+	size_t i;
+
+	for (i = 0; i + needle_len <= len; i++)
+		if (!memcmp(buf + i, needle, needle_len))
+			return buf + i;
+	return NULL;
+}
+
+static enum feh_probe_class feh_probe_class(int fd, unsigned char *buf, size_t len)
+{
+	enum feh_probe_type type;
+	unsigned int i;
+	unsigned char *xmp;
+
+	if (!len)
+		return FEH_CLASS_OTHER;
+
+	for (i = 0; i < sizeof(feh_class_raw) / sizeof(feh_class_raw[0]); i++)
+		if ((len >= feh_class_raw[i].offset + feh_class_raw[i].size)
+				&& !memcmp(buf + feh_class_raw[i].offset,
+					feh_class_raw[i].magic, feh_class_raw[i].size))
+			return FEH_CLASS_RAW;
+
+	if ((type = feh_probe_type(buf, len)) == FEH_PROBE_TIFF)
+		return feh_probe_tiff_is_raw(fd, buf, len) ? FEH_CLASS_RAW : FEH_CLASS_IMAGE;
+	if (type != FEH_PROBE_UNKNOWN)
+		return FEH_CLASS_IMAGE;
+
+	for (i = 0; i < sizeof(feh_class_other) / sizeof(feh_class_other[0]); i++)
+		if ((len >= feh_class_other[i].offset + feh_class_other[i].size)
+				&& !memcmp(buf + feh_class_other[i].offset,
+					feh_class_other[i].magic, feh_class_other[i].size))
+			return FEH_CLASS_OTHER;
+
+	/* an XMP sidecar with an XML declaration (unlike e.g. an SVG image) */
+	if ((len >= 5) && !memcmp(buf, "<?xml", 5)
+			&& (xmp = feh_probe_find(buf, len, "<x:xmpmeta", 10))
+			&& !feh_probe_find(buf, xmp - buf, "<svg", 4))
+		return FEH_CLASS_OTHER;
+
+	return FEH_CLASS_UNKNOWN;
+}
+
+static unsigned int feh_class_slot(dev_t dev, ino_t ino)
+{
+	unsigned long long key = ((unsigned long long) dev << 32) ^ ino;
+	unsigned int slot;
+
+	key *= 0x9e3779b97f4a7c15ull;
+	slot = (unsigned int) (key >> 32) & (class_cache_size - 1);
+	while (class_cache[slot].used && ((class_cache[slot].ino != ino)
+				|| (class_cache[slot].dev != dev)))
+		slot = (slot + 1) & (class_cache_size - 1);
+	return slot;
+}
+
+static void feh_class_cache_grow(void)
+{
+	feh_class_entry *old = class_cache;
+	unsigned int old_size = class_cache_size, i;
+
+	class_cache_size = class_cache_size ? 2 * class_cache_size : 256;
+	class_cache = emalloc(class_cache_size * sizeof(feh_class_entry));
+	memset(class_cache, 0, class_cache_size * sizeof(feh_class_entry));
+	for (i = 0; i < old_size; i++)
+		if (old[i].used)
+			class_cache[feh_class_slot(old[i].dev, old[i].ino)] = old[i];
+	free(old);
+}
+
+enum feh_probe_class feh_probe_classify(char *filename)
+{
+	unsigned char buf[FEH_CLASS_HEADER_SIZE];
+	feh_class_entry *entry;
+	struct stat st;
+	ssize_t len;
+	int fd;
+
+	if (path_is_url(filename) || stat(filename, &st) || !S_ISREG(st.st_mode))
+		return FEH_CLASS_UNKNOWN;
+
+	if (2 * (class_cache_count + 1) > class_cache_size)
+		feh_class_cache_grow();
+	entry = &class_cache[feh_class_slot(st.st_dev, st.st_ino)];
+	if (entry->used && (entry->mtime == st.st_mtime)
+			&& (entry->size == st.st_size))
+		return entry->class;
+
+	if ((fd = open(filename, O_RDONLY | O_CLOEXEC)) == -1)
+		return FEH_CLASS_UNKNOWN;
+	if ((len = read(fd, buf, sizeof(buf))) < 0) {
+		close(fd);
+		return FEH_CLASS_UNKNOWN;
+	}
+
+	if (!entry->used) {
+		entry->used = 1;
+		entry->dev = st.st_dev;
+		entry->ino = st.st_ino;
+		class_cache_count++;
+	}
+	entry->mtime = st.st_mtime;
+	entry->size = st.st_size;
+	entry->class = feh_probe_class(fd, buf, len);
+	close(fd);
+	D(("%s is of class %d\n", filename, entry->class));
+	return entry->class;
+}
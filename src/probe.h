@@ -0,0 +1,63 @@
+/* probe.h
+
+Copyright (C) 2024 feh contributors.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to
+deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+sell copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies of the Software and its documentation and acknowledgment shall be
+given in the documentation and software packages that this Software was
+used.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#ifndef PROBE_H
+#define PROBE_H
+
+#include "feh.h"
+
+enum feh_probe_type {
+	FEH_PROBE_UNKNOWN = -1,
+	FEH_PROBE_JPEG,
+	FEH_PROBE_PNG,
+	FEH_PROBE_GIF,
+	FEH_PROBE_BMP,
+	FEH_PROBE_PNM,
+	FEH_PROBE_WEBP,
+	FEH_PROBE_TIFF,
+	FEH_PROBE_TYPES
+};
+
+enum feh_probe_class {
+	FEH_CLASS_UNKNOWN,
+	FEH_CLASS_IMAGE,
+	FEH_CLASS_RAW,
+	FEH_CLASS_OTHER
+};
+
+typedef struct {
+	enum feh_probe_type type;
+	int width;
+	int height;
+	int has_alpha;
+} feh_probe_info;
+
+int feh_probe_image(char *filename, feh_probe_info * info);
+char *feh_probe_format(feh_probe_info * info);
+void feh_probe_learn(feh_probe_info * info, Imlib_Image im);
+int feh_probe_name_wanted(char *name);
+enum feh_probe_class feh_probe_classify(char *filename);
+
+#endif				/* PROBE_H */
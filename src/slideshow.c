@@ -31,11 +31,51 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "options.h"
 #include "signals.h"
 
-void init_slideshow_mode(void)
+/*
+ * Opens the slideshow window on the first loadable file from l on. Files
+ * which cannot be loaded are removed. Returns 0 if there is none.
+ */
+static int slideshow_start_at(gib_list * l)
 {
 	winwidget w = NULL;
-	int success = 0;
-	gib_list *l = filelist, *last = NULL;
+	gib_list *last = NULL;
+
+	for (; l; l = l->next) {
+		if (last) {
+			filelist = feh_file_remove_from_list(filelist, last);
+			last = NULL;
+		}
+		current_file = l;
+		if ((w = winwidget_create_from_file(l, WIN_TYPE_SLIDESHOW)) != NULL) {
+			winwidget_show(w);
+			feh_timing_event("first image shown");
+			if (opt.slideshow_delay > 0.0)
+				feh_add_timer(cb_slide_timer, w, opt.slideshow_delay, "SLIDE_CHANGE");
+			if (opt.reload > 0)
+				feh_add_unique_timer(cb_reload_timer, w, opt.reload);
+			feh_prefetch_update(w, SLIDE_NEXT);
+			return(1);
+		} else {
+			last = l;
+		}
+	}
+	if (last)
+		filelist = feh_file_remove_from_list(filelist, last);
+	current_file = NULL;
+	return(0);
+}
+
+void init_slideshow_mode(void)
+{
+	gib_list *l = filelist;
+
+	if (!opt.title)
+		opt.title = PACKAGE " [%u of %l] - %f";
+	mode = "slideshow";
+
+	/* see slideshow_stream_update */
+	if (feh_filelist_streaming())
+		return;
 
 	/*
 	 * In theory, --start-at FILENAME is simple: Look for a file called
@@ -96,34 +136,52 @@ void init_slideshow_mode(void)
 		eprintf("--start-at %s: File not found in filelist",
 				opt.start_list_at);
 
-	if (!opt.title)
-		opt.title = PACKAGE " [%u of %l] - %f";
-
-	mode = "slideshow";
-	for (; l; l = l->next) {
-		if (last) {
-			filelist = feh_file_remove_from_list(filelist, last);
-			last = NULL;
-		}
-		current_file = l;
-		if ((w = winwidget_create_from_file(l, WIN_TYPE_SLIDESHOW)) != NULL) {
-			success = 1;
-			winwidget_show(w);
-			if (opt.slideshow_delay > 0.0)
-				feh_add_timer(cb_slide_timer, w, opt.slideshow_delay, "SLIDE_CHANGE");
-			if (opt.reload > 0)
-				feh_add_unique_timer(cb_reload_timer, w, opt.reload);
-			break;
-		} else {
-			last = l;
-		}
-	}
-	if (!success)
+	if (!slideshow_start_at(l))
 		show_mini_usage();
 
 	return;
 }
 
+/*
+ * Called by feh_filelist_stream_step for each batch of files added to the
+ * filelist. The slideshow starts as soon as the first loadable image (or the
+ * one given by --start-at) is there; its title is kept up to date afterwards.
+ * Only exact --start-at matches can be found this way, the fuzzy ones have to
+ * wait for slideshow_stream_done.
+ */
+void slideshow_stream_update(gib_list * added)
+{
+	winwidget w = winwidget_get_first_window_of_type(WIN_TYPE_SLIDESHOW);
+	gib_list *l = added;
+
+	if (w) {
+		winwidget_update_title(w);
+		return;
+	}
+
+	if (opt.start_list_at) {
+		for (; l; l = l->next)
+			if (!strcmp(opt.start_list_at, FEH_FILE(l->data)->filename))
+				break;
+		if (!l)
+			return;
+		free(opt.start_list_at);
+		opt.start_list_at = NULL;
+	}
+	slideshow_start_at(l);
+}
+
+/* Called once the filelist is complete */
+void slideshow_stream_done(void)
+{
+	winwidget w = winwidget_get_first_window_of_type(WIN_TYPE_SLIDESHOW);
+
+	if (w)
+		winwidget_render_image(w, 0, 0);
+	else
+		init_slideshow_mode();
+}
+
 void cb_slide_timer(void *data)
 {
 	slideshow_change_image((winwidget) data, SLIDE_NEXT, 1);
@@ -132,9 +190,6 @@ void cb_slide_timer(void *data)
 
 void cb_reload_timer(void *data)
 {
-	gib_list *l;
-	char *current_filename;
-
 	winwidget w = (winwidget) data;
 
 	/*
@@ -142,47 +197,8 @@ void cb_reload_timer(void *data)
 	 * dynamically adding/removing windows is not implemented at the moment.
 	 * So don't reload filelists in multi-window mode.
 	 */
-	if (current_file != NULL) {
-		/* save the current filename for refinding it in new list */
-		current_filename = estrdup(FEH_FILE(current_file->data)->filename);
-
-		for (l = filelist; l; l = l->next) {
-			feh_file_free(l->data);
-			l->data = NULL;
-		}
-		gib_list_free_and_data(filelist);
-		filelist = NULL;
-		filelist_len = 0;
-		current_file = NULL;
-
-		/* rebuild filelist from original_file_items */
-		if (gib_list_length(original_file_items) > 0)
-			for (l = gib_list_last(original_file_items); l; l = l->prev)
-				add_file_to_filelist_recursively(l->data, FILELIST_FIRST);
-		else if (!opt.filelistfile && !opt.bgmode)
-			add_file_to_filelist_recursively(".", FILELIST_FIRST);
-
-		if (opt.filelistfile) {
-			filelist = gib_list_cat(filelist, feh_read_filelist(opt.filelistfile));
-		}
-
-		if (!(filelist_len = gib_list_length(filelist))) {
-			eprintf("No files found to reload.");
-		}
-
-		feh_prepare_filelist();
-
-		/* find the previously current file */
-		for (l = filelist; l; l = l->next)
-			if (strcmp(FEH_FILE(l->data)->filename, current_filename) == 0) {
-				current_file = l;
-				break;
-			}
-
-		free(current_filename);
-
-		if (!current_file)
-			current_file = filelist;
+	if ((current_file != NULL) && !feh_filelist_streaming()) {
+		current_file = feh_filelist_refresh(current_file);
 		w->file = current_file;
 	}
 
@@ -197,6 +213,7 @@ void slideshow_change_image(winwidget winwid, int change, int render)
 	gib_list *previous_file = current_file;
 	int i = 0;
 	int jmp = 1;
+	int requested_change = change;
 	/* We can't use filelist_len in the for loop, since that changes when we
 	 * encounter invalid images.
 	 */
@@ -215,7 +232,7 @@ void slideshow_change_image(winwidget winwid, int change, int render)
 	   find the correct one. Otherwise SLIDE_LAST would try the last file, *
 	   then loop forward to find a loadable one. */
 	if (change == SLIDE_FIRST) {
-		current_file = gib_list_last(filelist);
+		current_file = feh_filelist_nth(filelist_len - 1);
 		change = SLIDE_NEXT;
 		previous_file = NULL;
 	} else if (change == SLIDE_LAST) {
@@ -254,28 +271,14 @@ void slideshow_change_image(winwidget winwid, int change, int render)
 			}
 			break;
 		case SLIDE_JUMP_FWD:
-			if (filelist_len < 5)
-				jmp = 1;
-			else if (filelist_len < 40)
-				jmp = 2;
-			else
-				jmp = filelist_len / 20;
-			if (!jmp)
-				jmp = 2;
+			jmp = slideshow_jump_length();
 			current_file = feh_list_jump(filelist, current_file, FORWARD, jmp);
 			/* important. if the load fails, we only want to step on ONCE to
 			   try the next file, not another jmp */
 			change = SLIDE_NEXT;
 			break;
 		case SLIDE_JUMP_BACK:
-			if (filelist_len < 5)
-				jmp = 1;
-			else if (filelist_len < 40)
-				jmp = 2;
-			else
-				jmp = filelist_len / 20;
-			if (!jmp)
-				jmp = 2;
+			jmp = slideshow_jump_length();
 			current_file = feh_list_jump(filelist, current_file, BACK, jmp);
 			/* important. if the load fails, we only want to step back ONCE to
 			   try the previous file, not another jmp */
@@ -283,15 +286,13 @@ void slideshow_change_image(winwidget winwid, int change, int render)
 			break;
 		case SLIDE_JUMP_NEXT_DIR:
 			{
-				char old_dir[PATH_MAX], new_dir[PATH_MAX];
+				/* directory names are interned, see pathstore.c */
+				char *dir = FEH_FILE(current_file->data)->dir;
 				int j;
 
-				feh_file_dirname(old_dir, FEH_FILE(current_file->data), PATH_MAX);
-
 				for (j = 0; j < our_filelist_len; j++) {
 					current_file = feh_list_jump(filelist, current_file, FORWARD, 1);
-					feh_file_dirname(new_dir, FEH_FILE(current_file->data), PATH_MAX);
-					if (strcmp(old_dir, new_dir) != 0)
+					if (FEH_FILE(current_file->data)->dir != dir)
 						break;
 				}
 			}
@@ -299,18 +300,17 @@ void slideshow_change_image(winwidget winwid, int change, int render)
 			break;
 		case SLIDE_JUMP_PREV_DIR:
 			{
-				char old_dir[PATH_MAX], new_dir[PATH_MAX];
+				char *dir;
 				int j;
 
 				/* Start the search from the previous file in case we are on
 				   the first file of a directory */
 				current_file = feh_list_jump(filelist, current_file, BACK, 1);
-				feh_file_dirname(old_dir, FEH_FILE(current_file->data), PATH_MAX);
+				dir = FEH_FILE(current_file->data)->dir;
 
 				for (j = 0; j < our_filelist_len; j++) {
 					current_file = feh_list_jump(filelist, current_file, BACK, 1);
-					feh_file_dirname(new_dir, FEH_FILE(current_file->data), PATH_MAX);
-					if (strcmp(old_dir, new_dir) != 0)
+					if (FEH_FILE(current_file->data)->dir != dir)
 						break;
 				}
 
@@ -336,8 +336,8 @@ void slideshow_change_image(winwidget winwid, int change, int render)
 		}
 
 		if (winwidget_loadimage(winwid, FEH_FILE(current_file->data))) {
-			int w = gib_imlib_image_get_width(winwid->im);
-			int h = gib_imlib_image_get_height(winwid->im);
+			int w = feh_image_get_width(winwid->im);
+			int h = feh_image_get_height(winwid->im);
 			if (feh_should_ignore_image(winwid->im)) {
 				last = current_file;
 				continue;
@@ -362,9 +362,26 @@ void slideshow_change_image(winwidget winwid, int change, int render)
 	if (filelist_len == 0)
 		eprintf("No more slides in show");
 
+	feh_prefetch_update(winwid, requested_change);
+
 	return;
 }
 
+int slideshow_jump_length(void)
+{
+	int jmp;
+
+	if (filelist_len < 5)
+		jmp = 1;
+	else if (filelist_len < 40)
+		jmp = 2;
+	else
+		jmp = filelist_len / 20;
+	if (!jmp)
+		jmp = 2;
+	return(jmp);
+}
+
 void slideshow_pause_toggle(winwidget w)
 {
 	if (!opt.paused) {
@@ -470,7 +487,7 @@ char *feh_printf(char *str, feh_file * file, winwidget winwid, int shell)
 				}
 				break;
 			case 'l':
-				snprintf(buf, sizeof(buf), "%d", gib_list_length(filelist));
+				snprintf(buf, sizeof(buf), "%d", filelist_len);
 				strncat(ret, buf, ret_size - ret_used);
 				break;
 			case 'L':
@@ -540,7 +557,7 @@ char *feh_printf(char *str, feh_file * file, winwidget winwid, int shell)
 				break;
 			case 'u':
 				f = current_file ? current_file : gib_list_find_by_data(filelist, file);
-				snprintf(buf, sizeof(buf), "%d", f ? gib_list_num(filelist, f) + 1 : 0);
+				snprintf(buf, sizeof(buf), "%d", feh_filelist_pos(f) + 1);
 				strncat(ret, buf, ret_size - ret_used);
 				break;
 			case 'v':
@@ -674,6 +691,8 @@ void slideshow_save_image(winwidget win)
 	if (opt.verbose)
 		fprintf(stderr, "saving image to filename '%s'\n", tmpname);
 
+	winwidget_ensure_full_image(win);
+
 	gib_imlib_save_image_with_error_return(win->im, tmpname, &err);
 
 	if (err)
@@ -685,38 +704,35 @@ void slideshow_save_image(winwidget win)
 
 gib_list *feh_list_jump(gib_list * root, gib_list * l, int direction, int num)
 {
-	int i;
-	gib_list *ret = NULL;
+	gib_list *ret;
+	int pos;
 
 	if (!root)
 		return (NULL);
 	if (!l)
 		return (root);
 
-	ret = l;
+	/* l is always part of the filelist, so jump by position */
+	if ((pos = feh_filelist_pos(l)) < 0)
+		return (root);
 
-	for (i = 0; i < num; i++) {
-		if (direction == FORWARD) {
-			if (ret->next) {
-				ret = ret->next;
-			} else {
-				if (opt.on_last_slide == ON_LAST_SLIDE_QUIT) {
-					exit(0);
-				}
-				if (opt.randomize) {
-					/* Randomize the filename order */
-					filelist = gib_list_randomize(filelist);
-					ret = filelist;
-				} else {
-					ret = root;
-				}
+	if (direction == FORWARD) {
+		for (pos += num; pos >= filelist_len; pos -= filelist_len) {
+			if (opt.on_last_slide == ON_LAST_SLIDE_QUIT) {
+				exit(0);
+			}
+			if (opt.randomize) {
+				/* Randomize the filename order */
+				filelist = gib_list_randomize(filelist);
+				feh_filelist_index_invalidate();
 			}
-		} else {
-			if (ret->prev)
-				ret = ret->prev;
-			else
-				ret = gib_list_last(ret);
 		}
+	} else {
+		pos = (pos - num) % filelist_len;
+		if (pos < 0)
+			pos += filelist_len;
 	}
-	return (ret);
+
+	ret = feh_filelist_nth(pos);
+	return (ret ? ret : filelist);
 }
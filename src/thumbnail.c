@@ -31,6 +31,7 @@ CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 #include "thumbnail.h"
 #include "md5.h"
 #include "feh_png.h"
+#include "worker.h"
 #include "index.h"
 #include "signals.h"
 
@@ -38,6 +39,227 @@ static gib_list *thumbnails = NULL;
 
 static thumbmode_data td;
 
+/*
+ * MD5 sums of the thumbnails in a cache directory, read once by
+ * feh_thumbnail_setup_cache so that cache misses need no file system access.
+ * An open addressing hash table; all-zero entries are empty.
+ */
+typedef struct {
+	md5_byte_t (*entries)[16];
+	unsigned int size;
+	unsigned int count;
+} feh_thumbnail_index;
+
+/* thumbnails and failure records (for images which could not be loaded) */
+static feh_thumbnail_index cache_index, fail_index;
+
+static const md5_byte_t cache_index_empty[16];
+
+/*
+ * Thumbnails waiting to be written to the cache. They are written in batches
+ * by a child process so that encoding them does not hold up thumbnail
+ * creation.
+ */
+#define FEH_THUMBNAIL_WRITE_BATCH 32
+
+typedef struct {
+	Imlib_Image im;
+	char *thumb_file;
+	char *uri;
+	char mtime[32];
+	char width[16];
+	char height[16];
+	char *tmp_file;
+	int tmp_fd;
+} feh_thumbnail_pending;
+
+static gib_list *pending_writes = NULL;
+static int pending_count = 0;
+static pid_t cache_writer = 0;
+
+/*
+ * Loads file and scales it to its thumbnail size. *orig_w and *orig_h are
+ * set to the dimensions of the original image, *has_alpha tells whether it
+ * has an alpha channel.
+ */
+static int feh_thumbnail_create(feh_file * file, Imlib_Image * im_thumb,
+		int *orig_w, int *orig_h, int *has_alpha)
+{
+	Imlib_Image im_temp;
+	int ww, hh;
+
+	if (!feh_thumbnail_get_thumbnail(&im_temp, file, orig_w, orig_h))
+		return(0);
+
+	ww = feh_image_get_width(im_temp);
+	hh = feh_image_get_height(im_temp);
+
+	if (!*orig_w) {
+		*orig_w = ww;
+		*orig_h = hh;
+	}
+
+	*has_alpha = gib_imlib_image_has_alpha(im_temp) ? 1 : 0;
+	imlib_context_set_blend(*has_alpha);
+
+	*im_thumb = index_scale_thumbnail(im_temp, ww, hh);
+	return(1);
+}
+
+static int feh_thumbnail_job_run(feh_worker_job * job)
+{
+	feh_file *file = feh_file_new(job->filename);
+	int ret = feh_thumbnail_create(file, &(job->im), &(job->ret[0]),
+			&(job->ret[1]), &(job->ret[2]));
+
+	if (!ret)
+		job->im = NULL;
+	feh_file_free(file);
+	return(ret);
+}
+
+/*
+ * Draws im_thumb, the thumbnail of file, at the next free position of the
+ * thumbnail window. Returns 0 if there is no space left.
+ */
+static int feh_thumbnail_draw(feh_file * file, Imlib_Image im_thumb,
+		int has_alpha)
+{
+	int www, hhh, xxx, yyy;
+	int x = td.next_x, y = td.next_y;
+	int tw, th, fw, fh;
+	int lineno;
+	gib_list *line, *lines;
+
+	www = gib_imlib_image_get_width(im_thumb);
+	hhh = gib_imlib_image_get_height(im_thumb);
+
+	imlib_context_set_blend(has_alpha);
+
+	td.text_area_w = opt.thumb_w;
+	/* Now draw on the info text */
+	if (opt.index_info) {
+		get_index_string_dim(file, td.font_main, &fw, &fh);
+		if (fw > td.text_area_w)
+			td.text_area_w = fw;
+		if (fh > td.text_area_h) {
+			td.text_area_h = fh + 5;
+			td.thumb_tot_h = opt.thumb_h + td.text_area_h;
+		}
+	}
+	if (td.text_area_w > opt.thumb_w)
+		td.text_area_w += 5;
+
+	if (td.vertical) {
+		if (td.text_area_w > td.max_column_w)
+			td.max_column_w = td.text_area_w;
+		if (y > td.h - td.thumb_tot_h) {
+			y = 0;
+			x += td.max_column_w;
+			td.max_column_w = 0;
+		}
+		if (x > td.w - td.text_area_w)
+			return(0);
+	} else {
+		if (x > td.w - td.text_area_w) {
+			x = 0;
+			y += td.thumb_tot_h;
+		}
+		if (y > td.h - td.thumb_tot_h)
+			return(0);
+	}
+
+	/* center image relative to the text below it (if any) */
+	xxx = x + ((td.text_area_w - www) / 2);
+	yyy = y;
+
+	if (opt.aspect)
+		yyy += (opt.thumb_h - hhh) / 2;
+
+	/* Draw now */
+	gib_imlib_blend_image_onto_image(td.im_main,
+					 im_thumb,
+					 gib_imlib_image_has_alpha
+					 (im_thumb), 0, 0,
+					 www, hhh, xxx,
+					 yyy, www, hhh, 1,
+					 gib_imlib_image_has_alpha(im_thumb), 0);
+
+	thumbnails = gib_list_add_front(thumbnails,
+			feh_thumbnail_new(file, xxx, yyy, www, hhh));
+
+	lineno = 0;
+	if (opt.index_info) {
+		char *tmp = create_index_string(file);
+		line = lines = feh_wrap_string(tmp,
+				opt.thumb_w * 3, td.font_main, NULL);
+		free(tmp);
+
+		/* Work out how tall the font is */
+		gib_imlib_get_text_size(td.font_main, "W", NULL, &tw, &th,
+				IMLIB_TEXT_TO_RIGHT);
+
+		while (line) {
+			gib_imlib_get_text_size(td.font_main, (char *) line -> data,
+					NULL, &fw, &fh, IMLIB_TEXT_TO_RIGHT);
+			gib_imlib_text_draw(td.im_main, td.font_main, NULL,
+					x + ((td.text_area_w - fw) >> 1),
+					y + opt.thumb_h + (lineno++ * (th + 2)) + 2,
+					(char *) line->data,
+					IMLIB_TEXT_TO_RIGHT, 255, 255, 255, 255);
+			line = line->next;
+		}
+		gib_list_free_and_data(lines);
+	}
+
+	if (td.vertical)
+		y += td.thumb_tot_h;
+	else
+		x += td.text_area_w;
+
+	td.next_x = x;
+	td.next_y = y;
+	return(1);
+}
+
+/*
+ * Adds a thumbnail for file, which has just been added to the filelist, to
+ * the thumbnail window. Returns 1 if the window needs to be redrawn.
+ */
+int feh_thumbnail_add(feh_file * file)
+{
+	Imlib_Image im_thumb;
+	int orig_w = 0, orig_h = 0, has_alpha, ret;
+
+	if (!winwidget_get_first_window_of_type(WIN_TYPE_THUMBNAIL)
+			|| !feh_thumbnail_create(file, &im_thumb, &orig_w, &orig_h,
+				&has_alpha))
+		return(0);
+
+	ret = feh_thumbnail_draw(file, im_thumb, has_alpha);
+	gib_imlib_free_image_and_decache(im_thumb);
+	return(ret);
+}
+
+/*
+ * Called by feh_filelist_stream_step with files read from a --filelist pipe.
+ * Adds them to the filelist and the thumbnail window, like --watch does.
+ */
+void feh_thumbnail_stream_update(gib_list * added)
+{
+	winwidget w;
+	gib_list *l;
+	int redraw = 0;
+
+	added = feh_filelist_add_batch(added);
+	for (l = added; l; l = l->next)
+		redraw |= feh_thumbnail_add(FEH_FILE(l->data));
+	gib_list_free(added);
+
+	if (redraw && (w = winwidget_get_first_window_of_type(WIN_TYPE_THUMBNAIL)))
+		winwidget_render_image(w, 0, 1);
+}
+
 /* TODO Break this up a bit ;) */
 /* TODO s/bit/lot */
 void init_thumbnail_mode(void)
@@ -56,23 +278,17 @@ void init_thumbnail_mode(void)
 	 */
 
 	Imlib_Load_Error err;
-	Imlib_Image im_temp;
-	int ww = 0, hh = 0, www, hhh, xxx, yyy;
-	int orig_w, orig_h;
-	int x = 0, y = 0;
+	int orig_w, orig_h, has_alpha, full;
 	winwidget winwid = NULL;
 	Imlib_Image im_thumb = NULL;
 	unsigned char trans_bg = 0;
 	int title_area_h = 0;
-	int tw = 0, th = 0;
 	int fw, fh;
 	int thumbnailcount = 0;
 	feh_file *file = NULL;
 	gib_list *l, *last = NULL;
-	int lineno;
 	int index_image_width, index_image_height;
 	unsigned int thumb_counter = 0;
-	gib_list *line, *lines;
 
 	/* initialize thumbnail mode data */
 	td.im_main = NULL;
@@ -90,6 +306,8 @@ void init_thumbnail_mode(void)
 
 	td.vertical = 0;
 	td.max_column_w = 0;
+	td.next_x = 0;
+	td.next_y = 0;
 
 	if (!opt.thumb_title)
 		opt.thumb_title = "%n";
@@ -117,9 +335,6 @@ void init_thumbnail_mode(void)
 	if ((!td.font_main) || (!td.font_title))
 		eprintf("Error loading fonts");
 
-	/* Work out how tall the font is */
-	gib_imlib_get_text_size(td.font_main, "W", NULL, &tw, &th,
-			IMLIB_TEXT_TO_RIGHT);
 	get_index_string_dim(NULL, td.font_main, &fw, &fh);
 	td.text_area_h = fh + 5;
 
@@ -183,32 +398,10 @@ void init_thumbnail_mode(void)
 		winwidget_show(winwid);
 	}
 
-	td.cache_thumbnails = opt.cache_thumbnails;
+	feh_thumbnail_setup_cache();
 
-	if (td.cache_thumbnails) {
-		if (opt.thumb_w > opt.thumb_h)
-			td.cache_dim = opt.thumb_w;
-		else
-			td.cache_dim = opt.thumb_h;
-
-		if (td.cache_dim > 1024) {
-			/* Not specified by XDG thumbnail standard */
-			td.cache_thumbnails = 0;
-		} else if (td.cache_dim > 512) {
-			td.cache_dim = 1024;
-			td.cache_dir = estrdup("xx-large");
-		} else if (td.cache_dim > 256) {
-			td.cache_dim = 512;
-			td.cache_dir = estrdup("x-large");
-		} else if (td.cache_dim > 128) {
-			td.cache_dim = 256;
-			td.cache_dir = estrdup("large");
-		} else {
-			td.cache_dim = 128;
-			td.cache_dir = estrdup("normal");
-		}
-		feh_thumbnail_setup_thumbnail_dir();
-	}
+	/* td must be set up before starting the workers */
+	index_jobs_init(feh_thumbnail_job_run);
 
 	for (l = filelist; l; l = l->next) {
 		file = FEH_FILE(l->data);
@@ -217,138 +410,17 @@ void init_thumbnail_mode(void)
 			last = NULL;
 		}
 		D(("About to load image %s\n", file->filename));
-		/*      if (feh_load_image(&im_temp, file) != 0) */
-		if (feh_thumbnail_get_thumbnail(&im_temp, file, &orig_w, &orig_h)
-				!= 0) {
+		if (index_jobs_next(l, feh_thumbnail_create,
+				&im_thumb, &orig_w, &orig_h, &has_alpha)) {
 			if (opt.verbose)
 				feh_display_status('.');
 			D(("Successfully loaded %s\n", file->filename));
-			www = opt.thumb_w;
-			hhh = opt.thumb_h;
-			ww = gib_imlib_image_get_width(im_temp);
-			hh = gib_imlib_image_get_height(im_temp);
-
-			if (!orig_w) {
-				orig_w = ww;
-				orig_h = hh;
-			}
 
 			thumbnailcount++;
-			if (gib_imlib_image_has_alpha(im_temp))
-				imlib_context_set_blend(1);
-			else
-				imlib_context_set_blend(0);
-
-			if (opt.aspect) {
-				double ratio = 0.0;
-
-				/* Keep the aspect ratio for the thumbnail */
-				ratio = ((double) ww / hh) / ((double) www / hhh);
-
-				if (ratio > 1.0)
-					hhh = opt.thumb_h / ratio;
-				else if (ratio != 1.0)
-					www = opt.thumb_w * ratio;
-			}
-
-			if ((!opt.stretch) && ((www > ww) || (hhh > hh))) {
-				/* Don't make the image larger unless stretch is specified */
-				www = ww;
-				hhh = hh;
-			}
-
-			im_thumb = gib_imlib_create_cropped_scaled_image(im_temp, 0, 0,
-					ww, hh, www, hhh, 1);
-			gib_imlib_free_image_and_decache(im_temp);
-
-			if (opt.alpha) {
-				DATA8 atab[256];
-
-				D(("Applying alpha options\n"));
-				gib_imlib_image_set_has_alpha(im_thumb, 1);
-				memset(atab, opt.alpha_level, sizeof(atab));
-				gib_imlib_apply_color_modifier_to_rectangle
-				    (im_thumb, 0, 0, www, hhh, NULL, NULL, NULL, atab);
-			}
-
-			td.text_area_w = opt.thumb_w;
-			/* Now draw on the info text */
-			if (opt.index_info) {
-				get_index_string_dim(file, td.font_main, &fw, &fh);
-				if (fw > td.text_area_w)
-					td.text_area_w = fw;
-				if (fh > td.text_area_h) {
-					td.text_area_h = fh + 5;
-					td.thumb_tot_h = opt.thumb_h + td.text_area_h;
-				}
-			}
-			if (td.text_area_w > opt.thumb_w)
-				td.text_area_w += 5;
-
-			if (td.vertical) {
-				if (td.text_area_w > td.max_column_w)
-					td.max_column_w = td.text_area_w;
-				if (y > td.h - td.thumb_tot_h) {
-					y = 0;
-					x += td.max_column_w;
-					td.max_column_w = 0;
-				}
-				if (x > td.w - td.text_area_w)
-					break;
-			} else {
-				if (x > td.w - td.text_area_w) {
-					x = 0;
-					y += td.thumb_tot_h;
-				}
-				if (y > td.h - td.thumb_tot_h)
-					break;
-			}
-
-			/* center image relative to the text below it (if any) */
-			xxx = x + ((td.text_area_w - www) / 2);
-			yyy = y;
-
-			if (opt.aspect)
-				yyy += (opt.thumb_h - hhh) / 2;
-
-			/* Draw now */
-			gib_imlib_blend_image_onto_image(td.im_main,
-							 im_thumb,
-							 gib_imlib_image_has_alpha
-							 (im_thumb), 0, 0,
-							 www, hhh, xxx,
-							 yyy, www, hhh, 1,
-							 gib_imlib_image_has_alpha(im_thumb), 0);
-
-			thumbnails = gib_list_add_front(thumbnails,
-					feh_thumbnail_new(file, xxx, yyy, www, hhh));
-
+			full = !feh_thumbnail_draw(file, im_thumb, has_alpha);
 			gib_imlib_free_image_and_decache(im_thumb);
-
-			lineno = 0;
-			if (opt.index_info) {
-				char *tmp = create_index_string(file);
-				line = lines = feh_wrap_string(tmp,
-						opt.thumb_w * 3, td.font_main, NULL);
-				free(tmp);
-
-				while (line) {
-					gib_imlib_get_text_size(td.font_main, (char *) line -> data,
-							NULL, &fw, &fh, IMLIB_TEXT_TO_RIGHT);
-					gib_imlib_text_draw(td.im_main, td.font_main, NULL,
-							x + ((td.text_area_w - fw) >> 1),
-							y + opt.thumb_h + (lineno++ * (th + 2)) + 2,
-							(char *) line->data,
-							IMLIB_TEXT_TO_RIGHT, 255, 255, 255, 255);
-					line = line->next;
-				}
-				gib_list_free_and_data(lines);
-			}
-
-			if (td.vertical)
-				y += td.thumb_tot_h;
-			else
-				x += td.text_area_w;
+			if (full)
+				break;
 		} else {
 			if (opt.verbose)
 				feh_display_status('x');
@@ -365,6 +437,8 @@ void init_thumbnail_mode(void)
 		}
 	}
 
+	index_jobs_abandon();
+
 	if (thumb_counter != 0)
 		winwidget_render_image(winwid, 0, 1);
 
@@ -544,6 +618,11 @@ void feh_thumbnail_calculate_geometry(void)
 
 		index_calculate_height(td.font_main, td.w, &td.h, &td.thumb_tot_h);
 
+		/* leave room for the files still to be read from --filelist */
+		if (!opt.limit_h && feh_filelist_streaming() && scr
+				&& (td.h < scr->height))
+			td.h = scr->height;
+
 		if (opt.limit_h) {
 			if (td.h> opt.limit_h)
 				weprintf(
@@ -562,11 +641,324 @@ void feh_thumbnail_calculate_geometry(void)
 	}
 }
 
+/*
+ * Parses the MD5 sum from the name of a cached thumbnail. Returns 0 if name
+ * is not of the form <md5>.png.
+ */
+static int feh_thumbnail_name_to_md5(char *name, md5_byte_t digest[16])
+{
+	int i, hi, lo;
+	char *base = strrchr(name, '/');
+
+	if (base)
+		name = base + 1;
+
+	for (i = 0; i < 16; i++) {
+		if (!isxdigit(name[2 * i]) || !isxdigit(name[2 * i + 1]))
+			return 0;
+		hi = isdigit(name[2 * i]) ? name[2 * i] - '0'
+			: tolower(name[2 * i]) - 'a' + 10;
+		lo = isdigit(name[2 * i + 1]) ? name[2 * i + 1] - '0'
+			: tolower(name[2 * i + 1]) - 'a' + 10;
+		digest[i] = (hi << 4) | lo;
+	}
+	return !strcmp(name + 32, ".png");
+}
+
+static unsigned int feh_thumbnail_index_slot(feh_thumbnail_index * index,
+		md5_byte_t digest[16])
+{
+	/* MD5 sums are evenly distributed, so any part of them will do */
+	unsigned int slot = (digest[0] << 24) | (digest[1] << 16)
+		| (digest[2] << 8) | digest[3];
+
+	slot &= index->size - 1;
+	while (memcmp(index->entries[slot], digest, 16)) {
+		if (!memcmp(index->entries[slot], cache_index_empty, 16))
+			break;
+		slot = (slot + 1) & (index->size - 1);
+	}
+	return slot;
+}
+
+/* Records that the thumbnail thumb_file exists */
+static void feh_thumbnail_index_add(feh_thumbnail_index * index,
+		char *thumb_file)
+{
+	md5_byte_t digest[16];
+	md5_byte_t (*old)[16] = index->entries;
+	unsigned int i, old_size = index->size;
+
+	if (!index->entries || !feh_thumbnail_name_to_md5(thumb_file, digest))
+		return;
+
+	if (2 * (index->count + 1) > index->size) {
+		index->size *= 2;
+		index->entries = emalloc(index->size * 16);
+		memset(index->entries, 0, index->size * 16);
+		index->count = 0;
+		for (i = 0; i < old_size; i++) {
+			if (memcmp(old[i], cache_index_empty, 16)) {
+				memcpy(index->entries[feh_thumbnail_index_slot(index, old[i])],
+						old[i], 16);
+				index->count++;
+			}
+		}
+		free(old);
+	}
+
+	i = feh_thumbnail_index_slot(index, digest);
+	if (memcmp(index->entries[i], digest, 16)) {
+		memcpy(index->entries[i], digest, 16);
+		index->count++;
+	}
+}
+
+/*
+ * Returns 0 if the thumbnail thumb_file is known not to exist. Before the
+ * cache directory has been read (or if reading it failed), every thumbnail
+ * may exist.
+ */
+static int feh_thumbnail_index_contains(feh_thumbnail_index * index,
+		char *thumb_file)
+{
+	md5_byte_t digest[16];
+
+	if (!index->entries || !feh_thumbnail_name_to_md5(thumb_file, digest))
+		return 1;
+
+	return !memcmp(index->entries[feh_thumbnail_index_slot(index, digest)],
+			digest, 16);
+}
+
+static void feh_thumbnail_read_index(feh_thumbnail_index * index, char *path)
+{
+	DIR *dir;
+	struct dirent *de;
+
+	if (!(dir = opendir(path)))
+		return;
+
+	index->size = 1024;
+	index->count = 0;
+	index->entries = emalloc(index->size * 16);
+	memset(index->entries, 0, index->size * 16);
+
+	while ((de = readdir(dir)))
+		feh_thumbnail_index_add(index, de->d_name);
+
+	closedir(dir);
+}
+
+/*
+ * Writes p to a temporary file next to its thumbnail. p->tmp_fd stays open
+ * so that the file can be synced before it is renamed into place.
+ */
+static void feh_thumbnail_write_tmp(feh_thumbnail_pending * p)
+{
+	int tmp_fd;
+
+	/* the temporary file must be in the same directory for rename */
+	p->tmp_file = estrdup(p->thumb_file);
+	strcpy(strrchr(p->tmp_file, '/') + 1, ".feh_XXXXXX");
+	p->tmp_fd = -1;
+
+	if ((tmp_fd = mkstemp(p->tmp_file)) != -1) {
+		p->tmp_fd = dup(tmp_fd);
+		/* failure records do not have image dimensions */
+		if ((p->tmp_fd != -1) && !feh_png_write_png_fd(p->im, tmp_fd,
+				opt.thumb_compression, opt.thumb_filters,
+				"Thumb::URI", p->uri, "Thumb::MTime", p->mtime,
+				p->width[0] ? "Thumb::Image::Width" : NULL, p->width,
+				"Thumb::Image::Height", p->height, NULL))
+			return;
+		if (p->tmp_fd != -1)
+			close(p->tmp_fd);
+		else
+			close(tmp_fd);
+		p->tmp_fd = -1;
+		unlink(p->tmp_file);
+	}
+	free(p->tmp_file);
+	p->tmp_file = NULL;
+}
+
+/*
+ * Writes the thumbnails in list. All of them are synced to disk in one pass
+ * before the first one is renamed into place, so that a crash cannot leave
+ * truncated thumbnails behind and the renames are not held up by I/O.
+ */
+static void feh_thumbnail_write(gib_list * list)
+{
+	gib_list *l;
+	feh_thumbnail_pending *p;
+
+	for (l = list; l; l = l->next)
+		feh_thumbnail_write_tmp(l->data);
+
+	for (l = list; l; l = l->next) {
+		p = l->data;
+		if (p->tmp_fd == -1)
+			continue;
+		if (fsync(p->tmp_fd)) {
+			unlink(p->tmp_file);
+			free(p->tmp_file);
+			p->tmp_file = NULL;
+		}
+		close(p->tmp_fd);
+		p->tmp_fd = -1;
+	}
+
+	for (l = list; l; l = l->next) {
+		p = l->data;
+		if (p->tmp_file && rename(p->tmp_file, p->thumb_file))
+			unlink(p->tmp_file);
+		free(p->tmp_file);
+		p->tmp_file = NULL;
+	}
+}
+
+static void feh_thumbnail_pending_free(feh_thumbnail_pending * p)
+{
+	gib_imlib_free_image_and_decache(p->im);
+	free(p->thumb_file);
+	free(p->uri);
+	free(p);
+}
+
+static void feh_thumbnail_wait_writer(void)
+{
+	while (cache_writer && (waitpid(cache_writer, NULL, 0) == -1)
+			&& (errno == EINTR));
+	cache_writer = 0;
+}
+
+/*
+ * Hands all pending thumbnails to a new writer process. Only one writer
+ * runs at a time, so this waits for the previous one to finish first.
+ */
+static void feh_thumbnail_start_writer(void)
+{
+	gib_list *l;
+
+	feh_thumbnail_wait_writer();
+
+	if ((cache_writer = fork()) == 0) {
+		feh_thumbnail_write(pending_writes);
+		_exit(0);
+	} else if (cache_writer < 0) {
+		cache_writer = 0;
+		feh_thumbnail_write(pending_writes);
+	}
+
+	for (l = pending_writes; l; l = l->next)
+		feh_thumbnail_pending_free(l->data);
+	gib_list_free(pending_writes);
+	pending_writes = NULL;
+	pending_count = 0;
+}
+
+/*
+ * Writes all pending thumbnails to the cache and waits until they are there.
+ * Called on exit, including exits caused by SIGTERM or SIGINT.
+ */
+void feh_thumbnail_flush_cache(void)
+{
+	if (pending_writes)
+		feh_thumbnail_start_writer();
+	feh_thumbnail_wait_writer();
+}
+
+/*
+ * Queues im (which is not modified) for writing to thumb_file and adds it to
+ * index. w and h are the original image dimensions, 0 if unknown. Worker
+ * processes already run in the background and write right away.
+ */
+static void feh_thumbnail_queue_write(feh_thumbnail_index * index,
+		Imlib_Image im, char *thumb_file, char *uri, time_t mtime, int w, int h)
+{
+	feh_thumbnail_pending *p = emalloc(sizeof(feh_thumbnail_pending));
+
+	p->thumb_file = estrdup(thumb_file);
+	p->uri = estrdup(uri);
+	snprintf(p->mtime, sizeof(p->mtime), "%d", (int) mtime);
+	p->width[0] = p->height[0] = '\0';
+	if (w && h) {
+		snprintf(p->width, sizeof(p->width), "%d", w);
+		snprintf(p->height, sizeof(p->height), "%d", h);
+	}
+
+	feh_thumbnail_index_add(index, thumb_file);
+
+	if (feh_worker_child) {
+		gib_list *single = gib_list_add_front(NULL, p);
+
+		p->im = im;
+		feh_thumbnail_write(single);
+		gib_list_free(single);
+		free(p->thumb_file);
+		free(p->uri);
+		free(p);
+		return;
+	}
+
+	p->im = gib_imlib_clone_image(im);
+	pending_writes = gib_list_add_end(pending_writes, p);
+	if (++pending_count >= FEH_THUMBNAIL_WRITE_BATCH)
+		feh_thumbnail_start_writer();
+}
+
+/*
+ * Returns 1 if fail_file records that file could not be loaded and file has
+ * not changed since.
+ */
+static int feh_thumbnail_has_failed(feh_file * file, char *uri,
+		char *fail_file)
+{
+	struct stat sb;
+	Imlib_Image im;
+	int w, h;
+
+	if (!feh_thumbnail_index_contains(&fail_index, fail_file)
+			|| stat(file->filename, &sb))
+		return (0);
+
+	if (!(im = feh_png_load_thumbnail(fail_file, uri, sb.st_mtime, &w, &h)))
+		return (0);
+
+	gib_imlib_free_image_and_decache(im);
+	return (1);
+}
+
+/*
+ * Records that file could not be loaded, as described by the XDG thumbnail
+ * specification: an empty thumbnail in the fail directory, which only counts
+ * while the file's mtime does not change.
+ */
+static void feh_thumbnail_record_failure(feh_file * file, char *uri,
+		char *fail_file)
+{
+	struct stat sb;
+	Imlib_Image im;
+
+	if (stat(file->filename, &sb) || !(im = imlib_create_image(1, 1)))
+		return;
+
+	imlib_context_set_image(im);
+	imlib_image_set_has_alpha(1);
+	memset(imlib_image_get_data(), 0, sizeof(DATA32));
+	imlib_image_put_back_data(imlib_image_get_data());
+
+	feh_thumbnail_queue_write(&fail_index, im, fail_file, uri, sb.st_mtime,
+			0, 0);
+	gib_imlib_free_image_and_decache(im);
+}
+
 int feh_thumbnail_get_thumbnail(Imlib_Image * image, feh_file * file,
 	int * orig_w, int * orig_h)
 {
 	int status = 0;
-	char *thumb_file = NULL, *uri = NULL;
+	char *thumb_file = NULL, *uri = NULL, *fail_file = NULL;
 
 	*orig_w = 0;
 	*orig_h = 0;
@@ -580,26 +972,45 @@ int feh_thumbnail_get_thumbnail(Imlib_Image * image, feh_file * file,
 
 		if (thumb_file == NULL) {
 			free(uri);
-			return feh_load_image(image, file);
+			return feh_load_thumbnail(image, file,
+					opt.aspect ? opt.thumb_w : 0, opt.thumb_h);
 		}
 
-		status = feh_thumbnail_get_generated(image, file, thumb_file,
-			orig_w, orig_h);
+		if (td.fail_prefix)
+			fail_file = estrjoin("/", td.fail_prefix,
+					strrchr(thumb_file, '/') + 1, NULL);
 
-		if (!status)
+		if (fail_file && feh_thumbnail_has_failed(file, uri, fail_file)) {
+			D(("%s is known not to load\n", file->filename));
+			free(uri);
+			free(thumb_file);
+			free(fail_file);
+			return (0);
+		}
+
+		if (feh_thumbnail_index_contains(&cache_index, thumb_file))
+			status = feh_thumbnail_get_generated(image, file, thumb_file,
+				uri, orig_w, orig_h);
+
+		if (!status) {
 			status = feh_thumbnail_generate(image, file, thumb_file, uri,
 				orig_w, orig_h);
+			if (!status && fail_file)
+				feh_thumbnail_record_failure(file, uri, fail_file);
+		}
 
 		D(("uri is %s, thumb_file is %s\n", uri, thumb_file));
 		free(uri);
 		free(thumb_file);
+		free(fail_file);
 	} else
-		status = feh_load_image(image, file);
+		status = feh_load_thumbnail(image, file,
+				opt.aspect ? opt.thumb_w : 0, opt.thumb_h);
 
 	return status;
 }
 
-static char *feh_thumbnail_get_prefix(void)
+static char *feh_thumbnail_get_prefix(char *subdir)
 {
 	char *dir = NULL, *home, *xdg_cache_home;
 
@@ -607,11 +1018,11 @@ static char *feh_thumbnail_get_prefix(void)
 
 	xdg_cache_home = getenv("XDG_CACHE_HOME");
 	if (xdg_cache_home && xdg_cache_home[0] == '/') {
-		dir = estrjoin("/", xdg_cache_home, "thumbnails", td.cache_dir, NULL);
+		dir = estrjoin("/", xdg_cache_home, "thumbnails", subdir, NULL);
 	} else {
 		home = getenv("HOME");
 		if (home && home[0] == '/') {
-			dir = estrjoin("/", home, ".cache/thumbnails", td.cache_dir, NULL);
+			dir = estrjoin("/", home, ".cache/thumbnails", subdir, NULL);
 		}
 	}
 
@@ -620,16 +1031,14 @@ static char *feh_thumbnail_get_prefix(void)
 
 char *feh_thumbnail_get_name(char *uri)
 {
-	char *prefix, *thumb_file = NULL, *md5_name;
+	char *thumb_file = NULL, *md5_name;
 
 	/* FIXME: make sure original file isn't under ~/.thumbnails */
 
-	prefix = feh_thumbnail_get_prefix();
-	if (prefix) {
+	if (td.cache_prefix) {
 		md5_name = feh_thumbnail_get_name_md5(uri);
-		thumb_file = estrjoin("/", prefix, md5_name, NULL);
+		thumb_file = estrjoin("/", td.cache_prefix, md5_name, NULL);
 		free(md5_name);
-		free(prefix);
 	}
 
 	return thumb_file;
@@ -689,13 +1098,10 @@ int feh_thumbnail_generate(Imlib_Image * image, feh_file * file,
 	int w, h, thumb_w, thumb_h;
 	Imlib_Image im_temp;
 	struct stat sb;
-	char c_width[8], c_height[8];
-	char *tmp_thumb_file, *prefix;
-	int tmp_fd;
 
-	if (feh_load_image(&im_temp, file) != 0) {
-		*orig_w = w = gib_imlib_image_get_width(im_temp);
-		*orig_h = h = gib_imlib_image_get_height(im_temp);
+	if (feh_load_thumbnail(&im_temp, file, td.cache_dim, td.cache_dim) != 0) {
+		*orig_w = w = feh_image_get_width(im_temp);
+		*orig_h = h = feh_image_get_height(im_temp);
 		thumb_w = td.cache_dim;
 		thumb_h = td.cache_dim;
 
@@ -714,33 +1120,13 @@ int feh_thumbnail_generate(Imlib_Image * image, feh_file * file,
 			return 1;
 		}
 
-		*image = gib_imlib_create_cropped_scaled_image(im_temp, 0, 0, w, h,
-				thumb_w, thumb_h, 1);
+		*image = gib_imlib_create_cropped_scaled_image(im_temp, 0, 0,
+				gib_imlib_image_get_width(im_temp),
+				gib_imlib_image_get_height(im_temp), thumb_w, thumb_h, 1);
 
-		if (!stat(file->filename, &sb)) {
-			char c_mtime[128];
-			sprintf(c_mtime, "%d", (int)sb.st_mtime);
-			snprintf(c_width, 8, "%d", w);
-			snprintf(c_height, 8, "%d", h);
-			prefix = feh_thumbnail_get_prefix();
-			if (prefix == NULL) {
-				gib_imlib_free_image_and_decache(im_temp);
-				return 0;
-			}
-			tmp_thumb_file = estrjoin("/", prefix, ".feh_thumbnail_XXXXXX", NULL);
-			free(prefix);
-			tmp_fd = mkstemp(tmp_thumb_file);
-			if (!feh_png_write_png_fd(*image, tmp_fd, "Thumb::URI", uri,
-					"Thumb::MTime", c_mtime,
-					"Thumb::Image::Width", c_width,
-					"Thumb::Image::Height", c_height)) {
-				rename(tmp_thumb_file, thumb_file);
-			} else {
-				unlink(tmp_thumb_file);
-			}
-			close(tmp_fd);
-			free(tmp_thumb_file);
-		}
+		if (!stat(file->filename, &sb))
+			feh_thumbnail_queue_write(&cache_index, *image, thumb_file, uri,
+					sb.st_mtime, w, h);
 
 		gib_imlib_free_image_and_decache(im_temp);
 
@@ -751,35 +1137,16 @@ int feh_thumbnail_generate(Imlib_Image * image, feh_file * file,
 }
 
 int feh_thumbnail_get_generated(Imlib_Image * image, feh_file * file,
-	char *thumb_file, int * orig_w, int * orig_h)
+	char *thumb_file, char *uri, int * orig_w, int * orig_h)
 {
 	struct stat sb;
-	char *c_mtime;
-	char *c_width, *c_height;
-	time_t mtime = 0;
-	gib_hash *hash;
 
 	if (!stat(file->filename, &sb)) {
-		hash = feh_png_read_comments(thumb_file);
-		if (hash != NULL) {
-			c_mtime  = (char *) gib_hash_get(hash, "Thumb::MTime");
-			c_width  = (char *) gib_hash_get(hash, "Thumb::Image::Width");
-			c_height = (char *) gib_hash_get(hash, "Thumb::Image::Height");
-			if (c_mtime != NULL)
-				mtime = (time_t) strtol(c_mtime, NULL, 10);
-			if (c_width != NULL)
-				*orig_w = atoi(c_width);
-			if (c_height != NULL)
-				*orig_h = atoi(c_height);
-			gib_hash_free_and_data(hash);
-		}
-
-		/* FIXME: should we bother about Thumb::URI? */
-		if (mtime == sb.st_mtime) {
-			feh_load_image_char(image, thumb_file);
-
+		*image = feh_png_load_thumbnail(thumb_file, uri, sb.st_mtime,
+				orig_w, orig_h);
+		if (*image)
 			return (1);
-		}
+		*orig_w = *orig_h = 0;
 	}
 
 	return (0);
@@ -908,13 +1275,53 @@ feh_file* feh_thumbnail_get_selected_file(void)
 	return NULL;
 }
 
-int feh_thumbnail_setup_thumbnail_dir(void)
+/*
+ * Selects the XDG thumbnail size for --thumb-width/--thumb-height and
+ * creates its directory. Returns whether thumbnails will be cached.
+ */
+int feh_thumbnail_setup_cache(void)
+{
+	td.cache_thumbnails = opt.cache_thumbnails;
+
+	if (td.cache_thumbnails) {
+		if (opt.thumb_w > opt.thumb_h)
+			td.cache_dim = opt.thumb_w;
+		else
+			td.cache_dim = opt.thumb_h;
+
+		if (td.cache_dim > 1024) {
+			/* Not specified by XDG thumbnail standard */
+			td.cache_thumbnails = 0;
+		} else if (td.cache_dim > 512) {
+			td.cache_dim = 1024;
+			td.cache_dir = estrdup("xx-large");
+		} else if (td.cache_dim > 256) {
+			td.cache_dim = 512;
+			td.cache_dir = estrdup("x-large");
+		} else if (td.cache_dim > 128) {
+			td.cache_dim = 256;
+			td.cache_dir = estrdup("large");
+		} else {
+			td.cache_dim = 128;
+			td.cache_dir = estrdup("normal");
+		}
+		if (td.cache_thumbnails) {
+			td.cache_prefix = feh_thumbnail_get_prefix(td.cache_dir);
+			td.fail_prefix = feh_thumbnail_get_prefix("fail/" PACKAGE "-" VERSION);
+			if (feh_thumbnail_setup_thumbnail_dir(td.cache_prefix))
+				feh_thumbnail_read_index(&cache_index, td.cache_prefix);
+			if (feh_thumbnail_setup_thumbnail_dir(td.fail_prefix))
+				feh_thumbnail_read_index(&fail_index, td.fail_prefix);
+		}
+	}
+	return(td.cache_thumbnails);
+}
+
+int feh_thumbnail_setup_thumbnail_dir(char *dir)
 {
 	int status = 0;
 	struct stat sb;
-	char *dir, *p;
-
-	dir = feh_thumbnail_get_prefix();
+	char *p;
 
 	if (dir) {
 		if (!stat(dir, &sb)) {
@@ -941,9 +1348,9 @@ int feh_thumbnail_setup_thumbnail_dir(void)
 				if (mkdir(dir, 0700) == -1) {
 					weprintf("unable to create directory %s", dir);
 				}
-			}
+			} else
+				status = 1;
 		}
-		free(dir);
 	}
 
 	return status;
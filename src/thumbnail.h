@@ -57,10 +57,13 @@ typedef struct thumbmode_data {
 
 	int max_column_w;        /* FIXME: description */
 	int vertical;            /* == !opt.limit_w && opt.limit_h */
+	int next_x, next_y;      /* position of the next thumbnail */
 
 	int cache_thumbnails;    /* use cached thumbnails from ~/.thumbnails */
 	int cache_dim;           /* 128 = 128x128 ("normal"), 256 = 256x256 ("large") */
 	char *cache_dir;         /* "normal"/"large" (.thumbnails/...) */
+	char *cache_prefix;      /* full path of cache_dir */
+	char *fail_prefix;       /* directory for images which failed to load */
 	feh_thumbnail *selected;     /* currently selected thumbnail */
 
 } thumbmode_data;
@@ -70,12 +73,14 @@ feh_file *feh_thumbnail_get_file_from_coords(int x, int y);
 feh_thumbnail *feh_thumbnail_get_thumbnail_from_coords(int x, int y);
 feh_thumbnail *feh_thumbnail_get_from_file(feh_file * file);
 void feh_thumbnail_mark_removed(feh_file * file, int deleted);
+int feh_thumbnail_add(feh_file * file);
+void feh_thumbnail_stream_update(gib_list * added);
 
 void feh_thumbnail_calculate_geometry(void);
 
 int feh_thumbnail_get_thumbnail(Imlib_Image * image, feh_file * file, int * orig_w, int * orig_h);
 int feh_thumbnail_generate(Imlib_Image * image, feh_file * file, char *thumb_file, char *uri, int * orig_w, int * orig_h);
-int feh_thumbnail_get_generated(Imlib_Image * image, feh_file * file, char * thumb_file, int * orig_w, int * orig_h);
+int feh_thumbnail_get_generated(Imlib_Image * image, feh_file * file, char * thumb_file, char * uri, int * orig_w, int * orig_h);
 char *feh_thumbnail_get_name(char *uri);
 char *feh_thumbnail_get_name_uri(char *name);
 char *feh_thumbnail_get_name_md5(char *uri);
@@ -86,6 +91,8 @@ void feh_thumbnail_select_prev(winwidget winwid, int jump);
 void feh_thumbnail_show_selected(void);
 feh_file *feh_thumbnail_get_selected_file(void);
 
-int feh_thumbnail_setup_thumbnail_dir(void);
+int feh_thumbnail_setup_cache(void);
+void feh_thumbnail_flush_cache(void);
+int feh_thumbnail_setup_thumbnail_dir(char *dir);
 
 #endif
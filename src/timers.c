@@ -183,3 +183,21 @@ void feh_add_unique_timer(void (*func) (void *data), void *data, double in)
 		i = 0;
 	return;
 }
+
+/*
+ * Start-up milestones ("first image shown", "filelist complete"), reported
+ * relative to feh_timing_start with --verbose.
+ */
+static double timing_start = 0.0;
+
+void feh_timing_start(void)
+{
+	timing_start = feh_get_time();
+}
+
+void feh_timing_event(char *event)
+{
+	if (opt.verbose)
+		fprintf(stderr, PACKAGE ": %s after %.3f s\n", event,
+				feh_get_time() - timing_start);
+}
@@ -40,6 +40,8 @@ double feh_get_time(void);
 void feh_remove_timer_by_data(void *data);
 void feh_add_timer(void (*func) (void *data), void *data, double in, char *name);
 void feh_add_unique_timer(void (*func) (void *data), void *data, double in);
+void feh_timing_start(void);
+void feh_timing_event(char *event);
 
 extern fehtimer first_timer;
 
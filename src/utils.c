@@ -183,6 +183,38 @@ char *feh_unique_filename(char *path, char *basename)
 	return(tmpname);
 }
 
+/*
+ * Creates the directory path (with mode 0700) including any missing parents.
+ * Returns 1 if path is a directory afterwards.
+ */
+int feh_mkdir_p(char *path)
+{
+	struct stat st;
+	char *dir = estrdup(path);
+	char *p = dir;
+	int err;
+
+	do {
+		if ((p = strchr(p + 1, '/')))
+			*p = '\0';
+		if (mkdir(dir, 0700) && ((err = errno) != EEXIST) && stat(dir, &st)) {
+			errno = err;
+			weprintf("unable to create directory %s:", dir);
+			free(dir);
+			return(0);
+		}
+		if (p)
+			*p = '/';
+	} while (p);
+	free(dir);
+
+	if (stat(path, &st) || !S_ISDIR(st.st_mode)) {
+		weprintf("%s should be a directory", path);
+		return(0);
+	}
+	return(1);
+}
+
 /* reads file into a string, but limits o 4095 chars and ensures a \0 */
 char *ereadfile(char *path)
 {
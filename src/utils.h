@@ -45,6 +45,7 @@ void *_erealloc(void *ptr, size_t n);
 char *estrjoin(const char *separator, ...);
 char path_is_url(char *path);
 char *feh_unique_filename(char *path, char *basename);
+int feh_mkdir_p(char *path);
 char *ereadfile(char *path);
 char *shell_escape(char *input);
 
@@ -0,0 +1,397 @@
+/* watch.c
+
+Copyright (C) 2024 feh contributors.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to
+deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+sell copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies of the Software and its documentation and acknowledgment shall be
+given in the documentation and software packages that this Software was
+used.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#include "feh.h"
+#include "filelist.h"
+#include "options.h"
+#include "winwidget.h"
+#include "thumbnail.h"
+#include "watch.h"
+#include "probe.h"
+
+#ifdef HAVE_INOTIFY
+#include <sys/inotify.h>
+
+/*
+ * --watch: every directory which contributes to the filelist is watched
+ * with inotify. Files which are written to, moved into or removed from these
+ * directories are added to or removed from the filelist (and the thumbnail
+ * window) as they come and go, without scanning anything else. With
+ * --recursive, new subdirectories are scanned and watched as well.
+ *
+ * This uses its own inotify instance, since the auto-reload watches of the
+ * image windows (see winwidget_inotify_add) would otherwise replace the
+ * masks of the same directories.
+ */
+
+#define WATCH_MASK (IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM \
+		| IN_DELETE | IN_ONLYDIR)
+#define WATCH_BUFFER_LEN (1024 * (sizeof(struct inotify_event) + 16))
+
+static int watch_fd = -1;
+
+/* watched directory for each watch descriptor */
+static char **watch_dirs = NULL;
+static int watch_dirs_size = 0;
+
+/*
+ * filelist nodes by file name, so that removals do not need to search the
+ * filelist. Built on the first event, and dropped when the filelist is
+ * replaced.
+ */
+typedef struct feh_watch_entry {
+	gib_list *node;
+	struct feh_watch_entry *next;
+} feh_watch_entry;
+
+static feh_watch_entry **watch_index = NULL;
+static unsigned int watch_index_size = 0;
+static unsigned int watch_index_count = 0;
+
+static unsigned int feh_watch_hash(char *filename)
+{
+	unsigned int hash = 2166136261u;
+
+	for (; *filename; filename++) {
+		hash ^= (unsigned char) *filename;
+		hash *= 16777619u;
+	}
+	return(hash);
+}
+
+static void feh_watch_index_insert(gib_list * node)
+{
+	feh_watch_entry **old_index = watch_index, *entry, *next;
+	unsigned int old_size = watch_index_size, i, slot;
+
+	if (watch_index_count >= watch_index_size / 2) {
+		watch_index_size = watch_index_size ? 2 * watch_index_size : 1024;
+		watch_index = emalloc(watch_index_size * sizeof(feh_watch_entry *));
+		memset(watch_index, 0, watch_index_size * sizeof(feh_watch_entry *));
+		for (i = 0; i < old_size; i++)
+			for (entry = old_index[i]; entry; entry = next) {
+				next = entry->next;
+				slot = feh_watch_hash(FEH_FILE(entry->node->data)->filename)
+					& (watch_index_size - 1);
+				entry->next = watch_index[slot];
+				watch_index[slot] = entry;
+			}
+		free(old_index);
+	}
+
+	slot = feh_watch_hash(FEH_FILE(node->data)->filename)
+		& (watch_index_size - 1);
+	entry = emalloc(sizeof(feh_watch_entry));
+	entry->node = node;
+	entry->next = watch_index[slot];
+	watch_index[slot] = entry;
+	watch_index_count++;
+}
+
+static gib_list *feh_watch_index_find(char *filename)
+{
+	feh_watch_entry *entry;
+	gib_list *l;
+
+	if (!watch_index)
+		for (l = filelist; l; l = l->next)
+			feh_watch_index_insert(l);
+
+	if (!watch_index)
+		return(NULL);
+
+	for (entry = watch_index[feh_watch_hash(filename) & (watch_index_size - 1)];
+			entry; entry = entry->next)
+		if (!strcmp(FEH_FILE(entry->node->data)->filename, filename))
+			return(entry->node);
+	return(NULL);
+}
+
+void feh_watch_forget(gib_list * node)
+{
+	feh_watch_entry **entry, *doomed;
+
+	if (!watch_index)
+		return;
+
+	for (entry = &watch_index[feh_watch_hash(FEH_FILE(node->data)->filename)
+			& (watch_index_size - 1)]; *entry; entry = &((*entry)->next))
+		if ((*entry)->node == node) {
+			doomed = *entry;
+			*entry = doomed->next;
+			free(doomed);
+			watch_index_count--;
+			return;
+		}
+}
+
+void feh_watch_invalidate(void)
+{
+	feh_watch_entry *entry, *next;
+	unsigned int i;
+
+	for (i = 0; i < watch_index_size; i++)
+		for (entry = watch_index[i]; entry; entry = next) {
+			next = entry->next;
+			free(entry);
+		}
+	free(watch_index);
+	watch_index = NULL;
+	watch_index_size = watch_index_count = 0;
+}
+
+void feh_watch_add_dir(char *path)
+{
+	int wd;
+
+	if (!opt.watch)
+		return;
+
+	if ((watch_fd == -1)
+			&& ((watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1)) {
+		weprintf("inotify_init failed:");
+		weprintf("Disabling --watch");
+		opt.watch = 0;
+		return;
+	}
+
+	if ((wd = inotify_add_watch(watch_fd, path, WATCH_MASK)) == -1) {
+		weprintf("cannot watch %s:", path);
+		return;
+	}
+
+	if (wd >= watch_dirs_size) {
+		watch_dirs = erealloc(watch_dirs, (wd + 64) * sizeof(char *));
+		memset(watch_dirs + watch_dirs_size, 0,
+				(wd + 64 - watch_dirs_size) * sizeof(char *));
+		watch_dirs_size = wd + 64;
+	}
+	free(watch_dirs[wd]);
+	watch_dirs[wd] = estrdup(path);
+}
+
+/* Stops watching path and all directories below it */
+static void feh_watch_remove_dirs(char *path)
+{
+	size_t len = strlen(path);
+	int wd;
+
+	for (wd = 0; wd < watch_dirs_size; wd++)
+		if (watch_dirs[wd] && !strncmp(watch_dirs[wd], path, len)
+				&& ((watch_dirs[wd][len] == '/') || !watch_dirs[wd][len])) {
+			inotify_rm_watch(watch_fd, wd);
+			free(watch_dirs[wd]);
+			watch_dirs[wd] = NULL;
+		}
+}
+
+/* Returns 1 if the thumbnail window needs to be redrawn */
+static int feh_watch_add_file(feh_file * file)
+{
+	gib_list *node;
+
+	if (feh_watch_index_find(file->filename) || !(node = feh_filelist_add(file))) {
+		feh_file_free(file);
+		return(0);
+	}
+	D(("Added %s to the filelist\n", file->filename));
+	feh_watch_index_insert(node);
+
+	if (opt.thumbs)
+		return(feh_thumbnail_add(file));
+	return(0);
+}
+
+static void feh_watch_remove_file(gib_list * node)
+{
+	int i;
+
+	D(("Removing %s from the filelist\n", FEH_FILE(node->data)->filename));
+
+	/* windows showing the file move on, as if it had been removed with <d> */
+	for (i = window_num - 1; i >= 0; i--)
+		if (windows[i]->file == node) {
+			feh_filelist_image_remove(windows[i], 0);
+			return;
+		}
+
+	if (opt.thumbs)
+		feh_thumbnail_mark_removed(FEH_FILE(node->data), 1);
+	filelist = feh_file_remove_from_list(filelist, node);
+}
+
+static int feh_watch_cmp_name(const void *name1, const void *name2)
+{
+	return(strcmp(*(char **) name1, *(char **) name2));
+}
+
+/*
+ * Events were lost since the inotify queue overflowed, so scan everything
+ * again. The slideshow is refreshed like --reload does. Other windows hold
+ * on to the filelist nodes and feh_files, so there the new scan is compared
+ * with the filelist and the differences are handled like events.
+ *
+ * Returns 1 if the thumbnail window needs to be redrawn.
+ */
+static int feh_watch_rescan(void)
+{
+	winwidget w = winwidget_get_first_window_of_type(WIN_TYPE_SLIDESHOW);
+	gib_list *l, *next, *scan;
+	char **names, *name;
+	int count, i = 0, redraw = 0;
+
+	weprintf("inotify event queue overflowed, scanning everything again");
+	feh_watch_invalidate();
+
+	if (w && current_file) {
+		current_file = feh_filelist_rescan(current_file);
+		w->file = current_file;
+		feh_reload_image(w, 1, 0);
+		return(0);
+	}
+
+	scan = gib_list_reverse(feh_filelist_scan());
+	count = gib_list_length(scan);
+	names = emalloc((count + 1) * sizeof(char *));
+	for (l = scan; l; l = l->next)
+		names[i++] = FEH_FILE(l->data)->filename;
+	qsort(names, count, sizeof(char *), feh_watch_cmp_name);
+
+	for (l = filelist; l; l = next) {
+		next = l->next;
+		name = FEH_FILE(l->data)->filename;
+		if (!bsearch(&name, names, count, sizeof(char *), feh_watch_cmp_name))
+			feh_watch_remove_file(l);
+	}
+	free(names);
+
+	for (l = scan; l; l = l->next)
+		redraw |= feh_watch_add_file(l->data);
+	gib_list_free(scan);
+	return(redraw);
+}
+
+/* Returns 1 if the thumbnail window needs to be redrawn */
+static int feh_watch_handle_event(struct inotify_event *event)
+{
+	gib_list *l, *next, *added, *saved;
+	struct stat st;
+	char *path;
+	size_t len;
+	int redraw = 0;
+
+	if ((event->wd < 0) || (event->wd >= watch_dirs_size)
+			|| !watch_dirs[event->wd])
+		return(0);
+
+	if (event->mask & IN_IGNORED) {
+		free(watch_dirs[event->wd]);
+		watch_dirs[event->wd] = NULL;
+		return(0);
+	}
+	if (!event->len)
+		return(0);
+
+	path = estrjoin("/", watch_dirs[event->wd], event->name, NULL);
+
+	if ((event->mask & IN_ISDIR) && (event->mask & (IN_CREATE | IN_MOVED_TO))) {
+		/* it may already have been moved on */
+		if (opt.recursive && !stat(path, &st) && S_ISDIR(st.st_mode)) {
+			/* scan it like add_file_to_filelist_recursively would have */
+			saved = filelist;
+			filelist = NULL;
+			add_file_to_filelist_recursively(path, FILELIST_CONTINUE);
+			added = gib_list_reverse(filelist);
+			filelist = saved;
+			for (l = added; l; l = l->next)
+				redraw |= feh_watch_add_file(l->data);
+			gib_list_free(added);
+		}
+	} else if (event->mask & IN_ISDIR) {
+		if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+			feh_watch_remove_dirs(path);
+			len = strlen(path);
+			for (l = filelist; l; l = next) {
+				next = l->next;
+				if (!strncmp(FEH_FILE(l->data)->filename, path, len)
+						&& (FEH_FILE(l->data)->filename[len] == '/'))
+					feh_watch_remove_file(l);
+			}
+		}
+	} else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+		if (feh_probe_name_wanted(path))
+			redraw = feh_watch_add_file(feh_file_new(path));
+	} else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+		if ((l = feh_watch_index_find(path)))
+			feh_watch_remove_file(l);
+	}
+
+	free(path);
+	return(redraw);
+}
+
+void feh_watch_fdset(fd_set * fdset, int *fdsize)
+{
+	/* events are queued until the scan is complete, see --stream */
+	if ((watch_fd == -1) || feh_filelist_streaming())
+		return;
+
+	FD_SET(watch_fd, fdset);
+	if (watch_fd >= *fdsize)
+		*fdsize = watch_fd + 1;
+}
+
+void feh_watch_handle_fdset(fd_set * fdset)
+{
+	char buf[WATCH_BUFFER_LEN]
+		__attribute__ ((aligned(__alignof__(struct inotify_event))));
+	struct inotify_event *event;
+	winwidget w;
+	int i = 0, len, redraw = 0, overflow = 0;
+
+	if ((watch_fd == -1) || !FD_ISSET(watch_fd, fdset))
+		return;
+
+	if ((len = read(watch_fd, buf, sizeof(buf))) <= 0) {
+		if ((len == 0) || ((errno != EINTR) && (errno != EAGAIN)))
+			weprintf("inotify event read failed:");
+		return;
+	}
+
+	while (i < len) {
+		event = (struct inotify_event *) &buf[i];
+		if (event->mask & IN_Q_OVERFLOW)
+			overflow = 1;
+		else
+			redraw |= feh_watch_handle_event(event);
+		i += sizeof(struct inotify_event) + event->len;
+	}
+	if (overflow)
+		redraw |= feh_watch_rescan();
+
+	if (redraw && (w = winwidget_get_first_window_of_type(WIN_TYPE_THUMBNAIL)))
+		winwidget_render_image(w, 0, 1);
+}
+#endif				/* HAVE_INOTIFY */
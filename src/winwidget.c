@@ -135,8 +135,8 @@ winwidget winwidget_create_from_file(gib_list * list, char type)
 	}
 
 	if (!ret->win) {
-		ret->w = ret->im_w = gib_imlib_image_get_width(ret->im);
-		ret->h = ret->im_h = gib_imlib_image_get_height(ret->im);
+		ret->w = ret->im_w = feh_image_get_width(ret->im);
+		ret->h = ret->im_h = feh_image_get_height(ret->im);
 		D(("image is %dx%d pixels, format %s\n", ret->w, ret->h, gib_imlib_image_format(ret->im)));
 		if (opt.full_screen) {
 			ret->full_screen = True;
@@ -462,6 +462,7 @@ void winwidget_render_image(winwidget winwid, int resize, int force_alias)
 	int sx, sy, sw, sh, dx, dy, dw, dh;
 	int calc_w, calc_h;
 	int antialias = 0;
+	int scale;
 
 	if (!winwid->full_screen && resize) {
 		if (opt.default_zoom) {
@@ -519,6 +520,13 @@ void winwidget_render_image(winwidget winwid, int resize, int force_alias)
 	if (opt.keep_zoom_vp)
 		winwidget_sanitise_offsets(winwid);
 
+	/* A reduced-size decode is only good up to its own resolution */
+	scale = feh_image_get_scale(winwid->im);
+	if ((scale > 1) && ((winwid->zoom * scale > 1.0) || winwid->has_rotated)) {
+		winwidget_ensure_full_image(winwid);
+		scale = feh_image_get_scale(winwid->im);
+	}
+
 	if (!winwid->full_screen && ((gib_imlib_image_has_alpha(winwid->im))
 				     || (opt.geom_flags & (WidthValue | HeightValue))
 				     || (winwid->im_x || winwid->im_y)
@@ -573,6 +581,13 @@ void winwidget_render_image(winwidget winwid, int resize, int force_alias)
 	if ((winwid->zoom != 1.0 || winwid->has_rotated) && !force_alias && !winwid->force_aliasing)
 		antialias = 1;
 
+	if (scale > 1) {
+		sx /= scale;
+		sy /= scale;
+		sw = (sw + scale - 1) / scale;
+		sh = (sh + scale - 1) / scale;
+	}
+
 	D(("winwidget_render(): winwid->im_angle = %f\n", winwid->im_angle));
 	if (winwid->has_rotated)
 		gib_imlib_render_image_part_on_drawable_at_size_with_rotation
@@ -728,7 +743,7 @@ void winwidget_destroy(winwidget winwid)
 		free(winwid->name);
 	if (winwid->gc)
 		XFreeGC(disp, winwid->gc);
-	if (winwid->im)
+	if (winwid->im && !feh_imagecache_put(winwid->im))
 		gib_imlib_free_image_and_decache(winwid->im);
 	free(winwid);
 	return;
@@ -840,7 +855,14 @@ int winwidget_loadimage(winwidget winwid, feh_file * file)
 #ifdef HAVE_INOTIFY
     winwidget_inotify_remove(winwid);
 #endif
-    int res = feh_load_image(&(winwid->im), file);
+    int max_w = 0, max_h = 0;
+    winwidget_get_target_size(winwid, &max_w, &max_h);
+    int res = feh_prefetch_take(file, &(winwid->im), max_w, max_h);
+    if (res < 0) {
+        res = feh_load_image_scaled(&(winwid->im), file, max_w, max_h);
+        if (res)
+            feh_imagecache_loan(file, winwid->im);
+    }
 #ifdef HAVE_INOTIFY
     if (res) {
         winwidget_inotify_add(winwid, file);
@@ -1069,9 +1091,66 @@ void winwidget_rename(winwidget winwid, char *newname)
 	return;
 }
 
+/*
+ * Determines the area an image loaded into winwid will be fitted into, so
+ * that it can be decoded at a reduced size (see feh_load_image_scaled).
+ * Returns 0 if the image may be shown at or above its original resolution.
+ */
+int winwidget_get_target_size(winwidget winwid, int *w, int *h)
+{
+	if (opt.default_zoom || opt.keep_zoom_vp || (opt.zoom_mode == ZOOM_MODE_FILL)
+			|| (winwid && winwid->has_rotated))
+		return(0);
+
+	if (opt.full_screen) {
+		if (winwid && winwid->win && winwid->full_screen) {
+			*w = winwid->w;
+			*h = winwid->h;
+		} else {
+			*w = scr->width;
+			*h = scr->height;
+		}
+	} else if (opt.scale_down) {
+		if ((opt.geom_flags & WidthValue) && (opt.geom_flags & HeightValue)) {
+			*w = opt.geom_w;
+			*h = opt.geom_h;
+		} else {
+			*w = scr->width;
+			*h = scr->height;
+		}
+	} else
+		return(0);
+
+	return((*w > 0) && (*h > 0));
+}
+
+/*
+ * Replaces a reduced-size decode of winwid's image with the full-size one.
+ */
+void winwidget_ensure_full_image(winwidget winwid)
+{
+	Imlib_Image im;
+	int im_w, im_h;
+
+	if (!winwid->im || !winwid->file || (feh_image_get_scale(winwid->im) == 1))
+		return;
+
+	D(("%s: loading full-size image\n", FEH_FILE(winwid->file->data)->filename));
+	if (!feh_load_image(&im, FEH_FILE(winwid->file->data)))
+		return;
+	feh_imagecache_loan(FEH_FILE(winwid->file->data), im);
+
+	im_w = winwid->im_w;
+	im_h = winwid->im_h;
+	winwidget_free_image(winwid);
+	winwid->im = im;
+	winwid->im_w = im_w;
+	winwid->im_h = im_h;
+}
+
 void winwidget_free_image(winwidget w)
 {
-	if (w->im) {
+	if (w->im && !feh_imagecache_put(w->im)) {
 		gib_imlib_free_image(w->im);
 	}
 	w->im = NULL;
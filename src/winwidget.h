@@ -132,6 +132,8 @@ void winwidget_show(winwidget winwid);
 void winwidget_show_menu(winwidget winwid);
 void winwidget_hide(winwidget winwid);
 void winwidget_destroy_all(void);
+int winwidget_get_target_size(winwidget winwid, int *w, int *h);
+void winwidget_ensure_full_image(winwidget winwid);
 void winwidget_free_image(winwidget w);
 void winwidget_center_image(winwidget w);
 void winwidget_render_image(winwidget winwid, int resize, int force_alias);
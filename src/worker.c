@@ -0,0 +1,573 @@
+/* worker.c
+
+Copyright (C) 2024 feh contributors.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to
+deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+sell copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies of the Software and its documentation and acknowledgment shall be
+given in the documentation and software packages that this Software was
+used.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#include "feh.h"
+#include "filelist.h"
+#include "options.h"
+#include "signals.h"
+#include "worker.h"
+#include <fcntl.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+typedef struct {
+	pid_t pid;
+	int fd;
+	feh_worker_job *job;
+	int retired;
+} feh_worker;
+
+struct feh_worker_request {
+	feh_worker_fn work;
+	int arg[4];
+	size_t len;
+};
+
+struct feh_worker_response {
+	int status;
+	int width;
+	int height;
+	int has_alpha;
+	int ret[4];
+	char format[16];
+};
+
+static feh_worker *workers = NULL;
+static int worker_num = 0;
+static int worker_busy = 0;
+
+int feh_worker_child = 0;
+
+static int feh_worker_write(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = send(fd, p, len, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR && !(feh_worker_child && sig_exit))
+			continue;
+		if (n <= 0)
+			return(0);
+		p += n;
+		len -= n;
+	}
+	return(1);
+}
+
+static int feh_worker_read(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = read(fd, p, len);
+		if (n < 0 && errno == EINTR && !(feh_worker_child && sig_exit))
+			continue;
+		if (n <= 0)
+			return(0);
+		p += n;
+		len -= n;
+	}
+	return(1);
+}
+
+static void feh_worker_main(int fd)
+{
+	struct feh_worker_request req;
+	struct feh_worker_response res;
+	feh_worker_job job;
+	DATA32 *data;
+
+	feh_worker_child = 1;
+
+	/*
+	 * Workers never talk to the X server and must not leave temporary
+	 * files behind for a conversion cache they will not be around to clean.
+	 */
+	opt.use_conversion_cache = 0;
+	opt.image_cache = 0;
+
+	while (!sig_exit && feh_worker_read(fd, &req, sizeof(req))) {
+		memset(&job, 0, sizeof(job));
+		job.filename = emalloc(req.len + 1);
+		if (!feh_worker_read(fd, job.filename, req.len))
+			break;
+		job.filename[req.len] = '\0';
+		memcpy(job.arg, req.arg, sizeof(job.arg));
+
+		job.status = req.work(&job);
+
+		memset(&res, 0, sizeof(res));
+		res.status = job.status;
+		memcpy(res.ret, job.ret, sizeof(res.ret));
+		memcpy(res.format, job.format, sizeof(res.format));
+		if (job.im) {
+			imlib_context_set_image(job.im);
+			res.width = imlib_image_get_width();
+			res.height = imlib_image_get_height();
+			res.has_alpha = imlib_image_has_alpha();
+			if (!res.format[0] && imlib_image_format())
+				strncpy(res.format, imlib_image_format(), sizeof(res.format) - 1);
+		}
+
+		if (!feh_worker_write(fd, &res, sizeof(res)))
+			break;
+		if (job.im) {
+			data = imlib_image_get_data_for_reading_only();
+			if (!feh_worker_write(fd, data, (size_t)res.width * res.height * sizeof(DATA32)))
+				break;
+			gib_imlib_free_image_and_decache(job.im);
+		}
+		free(job.filename);
+	}
+	_exit(0);
+}
+
+int feh_worker_cpus(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	if (n > 0)
+		return(n);
+#endif
+	return(1);
+}
+
+/*
+ * Returns the number of parallel jobs requested with --jobs (by default, one
+ * per CPU).
+ */
+int feh_worker_jobs(void)
+{
+	return(opt.jobs > 0 ? opt.jobs : feh_worker_cpus());
+}
+
+/*
+ * Makes sure that at least count workers are running. Returns the number
+ * of workers actually available, which may be less if fork fails.
+ */
+int feh_worker_init(int count)
+{
+	int sv[2];
+	int i, live = 0;
+	pid_t pid;
+
+	/* forget about dead workers, retired ones stay until their job is done */
+	for (i = 0; i < worker_num; i++) {
+		if (workers[i].fd < 0) {
+			memmove(&workers[i], &workers[i + 1],
+					(worker_num - i - 1) * sizeof(feh_worker));
+			worker_num--;
+			i--;
+		} else if (!workers[i].retired)
+			live++;
+	}
+
+	if (count <= live)
+		return(live);
+
+	workers = erealloc(workers, (worker_num + count - live) * sizeof(feh_worker));
+
+	while (live < count) {
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+			weprintf("Cannot create worker socket:");
+			break;
+		}
+		fflush(stdout);
+		fflush(stderr);
+		if ((pid = fork()) == -1) {
+			weprintf("Cannot start worker process:");
+			close(sv[0]);
+			close(sv[1]);
+			break;
+		} else if (pid == 0) {
+			close(sv[0]);
+			for (i = 0; i < worker_num; i++)
+				if (workers[i].fd >= 0)
+					close(workers[i].fd);
+			feh_worker_main(sv[1]);
+		}
+		close(sv[1]);
+		fcntl(sv[0], F_SETFD, FD_CLOEXEC);
+#ifdef SO_NOSIGPIPE
+		setsockopt(sv[0], SOL_SOCKET, SO_NOSIGPIPE, &(int){1}, sizeof(int));
+#endif
+		workers[worker_num].pid = pid;
+		workers[worker_num].fd = sv[0];
+		workers[worker_num].job = NULL;
+		workers[worker_num].retired = 0;
+		worker_num++;
+		live++;
+	}
+	D(("%d workers\n", live));
+	return(live);
+}
+
+/*
+ * Stops using the current workers: idle ones exit right away, busy ones
+ * once their job is done. Workers started afterwards are forked from feh's
+ * current state, so this must be called before starting workers which rely
+ * on state set up since the last feh_worker_init.
+ */
+void feh_worker_retire(void)
+{
+	int i;
+
+	for (i = 0; i < worker_num; i++) {
+		if (workers[i].fd < 0)
+			continue;
+		if (workers[i].job)
+			workers[i].retired = 1;
+		else {
+			close(workers[i].fd);
+			workers[i].fd = -1;
+			waitpid(workers[i].pid, NULL, 0);
+		}
+	}
+}
+
+static void feh_worker_kill(feh_worker * w)
+{
+	close(w->fd);
+	w->fd = -1;
+	kill(w->pid, SIGKILL);
+	waitpid(w->pid, NULL, 0);
+}
+
+/*
+ * Hands job to an idle worker. Returns 0 if all workers are busy (or dead),
+ * in which case the caller still owns job and should load the image itself
+ * or try again later.
+ */
+int feh_worker_submit(feh_worker_job * job)
+{
+	struct feh_worker_request req;
+	int i;
+
+	for (i = 0; i < worker_num; i++) {
+		if ((workers[i].fd < 0) || workers[i].job || workers[i].retired)
+			continue;
+		memset(&req, 0, sizeof(req));
+		req.work = job->work;
+		req.len = strlen(job->filename);
+		memcpy(req.arg, job->arg, sizeof(req.arg));
+		if (!feh_worker_write(workers[i].fd, &req, sizeof(req))
+				|| !feh_worker_write(workers[i].fd, job->filename, req.len)) {
+			feh_worker_kill(&workers[i]);
+			continue;
+		}
+		job->status = 0;
+		job->lost = 0;
+		job->im = NULL;
+		workers[i].job = job;
+		worker_busy++;
+		return(1);
+	}
+	return(0);
+}
+
+int feh_worker_idle(void)
+{
+	int i, ret = 0;
+
+	for (i = 0; i < worker_num; i++)
+		if ((workers[i].fd >= 0) && !workers[i].job && !workers[i].retired)
+			ret++;
+	return(ret);
+}
+
+int feh_worker_busy(void)
+{
+	return(worker_busy);
+}
+
+static void feh_worker_finish(feh_worker * w)
+{
+	struct feh_worker_response res;
+	feh_worker_job *job = w->job;
+	DATA32 *data;
+	int ok = 0;
+
+	w->job = NULL;
+	worker_busy--;
+
+	if (feh_worker_read(w->fd, &res, sizeof(res))) {
+		ok = 1;
+		job->status = res.status;
+		memcpy(job->ret, res.ret, sizeof(job->ret));
+		memcpy(job->format, res.format, sizeof(job->format));
+		job->format[sizeof(job->format) - 1] = '\0';
+		if ((res.width > 0) && (res.height > 0)) {
+			ok = 0;
+			if ((job->im = imlib_create_image(res.width, res.height))) {
+				imlib_context_set_image(job->im);
+				data = imlib_image_get_data();
+				ok = feh_worker_read(w->fd, data,
+						(size_t)res.width * res.height * sizeof(DATA32));
+				imlib_image_put_back_data(data);
+				imlib_image_set_has_alpha(res.has_alpha);
+				if (job->format[0])
+					imlib_image_set_format(job->format);
+				if (!ok) {
+					gib_imlib_free_image_and_decache(job->im);
+					job->im = NULL;
+				}
+			}
+		}
+	}
+	if (!ok) {
+		weprintf("worker process %d died", (int)w->pid);
+		feh_worker_kill(w);
+		job->status = 0;
+		job->lost = 1;
+	} else if (w->retired) {
+		close(w->fd);
+		w->fd = -1;
+		waitpid(w->pid, NULL, 0);
+	}
+	if (job->done)
+		job->done(job);
+}
+
+void feh_worker_fdset(fd_set * fdset, int *fdsize)
+{
+	int i;
+
+	for (i = 0; i < worker_num; i++) {
+		if ((workers[i].fd >= 0) && workers[i].job) {
+			FD_SET(workers[i].fd, fdset);
+			if (workers[i].fd >= *fdsize)
+				*fdsize = workers[i].fd + 1;
+		}
+	}
+}
+
+/*
+ * Collects the results of all workers whose socket is readable according to
+ * fdset. Returns the number of finished jobs.
+ */
+int feh_worker_handle_fdset(fd_set * fdset)
+{
+	int i, ret = 0;
+
+	for (i = 0; i < worker_num; i++) {
+		if ((workers[i].fd >= 0) && workers[i].job
+				&& FD_ISSET(workers[i].fd, fdset)) {
+			feh_worker_finish(&workers[i]);
+			ret++;
+		}
+	}
+	return(ret);
+}
+
+/*
+ * Blocks until at least one running job has finished. Returns the number of
+ * finished jobs, or 0 if no job was running (or a signal asked us to exit).
+ */
+int feh_worker_wait(void)
+{
+	fd_set fdset;
+	int fdsize;
+
+	while (worker_busy && !sig_exit) {
+		fdsize = 0;
+		FD_ZERO(&fdset);
+		feh_worker_fdset(&fdset, &fdsize);
+		if (select(fdsize, &fdset, NULL, NULL, NULL) > 0)
+			return(feh_worker_handle_fdset(&fdset));
+		if (errno != EINTR)
+			break;
+	}
+	return(0);
+}
+
+/*
+ * Stops all workers. Jobs which are still running are finished with a
+ * status of 0 and marked as lost.
+ */
+void feh_worker_shutdown(void)
+{
+	feh_worker *w = workers;
+	int i, num = worker_num;
+
+	/* done callbacks must not find any workers to submit new jobs to */
+	workers = NULL;
+	worker_num = worker_busy = 0;
+
+	/* idle workers exit as soon as they notice that their socket was closed */
+	for (i = 0; i < num; i++) {
+		if (w[i].fd < 0)
+			continue;
+		close(w[i].fd);
+		if (w[i].job)
+			kill(w[i].pid, SIGKILL);
+		waitpid(w[i].pid, NULL, 0);
+	}
+
+	for (i = 0; i < num; i++) {
+		if ((w[i].fd >= 0) && w[i].job) {
+			w[i].job->status = 0;
+			w[i].job->lost = 1;
+			w[i].job->im = NULL;
+			if (w[i].job->done)
+				w[i].job->done(w[i].job);
+		}
+	}
+	free(w);
+}
+
+enum feh_worker_queue_state {
+	QUEUE_JOB_RUNNING,
+	QUEUE_JOB_DONE,
+	QUEUE_JOB_ABANDONED
+};
+
+typedef struct {
+	gib_list *file;
+	feh_worker_job job;
+	enum feh_worker_queue_state state;
+} feh_worker_queue_job;
+
+static void feh_worker_queue_done(feh_worker_job * job)
+{
+	feh_worker_queue_job *qj = job->data;
+
+	if (qj->state == QUEUE_JOB_ABANDONED) {
+		if (job->im)
+			gib_imlib_free_image_and_decache(job->im);
+		free(qj);
+	} else
+		qj->state = QUEUE_JOB_DONE;
+}
+
+/*
+ * Prepares q for running work on the files passed to feh_worker_queue_next
+ * and starts the workers if requested with --jobs. Files for which skip
+ * (if set) returns 1 are left to the caller. Returns 1 if workers are in use.
+ */
+int feh_worker_queue_init(feh_worker_queue * q, feh_worker_fn work,
+		feh_worker_skip_fn skip)
+{
+	memset(q, 0, sizeof(feh_worker_queue));
+	q->work = work;
+	q->skip = skip;
+	if (feh_worker_jobs() > 1)
+		q->max = 2 * feh_worker_init(feh_worker_jobs());
+	return(q->max > 0);
+}
+
+/*
+ * Hands the files following the last submitted one to idle workers. At most
+ * two jobs per worker are queued, counting finished ones whose results were
+ * not picked up yet. Remote files are left to the caller, so submission
+ * pauses there.
+ */
+static void feh_worker_queue_submit(feh_worker_queue * q)
+{
+	feh_worker_queue_job *qj;
+
+	while (q->next && feh_worker_idle() && (gib_list_length(q->jobs) < q->max)
+			&& !path_is_url(FEH_FILE(q->next->data)->filename)) {
+		if (q->skip && q->skip(FEH_FILE(q->next->data))) {
+			q->next = q->next->next;
+			continue;
+		}
+		qj = emalloc(sizeof(feh_worker_queue_job));
+		memset(qj, 0, sizeof(feh_worker_queue_job));
+		qj->file = q->next;
+		qj->job.work = q->work;
+		qj->job.done = feh_worker_queue_done;
+		qj->job.filename = FEH_FILE(q->next->data)->filename;
+		qj->job.data = qj;
+		if (!feh_worker_submit(&(qj->job))) {
+			free(qj);
+			break;
+		}
+		q->jobs = gib_list_add_end(q->jobs, qj);
+		q->next = q->next->next;
+	}
+}
+
+/*
+ * Must be called for each file in list order. If a worker has processed the
+ * file at l, stores its job in *job and returns 1 (job->status is 0 if the
+ * worker failed or feh is about to exit). Otherwise, returns 0 and the
+ * caller has to process the file itself. Either way, the following files
+ * are handed to the workers.
+ */
+int feh_worker_queue_next(feh_worker_queue * q, gib_list * l,
+		feh_worker_job * job)
+{
+	feh_worker_queue_job *qj;
+
+	if (!q->max)
+		return(0);
+
+	if (!q->jobs)
+		q->next = l;
+	feh_worker_queue_submit(q);
+
+	if (!q->jobs || (((feh_worker_queue_job *) q->jobs->data)->file != l))
+		return(0);
+
+	qj = q->jobs->data;
+	q->jobs = gib_list_remove(q->jobs, q->jobs);
+	while ((qj->state == QUEUE_JOB_RUNNING) && feh_worker_wait());
+
+	if (qj->state == QUEUE_JOB_RUNNING) {
+		/* we are about to exit */
+		qj->state = QUEUE_JOB_ABANDONED;
+		memset(job, 0, sizeof(feh_worker_job));
+		return(1);
+	}
+
+	memcpy(job, &(qj->job), sizeof(feh_worker_job));
+	free(qj);
+	feh_worker_queue_submit(q);
+	return(1);
+}
+
+/* Discards the results of all jobs in q which were not picked up */
+void feh_worker_queue_abandon(feh_worker_queue * q)
+{
+	gib_list *l;
+	feh_worker_queue_job *qj;
+
+	for (l = q->jobs; l; l = l->next) {
+		qj = l->data;
+		if (qj->state == QUEUE_JOB_DONE) {
+			if (qj->job.im)
+				gib_imlib_free_image_and_decache(qj->job.im);
+			free(qj);
+		} else
+			qj->state = QUEUE_JOB_ABANDONED;
+	}
+	gib_list_free(q->jobs);
+	q->jobs = q->next = NULL;
+	q->max = 0;
+}
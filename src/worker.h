@@ -0,0 +1,90 @@
+/* worker.h
+
+Copyright (C) 2024 feh contributors.
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to
+deal in the Software without restriction, including without limitation the
+rights to use, copy, modify, merge, publish, distribute, sublicense, and/or
+sell copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies of the Software and its documentation and acknowledgment shall be
+given in the documentation and software packages that this Software was
+used.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+THE AUTHORS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+*/
+
+#ifndef WORKER_H
+#define WORKER_H
+
+/*
+ * Imlib2 keeps its state in a global context and is not thread-safe, so
+ * background decoding happens in a small pool of forked worker processes.
+ * A job's work function runs inside a worker (which has a copy of feh's
+ * memory as of the fork) and may return an image, whose pixels are sent
+ * back to feh and re-assembled into an Imlib_Image before done is called.
+ */
+
+typedef struct __feh_worker_job feh_worker_job;
+
+typedef int (*feh_worker_fn) (feh_worker_job * job);
+typedef void (*feh_worker_done_fn) (feh_worker_job * job);
+
+struct __feh_worker_job {
+	feh_worker_fn work;
+	feh_worker_done_fn done;
+	char *filename;
+	int arg[4];
+	void *data;
+
+	int status;
+	int lost;		/* the worker went away before it was done */
+	Imlib_Image im;
+	int ret[4];
+	char format[16];
+};
+
+typedef int (*feh_worker_skip_fn) (feh_file * file);
+
+/*
+ * Runs work on the files of a list ahead of a caller which walks it in
+ * order, see feh_worker_queue_next.
+ */
+typedef struct {
+	feh_worker_fn work;
+	feh_worker_skip_fn skip;
+	gib_list *jobs;
+	gib_list *next;
+	int max;
+} feh_worker_queue;
+
+int feh_worker_init(int count);
+void feh_worker_retire(void);
+int feh_worker_cpus(void);
+int feh_worker_jobs(void);
+int feh_worker_submit(feh_worker_job * job);
+int feh_worker_idle(void);
+int feh_worker_busy(void);
+void feh_worker_fdset(fd_set * fdset, int *fdsize);
+int feh_worker_handle_fdset(fd_set * fdset);
+int feh_worker_wait(void);
+void feh_worker_shutdown(void);
+
+int feh_worker_queue_init(feh_worker_queue * q, feh_worker_fn work,
+		feh_worker_skip_fn skip);
+int feh_worker_queue_next(feh_worker_queue * q, gib_list * l,
+		feh_worker_job * job);
+void feh_worker_queue_abandon(feh_worker_queue * q);
+
+extern int feh_worker_child;
+
+#endif
@@ -2,7 +2,9 @@
 use strict;
 use warnings;
 use 5.010;
-use Test::Command tests => 73;
+use Cwd qw(getcwd);
+use File::Path qw(remove_tree);
+use Test::Command tests => 85;
 
 $ENV{HOME} = 'test';
 
@@ -114,6 +116,19 @@ for my $sort (qw/name filename width height pixels size format/) {
 	$cmd->stderr_like($re_warning);
 }
 
+# The second run reads image information from the metadata cache
+$ENV{XDG_CACHE_HOME} = getcwd() . '/test/cache';
+for my $run (qw/cold warm/) {
+	$cmd = Test::Command->new(
+		cmd => "$feh --cache-metadata --list $images --sort pixels" );
+
+	$cmd->exit_is_num(0);
+	$cmd->stdout_is_file("test/${list_dir}/pixels");
+	$cmd->stderr_like($re_warning);
+}
+remove_tree('test/cache');
+delete $ENV{XDG_CACHE_HOME};
+
 $cmd
   = Test::Command->new( cmd => "$feh --list $images --sort format --reverse" );
 
@@ -145,6 +160,13 @@ $cmd->exit_is_num(0);
 $cmd->stdout_is_file("test/${list_dir}/default");
 $cmd->stderr_is_eq('');
 
+# Filelists may use CRLF line endings and lack a final newline
+$cmd = Test::Command->new( cmd => "printf 'test/ok/gif\\r\\n\\ntest/ok/jpg\\n"
+	  . "test/ok/png\\r\\ntest/ok/pnm' | $feh --list --filelist -" );
+$cmd->exit_is_num(0);
+$cmd->stdout_is_file("test/${list_dir}/default");
+$cmd->stderr_is_eq('');
+
 $cmd = Test::Command->new(
 	cmd => "$feh --quiet --list --action 'echo %F \"%wx%h\" >&2' $images" );
 
@@ -176,6 +198,18 @@ else {
 	$cmd->stderr_is_file('test/no-loadable-files');
 }
 
+# test/ok contains no file with a .png extension
+$cmd = Test::Command->new( cmd => "$feh --list --extensions png test/ok" );
+
+$cmd->exit_is_num(1);
+$cmd->stdout_is_eq('');
+if ($has_help) {
+	$cmd->stderr_is_file('test/no-loadable-files.help');
+}
+else {
+	$cmd->stderr_is_file('test/no-loadable-files');
+}
+
 $cmd
   = Test::Command->new( cmd => "$feh --list --min-dimension 16x16 $images_ok" );
 